@@ -0,0 +1,175 @@
+/**
+ * Converts a llama2.c checkpoint (.bin: Config header followed by the weights
+ * in a fixed order) into the v2 container described in main/ckpt_image.h.
+ *
+ * usage: ckpt_pack <in.bin> <out.bin>
+ *
+ * The firmware build runs it on data/aidreams260K.bin, so the SPIFFS image
+ * always holds a v2 file; read_checkpoint() still tells the two formats apart
+ * by the magic. A v2 input is validated and copied unchanged.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ckpt_image.h"
+
+// the Config header of the legacy format, see llm.h
+typedef struct {
+    int32_t dim, hidden_dim, n_layers, n_heads, n_kv_heads, vocab_size, seq_len;
+} legacy_config_t;
+
+typedef struct {
+    const char *name;
+    uint32_t ndim;
+    uint32_t shape[4];
+} tensor_desc_t;
+
+static size_t tensor_count(const tensor_desc_t *t)
+{
+    size_t n = 1;
+    for (uint32_t i = 0; i < t->ndim; i++) {
+        n *= t->shape[i];
+    }
+    return n;
+}
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(*len);
+    if (buf && fread(buf, 1, *len, f) != *len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <in.bin> <out.bin>\n", argv[0]);
+        return 2;
+    }
+    size_t in_len;
+    uint8_t *in = read_file(argv[1], &in_len);
+    if (!in || in_len < sizeof(legacy_config_t)) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    // the firmware build packs data/ on every change: a file that is already v2 is copied as is
+    if (((const ckpt_header_t *)in)->magic == CKPT_MAGIC) {
+        if (!ckpt_validate(in, in_len)) {
+            fprintf(stderr, "%s is a corrupt v2 checkpoint\n", argv[1]);
+            return 1;
+        }
+        FILE *f = fopen(argv[2], "wb");
+        if (!f || fwrite(in, 1, in_len, f) != in_len || fclose(f) != 0) {
+            fprintf(stderr, "cannot write %s\n", argv[2]);
+            return 1;
+        }
+        printf("%s: already a v2 checkpoint, copied\n", argv[2]);
+        free(in);
+        return 0;
+    }
+
+    legacy_config_t c;
+    memcpy(&c, in, sizeof(c));
+    int shared = c.vocab_size > 0;
+    uint32_t vocab = abs(c.vocab_size);
+    uint32_t L = c.n_layers, dim = c.dim, hidden = c.hidden_dim;
+    uint32_t head_size = dim / c.n_heads;
+    uint32_t kv_dim = c.n_kv_heads * head_size;
+
+    // same order as memory_map_weights() in llm.c; shapes are (rows, cols) per layer
+    tensor_desc_t tensors[] = {
+        {"token_embedding", 2, {vocab, dim}},
+        {"rms_att_weight", 2, {L, dim}},
+        {"wq", 3, {L, dim, dim}},
+        {"wk", 3, {L, kv_dim, dim}},
+        {"wv", 3, {L, kv_dim, dim}},
+        {"wo", 3, {L, dim, dim}},
+        {"rms_ffn_weight", 2, {L, dim}},
+        {"w1", 3, {L, hidden, dim}},
+        {"w2", 3, {L, dim, hidden}},
+        {"w3", 3, {L, hidden, dim}},
+        {"rms_final_weight", 1, {dim}},
+        {"freq_cis", 2, {c.seq_len, head_size}}, // legacy RoPE tables, skipped
+        {"wcls", 2, {vocab, dim}},
+    };
+    int n_in = sizeof(tensors) / sizeof(tensors[0]) - (shared ? 1 : 0);
+    int n_tensors = n_in - 1;
+
+    ckpt_header_t hdr = {
+        .magic = CKPT_MAGIC,
+        .version = CKPT_VERSION,
+        .n_tensors = n_tensors,
+        .dir_off = sizeof(ckpt_header_t),
+        .alignment = CKPT_ALIGN,
+        .dim = c.dim,
+        .hidden_dim = c.hidden_dim,
+        .n_layers = c.n_layers,
+        .n_heads = c.n_heads,
+        .n_kv_heads = c.n_kv_heads,
+        .vocab_size = vocab,
+        .seq_len = c.seq_len,
+    };
+    ckpt_tensor_t *dir = calloc(n_tensors, sizeof(ckpt_tensor_t));
+    const float **src = calloc(n_tensors, sizeof(float *));
+    size_t in_pos = sizeof(legacy_config_t);
+    uint32_t out_pos = hdr.dir_off + n_tensors * sizeof(ckpt_tensor_t);
+    for (int i = 0, j = 0; i < n_in; i++) {
+        size_t bytes = tensor_count(&tensors[i]) * sizeof(float);
+        if (in_pos + bytes > in_len) {
+            fprintf(stderr, "%s is truncated at tensor %s\n", argv[1], tensors[i].name);
+            return 1;
+        }
+        if (strcmp(tensors[i].name, "freq_cis") != 0) {
+            out_pos = (out_pos + CKPT_ALIGN - 1) / CKPT_ALIGN * CKPT_ALIGN;
+            ckpt_tensor_t *t = &dir[j];
+            strncpy(t->name, tensors[i].name, CKPT_NAME_LEN - 1);
+            t->dtype = CKPT_DTYPE_F32;
+            t->ndim = tensors[i].ndim;
+            memcpy(t->shape, tensors[i].shape, sizeof(t->shape));
+            t->offset = out_pos;
+            t->size = bytes;
+            src[j++] = (const float *)(in + in_pos);
+            out_pos += bytes;
+        }
+        in_pos += bytes;
+    }
+    if (in_pos != in_len) {
+        fprintf(stderr, "warning: %zu trailing bytes in %s ignored\n", in_len - in_pos, argv[1]);
+    }
+
+    hdr.file_size = out_pos;
+    uint8_t *out = calloc(1, out_pos);
+    memcpy(out + hdr.dir_off, dir, n_tensors * sizeof(ckpt_tensor_t));
+    for (int j = 0; j < n_tensors; j++) {
+        memcpy(out + dir[j].offset, src[j], dir[j].size);
+    }
+    hdr.checksum = ckpt_checksum(out + sizeof(hdr), out_pos - sizeof(hdr));
+    memcpy(out, &hdr, sizeof(hdr));
+
+    FILE *f = fopen(argv[2], "wb");
+    if (!f || fwrite(out, 1, out_pos, f) != out_pos || fclose(f) != 0) {
+        fprintf(stderr, "cannot write %s\n", argv[2]);
+        return 1;
+    }
+    for (int j = 0; j < n_tensors; j++) {
+        printf("%-18s offset %8u size %8u\n", dir[j].name, (unsigned)dir[j].offset, (unsigned)dir[j].size);
+    }
+    printf("%s: %u tensors, %u bytes, checksum %08x%s\n", argv[2], (unsigned)n_tensors,
+           (unsigned)out_pos, (unsigned)hdr.checksum, shared ? ", classifier shared" : "");
+    free(in);
+    free(out);
+    free(dir);
+    free(src);
+    return 0;
+}
@@ -0,0 +1,225 @@
+/**
+ * Replays accelerometer traces through main/gesture.c and scores it.
+ *
+ * usage: gesture_bench [trace.csv ...]   (default: the traces in traces/motion)
+ *
+ * A trace is "t_ms,x,y,z" per sample, in g, optionally behind an "acc,"
+ * log prefix as the firmware prints it with CONFIG_LLM_MOTION_LOG_SAMPLES,
+ * and "# shake,start_ms,end_ms" lines marking the real shakes. A detection
+ * inside a marked shake (or up to MATCH_SLACK_MS after it) finds it; more
+ * detections in the same shake are repeats; any other is a false alarm.
+ *
+ * Prints, per trace, found/missed/false for the recognizer and for the
+ * frame-delta detector it replaced, and the recognizer's cost per sample.
+ * Exits non-zero if the recognizer misses a shake or raises a false alarm.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "gesture.h"
+
+#define SAMPLE_HZ 62.5f     // MOTION_ODR_HZ
+#define MAX_SAMPLES 20000
+#define MAX_SHAKES 32
+#define MATCH_SLACK_MS 500
+#define TIMING_NS 200000000LL
+
+static const char *default_traces[] = {"shakes.csv", "handling.csv", "mixed.csv"};
+
+typedef struct {
+    int n;
+    int t_ms[MAX_SAMPLES];
+    float x[MAX_SAMPLES], y[MAX_SAMPLES], z[MAX_SAMPLES];
+    int n_shakes;
+    int shake_start[MAX_SHAKES], shake_end[MAX_SHAKES];
+} trace_t;
+
+typedef struct {
+    int found, missed, repeats, false_alarms, moves;
+} score_t;
+
+static trace_t trace;
+
+static int load_trace(const char *path, trace_t *tr)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    tr->n = tr->n_shakes = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        const char *p = strstr(line, "acc,");
+        p = p ? p + 4 : line;
+        int a, b;
+        if (sscanf(p, "# shake,%d,%d", &a, &b) == 2) {
+            if (tr->n_shakes < MAX_SHAKES) {
+                tr->shake_start[tr->n_shakes] = a;
+                tr->shake_end[tr->n_shakes++] = b;
+            }
+            continue;
+        }
+        if (p[0] == '#' || tr->n >= MAX_SAMPLES) {
+            continue;
+        }
+        if (sscanf(p, "%d,%f,%f,%f", &tr->t_ms[tr->n], &tr->x[tr->n], &tr->y[tr->n], &tr->z[tr->n]) == 4) {
+            tr->n++;
+        }
+    }
+    fclose(f);
+    return tr->n > 0 ? 0 : -1;
+}
+
+// scores the detection times of one detector against the marked shakes
+static void score(const trace_t *tr, const int *det_ms, int n_det, score_t *s)
+{
+    int hit[MAX_SHAKES] = {0};
+    for (int d = 0; d < n_det; d++) {
+        int matched = 0;
+        for (int k = 0; k < tr->n_shakes && !matched; k++) {
+            if (det_ms[d] >= tr->shake_start[k] && det_ms[d] <= tr->shake_end[k] + MATCH_SLACK_MS) {
+                matched = 1;
+                if (hit[k]++) {
+                    s->repeats++;
+                }
+            }
+        }
+        if (!matched) {
+            s->false_alarms++;
+        }
+    }
+    for (int k = 0; k < tr->n_shakes; k++) {
+        if (hit[k]) {
+            s->found++;
+        } else {
+            s->missed++;
+        }
+    }
+}
+
+static int run_recognizer(const trace_t *tr, int *det_ms, int *moves)
+{
+    gesture_config_t config;
+    gesture_default_config(&config, SAMPLE_HZ);
+    gesture_t g;
+    gesture_init(&g, &config);
+    int n_det = 0;
+    for (int i = 0; i < tr->n; i++) {
+        gesture_event_t ev = gesture_update(&g, tr->x[i], tr->y[i], tr->z[i]);
+        if (ev == GESTURE_SHAKE && n_det < MAX_SAMPLES) {
+            det_ms[n_det++] = tr->t_ms[i];
+        }
+        *moves += ev != GESTURE_NONE;
+    }
+    return n_det;
+}
+
+// The detector motion_sensor.c used before gesture.c: Euclidean delta
+// between consecutive samples over 1.2 g, at least 100 ms apart, 8 of them
+// within 1.5 s. Kept here only as the baseline of the comparison.
+static int run_frame_delta(const trace_t *tr, int *det_ms)
+{
+    int n_det = 0, count = 0;
+    int start = 0, last = -100000;
+    for (int i = 1; i < tr->n; i++) {
+        int t = tr->t_ms[i];
+        float dx = tr->x[i] - tr->x[i - 1], dy = tr->y[i] - tr->y[i - 1], dz = tr->z[i] - tr->z[i - 1];
+        if (sqrtf(dx * dx + dy * dy + dz * dz) > 1.2f && t - last > 100) {
+            if (count == 0) {
+                start = t;
+            }
+            count++;
+            last = t;
+        }
+        if (count >= 8 && t - start <= 1500) {
+            det_ms[n_det++] = t;
+            count = 0;
+        } else if (count > 0 && t - start > 1500) {
+            count = 0;
+        }
+    }
+    return n_det;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// replays the trace until TIMING_NS have passed, for a stable per-sample figure
+static double ns_per_sample(const trace_t *tr)
+{
+    gesture_config_t config;
+    gesture_default_config(&config, SAMPLE_HZ);
+    gesture_t g;
+    volatile int sink = 0;
+    long long samples = 0;
+    double t0 = now_ns(), t1;
+    do {
+        gesture_init(&g, &config);
+        for (int i = 0; i < tr->n; i++) {
+            sink += gesture_update(&g, tr->x[i], tr->y[i], tr->z[i]);
+        }
+        samples += tr->n;
+        t1 = now_ns();
+    } while (t1 - t0 < TIMING_NS);
+    (void)sink;
+    return (t1 - t0) / samples;
+}
+
+int main(int argc, char **argv)
+{
+    static int det[MAX_SAMPLES];
+    char path[512];
+    int n_traces = argc > 1 ? argc - 1 : (int)(sizeof(default_traces) / sizeof(default_traces[0]));
+    score_t total = {0}, total_old = {0};
+    double ns_sum = 0;
+
+    printf("%-14s %6s %6s | %5s %6s %6s %5s %5s | %s\n", "trace", "secs", "shakes",
+           "found", "missed", "false", "rep", "moves", "frame-delta found/missed/false");
+    for (int t = 0; t < n_traces; t++) {
+        const char *name = argc > 1 ? argv[t + 1] : default_traces[t];
+        if (argc > 1) {
+            snprintf(path, sizeof(path), "%s", name);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s", GESTURE_TRACE_DIR, name);
+        }
+        if (load_trace(path, &trace) != 0) {
+            fprintf(stderr, "cannot read %s\n", path);
+            return 1;
+        }
+        score_t s = {0}, old = {0};
+        int n_det = run_recognizer(&trace, det, &s.moves);
+        score(&trace, det, n_det, &s);
+        n_det = run_frame_delta(&trace, det);
+        score(&trace, det, n_det, &old);
+        ns_sum += ns_per_sample(&trace);
+
+        const char *base = strrchr(path, '/');
+        printf("%-14s %6.1f %6d | %5d %6d %6d %5d %5d | %d/%d/%d\n", base ? base + 1 : path,
+               trace.t_ms[trace.n - 1] / 1000.0, trace.n_shakes, s.found, s.missed, s.false_alarms,
+               s.repeats, s.moves, old.found, old.missed, old.false_alarms);
+        total.found += s.found;
+        total.missed += s.missed;
+        total.false_alarms += s.false_alarms;
+        total_old.found += old.found;
+        total_old.missed += old.missed;
+        total_old.false_alarms += old.false_alarms;
+    }
+
+    int shakes = total.found + total.missed;
+    printf("recognizer:  %d/%d shakes found, %d false alarms\n", total.found, shakes, total.false_alarms);
+    printf("frame-delta: %d/%d shakes found, %d false alarms\n", total_old.found, shakes,
+           total_old.false_alarms);
+    printf("cost: %.1f ns/sample on this host, %d bytes of state\n", ns_sum / n_traces, (int)sizeof(gesture_t));
+    if (total.missed > 0 || total.false_alarms > 0) {
+        fprintf(stderr, "FAIL: the recognizer missed %d shakes and raised %d false alarms\n",
+                total.missed, total.false_alarms);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,842 @@
+/**
+ * Host microbenchmarks for the inference core.
+ *
+ * Reports ns/op for the kernels that make up a token (matmul, attention,
+ * rmsnorm, softmax, sample, encode) and end-to-end tokens/s on the real
+ * checkpoint, so a kernel change can be measured before flashing.
+ *
+ * The fused kernels (residual+rmsnorm, w1/w3+SwiGLU) and the tiled matmul are
+ * checked against their reference; a mismatch fails the run.
+ * The three-pass and the online-softmax attention are checked at every
+ * position against each other and against the (layer, seq_len, kv_dim)
+ * cache layout before the head-major one, and all three are timed.
+ *
+ * Every kernel backend is cross-checked against the scalar reference and
+ * timed on the same shapes.
+ *
+ * The llm_math approximations are checked against double precision and their
+ * kernels timed in both fast and libm mode.
+ *
+ * A tokenizer image must be rejected once its source tok512.bin changes.
+ *
+ * A deterministic generate() run closes the report: its token checksum must
+ * not change when a kernel is only meant to get faster. A batch session
+ * paused and resumed every few tokens must match it too, and its slowest
+ * step bounds how long a preemption waits for generation to yield.
+ * Two dreams are then made in split mode and one per core at once, for the
+ * aggregate tokens/s and the latency of a dream in each.
+ *
+ * With -DLLM_PREFETCH=ON a full context runs with the weight staging off and
+ * on, with per-matmul cycles when the profiler is built in.
+ *
+ * With -DLLM_STREAM_WEIGHTS=ON the end-to-end run also reports the layer
+ * prefetch hits and misses; pass a v2 checkpoint made by ckpt_pack.
+ *
+ * usage: llm_bench [checkpoint.bin] [tokenizer.bin]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "llm.h"
+#include "llm_prof.h"
+#include "llm_math.h"
+#include "llm_kernels.h"
+#include "tok_image.h"
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void fill_random(v4sf *x, int n)
+{
+    for (int i = 0; i < n; i++) {
+        x[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+    }
+}
+
+// runs `body` for at least ~0.2 s and prints the mean cost of one iteration
+#define BENCH(name, body)                                               \
+    do {                                                                \
+        long iters = 0;                                                 \
+        double t0 = now_ns(), t1;                                       \
+        do {                                                            \
+            for (int rep_ = 0; rep_ < 64; rep_++) { body; }             \
+            iters += 64;                                                \
+            t1 = now_ns();                                              \
+        } while (t1 - t0 < 2e8);                                        \
+        printf("%-32s %12.1f ns/op\n", name, (t1 - t0) / iters);        \
+    } while (0)
+
+#define BENCH_SEED 42
+#define BENCH_PROMPT "I dreamed"
+
+static void generation_done(float tokens_ps)
+{
+    (void)tokens_ps;
+}
+
+static float max_abs_diff(const v4sf *a, const v4sf *b, int n)
+{
+    float worst = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float d = fabsf(a[i] - b[i]);
+        worst = d > worst ? d : worst;
+    }
+    return worst;
+}
+
+// per-row against tiled layout; returns 0 if both give the same outputs
+static int bench_matmul(LlmWorkers *wk, const char *name, int n, int d)
+{
+    v4sf *w = malloc((size_t)n * d * sizeof(v4sf));
+    v4sf *x = malloc(n * sizeof(v4sf));
+    v4sf *out = malloc(d * sizeof(v4sf));
+    v4sf *ref = malloc(d * sizeof(v4sf));
+    char label[64];
+    fill_random(w, n * d);
+    fill_random(x, n);
+    snprintf(label, sizeof(label), "%s rows", name);
+    BENCH(label, matmul(wk, out, x, w, n, d));
+    snprintf(label, sizeof(label), "  kernel only, rows");
+    BENCH(label, matmul_local(out, x, w, 0, n, d));
+    matmul(wk, ref, x, w, n, d);
+    repack_tiled(w, n, d);
+    snprintf(label, sizeof(label), "%s tiled", name);
+    BENCH(label, matmul_tiled(wk, out, x, w, n, d));
+    snprintf(label, sizeof(label), "  kernel only, tiled");
+    BENCH(label, matmul_local(out, x, w, 1, n, d));
+    float err = max_abs_diff(ref, out, d);
+    if (err > 1e-5f) {
+        printf("%-32s %12.2e max abs diff  FAIL\n", label, err);
+    }
+    free(w);
+    free(x);
+    free(out);
+    free(ref);
+    return err > 1e-5f;
+}
+
+// worst error of an approximation over n evenly (or log-) spaced points in [lo, hi]
+static void check_accuracy(const char *name, float (*fast)(float), double (*ref)(double),
+                           float lo, float hi, int log_spaced, int relative)
+{
+    const int n = 200000;
+    double worst = 0.0;
+    float worst_x = lo;
+    for (int i = 0; i <= n; i++) {
+        double t = (double)i / n;
+        float x = log_spaced ? (float)(lo * pow(hi / lo, t)) : (float)(lo + (hi - lo) * t);
+        double want = ref(x);
+        double err = fabs(fast(x) - want);
+        if (relative) {
+            err /= fabs(want);
+        }
+        if (err > worst) {
+            worst = err;
+            worst_x = x;
+        }
+    }
+    printf("%-32s %12.2e %s error (at x=%g)\n", name, worst, relative ? "rel" : "abs", worst_x);
+}
+
+static double ref_sigmoid(double x)
+{
+    return 1.0 / (1.0 + exp(-x));
+}
+
+static double ref_rsqrt(double x)
+{
+    return 1.0 / sqrt(x);
+}
+
+static void bench_math_kernels(Config *p, RunState *s)
+{
+    v4sf *logits = malloc(p->vocab_size * sizeof(v4sf));
+    v4sf *weight = malloc(p->dim * sizeof(v4sf));
+    fill_random(logits, p->vocab_size);
+    fill_random(weight, p->dim);
+    fill_random(s->x, p->dim);
+    fill_random(s->hb2, p->hidden_dim);
+    char name[64];
+    for (int libm = 0; libm < 2; libm++) {
+        const char *mode = libm ? "libm" : "fast";
+        llm_math_use_libm(libm);
+        snprintf(name, sizeof(name), "rmsnorm %d [%s]", p->dim, mode);
+        BENCH(name, rmsnorm(s->xb, s->x, weight, p->dim));
+        snprintf(name, sizeof(name), "softmax %d [%s]", p->seq_len, mode);
+        BENCH(name, { memcpy(s->logits, logits, p->seq_len * sizeof(v4sf)); softmax(s->logits, p->seq_len); });
+        snprintf(name, sizeof(name), "softmax %d [%s]", p->vocab_size, mode);
+        BENCH(name, { memcpy(s->logits, logits, p->vocab_size * sizeof(v4sf)); softmax(s->logits, p->vocab_size); });
+        snprintf(name, sizeof(name), "swiglu %d [%s]", p->hidden_dim, mode);
+        BENCH(name, { memcpy(s->hb, logits, p->hidden_dim * sizeof(v4sf)); llm_swiglu(s->hb, s->hb2, p->hidden_dim); });
+    }
+#if CONFIG_LLM_FAST_MATH
+    llm_math_use_libm(0);
+#endif
+    free(logits);
+    free(weight);
+}
+
+// fused kernels against the unfused passes forward() used to make; returns 0 on a match
+static int check_fused_kernels(LlmWorkers *wk, Config *p, RunState *s)
+{
+    int dim = p->dim, hidden_dim = p->hidden_dim;
+    v4sf *weight = malloc(dim * sizeof(v4sf));
+    v4sf *x0 = malloc(dim * sizeof(v4sf));
+    v4sf *ref = malloc(hidden_dim * sizeof(v4sf));
+    v4sf *w1 = malloc((size_t)dim * hidden_dim * sizeof(v4sf));
+    v4sf *w3 = malloc((size_t)dim * hidden_dim * sizeof(v4sf));
+    fill_random(weight, dim);
+    fill_random(x0, dim);
+    fill_random(s->xb2, dim);
+    fill_random(w1, dim * hidden_dim);
+    fill_random(w3, dim * hidden_dim);
+    int failed = 0;
+
+    // residual + rmsnorm: x += xb2; xb = rmsnorm(x)
+    memcpy(s->x, x0, dim * sizeof(v4sf));
+    for (int i = 0; i < dim; i++) {
+        s->x[i] += s->xb2[i];
+    }
+    rmsnorm(ref, s->x, weight, dim);
+    memcpy(s->x, x0, dim * sizeof(v4sf));
+    residual_rmsnorm(s->xb, s->x, s->xb2, weight, dim);
+    float err = max_abs_diff(ref, s->xb, dim);
+    printf("%-32s %12.2e max abs diff%s\n", "residual_rmsnorm vs unfused", err, err > 1e-5f ? "  FAIL" : "");
+    failed |= err > 1e-5f;
+    BENCH("residual+rmsnorm unfused", {
+        memcpy(s->x, x0, dim * sizeof(v4sf));
+        for (int i = 0; i < dim; i++) { s->x[i] += s->xb2[i]; }
+        rmsnorm(s->xb, s->x, weight, dim);
+    });
+    BENCH("residual_rmsnorm fused", {
+        memcpy(s->x, x0, dim * sizeof(v4sf));
+        residual_rmsnorm(s->xb, s->x, s->xb2, weight, dim);
+    });
+
+    // w1/w3 + SwiGLU: hb = silu(w1 x) * (w3 x)
+    matmul(wk, ref, x0, w1, dim, hidden_dim);
+    matmul(wk, s->hb2, x0, w3, dim, hidden_dim);
+    llm_swiglu(ref, s->hb2, hidden_dim);
+    matmul_swiglu(wk, s->hb, x0, w1, w3, 0, dim, hidden_dim);
+    err = max_abs_diff(ref, s->hb, hidden_dim);
+    printf("%-32s %12.2e max abs diff%s\n", "matmul_swiglu vs unfused", err, err > 1e-5f ? "  FAIL" : "");
+    failed |= err > 1e-5f;
+    BENCH("w1/w3+swiglu unfused", {
+        matmul(wk, s->hb, x0, w1, dim, hidden_dim);
+        matmul(wk, s->hb2, x0, w3, dim, hidden_dim);
+        llm_swiglu(s->hb, s->hb2, hidden_dim);
+    });
+    BENCH("matmul_swiglu fused", matmul_swiglu(wk, s->hb, x0, w1, w3, 0, dim, hidden_dim));
+
+    // the same on tiled weights
+    repack_tiled(w1, dim, hidden_dim);
+    repack_tiled(w3, dim, hidden_dim);
+    matmul_swiglu(wk, s->hb, x0, w1, w3, 1, dim, hidden_dim);
+    err = max_abs_diff(ref, s->hb, hidden_dim);
+    printf("%-32s %12.2e max abs diff%s\n", "matmul_swiglu tiled vs unfused", err, err > 1e-5f ? "  FAIL" : "");
+    failed |= err > 1e-5f;
+    BENCH("matmul_swiglu fused, tiled", matmul_swiglu(wk, s->hb, x0, w1, w3, 1, dim, hidden_dim));
+
+    free(weight);
+    free(x0);
+    free(ref);
+    free(w1);
+    free(w3);
+    return failed;
+}
+
+#define ATTN_VARIANTS 3
+#define ATTN_ROUNDS 31
+#define ATTN_REPS 200
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// attention() as it was with the (layer, seq_len, kv_dim) cache: a dot and an
+// axpy per timestep, each striding by kv_dim. Kept only as a baseline of
+// check_attention(), with the scores of a head in att (seq_len,)
+static void attention_seq_major(const v4sf *key_cache, const v4sf *value_cache, RunState *s, Config *p,
+                                int pos, v4sf *att, v4sf *out)
+{
+    int kv_dim = (p->dim * p->n_kv_heads) / p->n_heads;
+    int kv_mul = p->n_heads / p->n_kv_heads;
+    int head_size = p->dim / p->n_heads;
+    const llm_kernels_t *kernels = llm_kernels_active;
+    for (int h = 0; h < p->n_heads; h++) {
+        v4sf *q = s->q + h * head_size;
+        for (int t = 0; t <= pos; t++) {
+            kernels->dot(q, key_cache + t * kv_dim + (h / kv_mul) * head_size, &att[t], head_size);
+            att[t] /= sqrtf(head_size);
+        }
+        softmax(att, pos + 1);
+        v4sf *xb = out + h * head_size;
+        memset(xb, 0, head_size * sizeof(v4sf));
+        for (int t = 0; t <= pos; t++) {
+            kernels->axpy(xb, att[t], value_cache + t * kv_dim + (h / kv_mul) * head_size, head_size);
+        }
+    }
+}
+
+// the same keys and values must give the same attention at every position,
+// with the fast math and with libm: both head-major kernels against the
+// seq-major cache.
+// Then the three are timed on a full context
+static int check_attention(Config *p, RunState *s)
+{
+    int kv_dim = (p->dim * p->n_kv_heads) / p->n_heads;
+    int head_size = p->dim / p->n_heads;
+    v4sf *keys = malloc((size_t)p->seq_len * kv_dim * sizeof(v4sf));
+    v4sf *values = malloc((size_t)p->seq_len * kv_dim * sizeof(v4sf));
+    v4sf *att = malloc(p->seq_len * sizeof(v4sf));
+    v4sf *out = malloc(p->dim * sizeof(v4sf));
+    // scores of a few units, as trained heads give, so the max moves around
+    fill_random(keys, p->seq_len * kv_dim);
+    fill_random(values, p->seq_len * kv_dim);
+    fill_random(s->q, p->dim);
+    llm_vscale(s->q, 3.0f, p->dim);
+    for (int t = 0; t < p->seq_len; t++) {
+        for (int j = 0; j < kv_dim; j++) {
+            int h = j / head_size, i = j % head_size;
+            s->key_cache[(h * p->seq_len + t) * head_size + i] = keys[t * kv_dim + j];
+            s->value_cache[(h * head_size + i) * p->seq_len + t] = values[t * kv_dim + j];
+        }
+    }
+    int failed = 0;
+    int was_libm = llm_math_is_libm();
+    for (int libm = 0; libm < 2; libm++) {
+        llm_math_use_libm(libm);
+        float worst_online = 0.0f, worst_layout = 0.0f;
+        for (int pos = 0; pos < p->seq_len; pos++) {
+            attention_seq_major(keys, values, s, p, pos, att, out);
+            attention_three_pass(s, p, 0, pos, 0, p->n_heads);
+            float diff = max_abs_diff(s->xb, out, p->dim);
+            worst_layout = diff > worst_layout ? diff : worst_layout;
+            attention_online(s, p, 0, pos, 0, p->n_heads);
+            diff = max_abs_diff(s->xb, out, p->dim);
+            worst_online = diff > worst_online ? diff : worst_online;
+        }
+        int bad = worst_online > 1e-5f || worst_layout > 1e-5f;
+        printf("attention [%s] three-pass %.2e, online %.2e max diff vs seq-major%s\n",
+               libm ? "libm" : "fast", worst_layout, worst_online, bad ? "  FAIL" : "");
+        failed |= bad;
+    }
+    llm_math_use_libm(was_libm);
+    // a few microseconds each, so BENCH() alone is at the mercy of whatever
+    // else the host runs: the three take turns, and the median round counts
+    int pos = p->seq_len - 1;
+    static const char *variants[ATTN_VARIANTS] = {"seq-major", "three-pass", "online"};
+    double rounds[ATTN_VARIANTS][ATTN_ROUNDS];
+    for (int r = 0; r < ATTN_ROUNDS; r++) {
+        for (int v = 0; v < ATTN_VARIANTS; v++) {
+            double t0 = now_ns();
+            for (int i = 0; i < ATTN_REPS; i++) {
+                if (v == 0) {
+                    attention_seq_major(keys, values, s, p, pos, att, out);
+                } else if (v == 1) {
+                    attention_three_pass(s, p, 0, pos, 0, p->n_heads);
+                } else {
+                    attention_online(s, p, 0, pos, 0, p->n_heads);
+                }
+            }
+            rounds[v][r] = (now_ns() - t0) / ATTN_REPS;
+        }
+    }
+    for (int v = 0; v < ATTN_VARIANTS; v++) {
+        qsort(rounds[v], ATTN_ROUNDS, sizeof(double), compare_double);
+        printf("attention pos=%d %-10s %9.1f ns/op median, %9.1f min of %d rounds\n", pos, variants[v],
+               rounds[v][ATTN_ROUNDS / 2], rounds[v][0], ATTN_ROUNDS);
+    }
+    free(keys);
+    free(values);
+    free(att);
+    free(out);
+    return failed;
+}
+
+// an image built from the tokenizer file must validate against that file and
+// be rejected once a single byte of it changes, so a new tok512.bin rebuilds
+static int check_tok_image(const char *tokenizer_path, int vocab_size)
+{
+    FILE *file = fopen(tokenizer_path, "rb");
+    if (!file) {
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *legacy = malloc(len);
+    size_t got = fread(legacy, 1, len, file);
+    fclose(file);
+    tok_image_header_t *img = got == len ? tok_image_build(legacy, len, vocab_size) : NULL;
+    int same = img && tok_image_validate(img, img->image_size, vocab_size, legacy, len);
+    int any = img && tok_image_validate(img, img->image_size, vocab_size, NULL, 0);
+    legacy[len - 1] ^= 1;
+    int stale = img && tok_image_validate(img, img->image_size, vocab_size, legacy, len);
+    int failed = !same || !any || stale;
+    printf("tok image: same source %s, edited source %s%s\n", same ? "valid" : "invalid",
+           stale ? "valid" : "rejected", failed ? "  FAIL" : "");
+    free(img);
+    free(legacy);
+    return failed;
+}
+
+// self-test and timings of every backend; returns 0 if all of them match the reference
+static int check_backends(Config *p, RunState *s)
+{
+    int n = p->dim, d = p->hidden_dim;
+    v4sf *w = malloc((size_t)n * d * sizeof(v4sf));
+    v4sf *weight = malloc(n * sizeof(v4sf));
+    v4sf *logits = malloc(p->vocab_size * sizeof(v4sf));
+    fill_random(w, n * d);
+    fill_random(weight, n);
+    fill_random(logits, p->vocab_size);
+    fill_random(s->x, n);
+    const llm_kernels_t *active = llm_kernels_active;
+    int failed = 0;
+    char name[64];
+    for (int id = 0; id < LLM_KERNELS_COUNT; id++) {
+        int errors = llm_kernels_self_test(id);
+        llm_kernels_select(id);
+        const char *backend = llm_kernels_active->name;
+        printf("%-32s %12d mismatches%s\n", backend, errors, errors ? "  FAIL" : "");
+        failed |= errors != 0;
+        snprintf(name, sizeof(name), "  gemv %dx%d [%s]", d, n, backend);
+        BENCH(name, matmul_local(s->hb, s->x, w, 0, n, d));
+        snprintf(name, sizeof(name), "  attention pos=%d [%s]", p->seq_len - 1, backend);
+        BENCH(name, attention(s, p, 0, p->seq_len - 1, 0, p->n_heads));
+        snprintf(name, sizeof(name), "  rmsnorm %d [%s]", n, backend);
+        BENCH(name, rmsnorm(s->xb, s->x, weight, n));
+        snprintf(name, sizeof(name), "  softmax %d [%s]", p->vocab_size, backend);
+        BENCH(name, { memcpy(s->logits, logits, p->vocab_size * sizeof(v4sf)); softmax(s->logits, p->vocab_size); });
+    }
+    llm_kernels_active = active;
+    free(w);
+    free(weight);
+    free(logits);
+    return failed;
+}
+
+static void count_dream(const char *text, const DreamTrail *trail, void *arg)
+{
+    (void)text;
+    (void)trail;
+    (*(int *)arg)++;
+}
+
+// generate_batch() with 1, 2 and 4 sequences seeded BENCH_SEED + b: sequence b
+// must produce the same tokens at every batch size, and sequence 0 the same
+// as generate(); what batching buys is the aggregate rate
+static int bench_batch(Transformer *t, Tokenizer *tokenizer, uint32_t reference)
+{
+    static const int sizes[] = {1, 2, LLM_MAX_BATCH};
+    Sampler samplers[LLM_MAX_BATCH];
+    for (int b = 0; b < LLM_MAX_BATCH; b++) {
+        build_sampler(&samplers[b], t->config.vocab_size, 0.7f, 0.8f, 1234);
+        sampler_set_deterministic(&samplers[b], BENCH_SEED + b);
+    }
+    uint32_t first[LLM_MAX_BATCH] = {0};
+    int failed = 0;
+    printf("\n");
+    for (int i = 0; i < 3; i++) {
+        int batch = sizes[i];
+        int dreams = 0;
+        generate_batch(t, tokenizer, samplers, batch, BENCH_PROMPT, t->config.seq_len, count_dream, &dreams);
+        const GenerateStats *st = llm_last_stats(t);
+        int mismatch = dreams != batch || st->seq_checksum[0] != reference;
+        for (int b = 0; b < batch; b++) {
+            if (first[b] == 0) {
+                first[b] = st->seq_checksum[b];
+            }
+            mismatch |= st->seq_checksum[b] != first[b];
+        }
+        printf("batch %d  %4d tokens %5ld ms %8.1f tok/s aggregate  checksum[0]=%08x%s\n",
+               batch, st->tokens, st->elapsed_ms, st->tokens_ps, (unsigned)st->seq_checksum[0],
+               mismatch ? "  MISMATCH" : "");
+        failed |= mismatch;
+    }
+    for (int b = 0; b < LLM_MAX_BATCH; b++) {
+        free_sampler(&samplers[b]);
+    }
+    return failed;
+}
+
+typedef struct {
+    int every;          // yield at every every-th token boundary
+    int calls;
+    double last_ns;
+    double max_step_ns; // longest time between two boundaries
+} yield_probe_t;
+
+static bool yield_sometimes(void *arg)
+{
+    yield_probe_t *y = arg;
+    double now = now_ns();
+    if (y->calls > 0 && now - y->last_ns > y->max_step_ns) {
+        y->max_step_ns = now - y->last_ns;
+    }
+    y->last_ns = now;
+    return ++y->calls % y->every == 0;
+}
+
+// a full batch as a session that yields every few tokens and is resumed at
+// once: same tokens as generate_batch(), no step done twice
+static int bench_session(Transformer *t, Tokenizer *tokenizer, uint32_t reference)
+{
+    Sampler samplers[LLM_MAX_BATCH];
+    for (int b = 0; b < LLM_MAX_BATCH; b++) {
+        build_sampler(&samplers[b], t->config.vocab_size, 0.7f, 0.8f, 1234);
+        sampler_set_deterministic(&samplers[b], BENCH_SEED + b);
+    }
+    int dreams = 0;
+    generate_batch(t, tokenizer, samplers, LLM_MAX_BATCH, BENCH_PROMPT, t->config.seq_len, count_dream, &dreams);
+    GenerateStats whole = *llm_last_stats(t);
+
+    GenSession session;
+    yield_probe_t probe = {.every = 7};
+    int runs = 0;
+    dreams = 0;
+    gen_session_begin(&session, t, tokenizer, samplers, LLM_MAX_BATCH, BENCH_PROMPT, t->config.seq_len,
+                      count_dream, &dreams);
+    while (!gen_session_run(&session, yield_sometimes, &probe)) {
+        runs++;
+        probe.last_ns = now_ns();  // the pause is not a step
+    }
+    int steps = session.pos;
+    gen_session_end(&session);
+    const GenerateStats *st = llm_last_stats(t);
+
+    int mismatch = dreams != LLM_MAX_BATCH || st->tokens != whole.tokens || st->seq_checksum[0] != reference;
+    for (int b = 0; b < LLM_MAX_BATCH; b++) {
+        mismatch |= st->seq_checksum[b] != whole.seq_checksum[b];
+    }
+    printf("session  %4d tokens in %d steps, %d yields, worst step %.2f ms  checksum[0]=%08x%s\n",
+           st->tokens, steps, runs, probe.max_step_ns / 1e6, (unsigned)st->seq_checksum[0],
+           mismatch ? "  MISMATCH" : "");
+    for (int b = 0; b < LLM_MAX_BATCH; b++) {
+        free_sampler(&samplers[b]);
+    }
+    return mismatch;
+}
+
+// two LlmSessions of one context, one split and one on the calling core,
+// stepped in turns: each must give the tokens of its sequence in the batch
+// that ran last, as if it had the model to itself. Streamed weights only
+// run split, so then the split session runs alone
+static int check_llm_sessions(Transformer *t, Tokenizer *tokenizer)
+{
+    GenerateStats batch = *llm_last_stats(t);
+    LlmContext ctx;
+    llm_context_init(&ctx, t, tokenizer);
+    Sampler samplers[2];
+    LlmSession *sessions[2] = {NULL, NULL};
+    static const LlmExec exec[2] = {LLM_EXEC_SPLIT, LLM_EXEC_LOCAL};
+    static const char *names[2] = {"split", "local"};
+    int n = t->stream ? 1 : 2;
+    if (t->stream) {
+        printf("session local skipped: streamed weights need the split forward\n");
+    }
+    int failed = 0;
+    for (int i = 0; i < n; i++) {
+        build_sampler(&samplers[i], t->config.vocab_size, 0.7f, 0.8f, 1234);
+        sampler_set_deterministic(&samplers[i], BENCH_SEED + i);
+        sessions[i] = llm_session_create(&ctx, &samplers[i], BENCH_PROMPT, t->config.seq_len, exec[i]);
+        if (!sessions[i]) {
+            printf("llm_session_create(%s) failed\n", names[i]);
+            failed = 1;
+        }
+    }
+    int running = !failed;
+    while (running > 0) {
+        running = 0;
+        for (int i = 0; i < n; i++) {
+            running += llm_session_step(sessions[i]) >= 0;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (sessions[i] && running == 0 && !failed) {
+            const GenerateStats *st = &sessions[i]->stats;
+            int mismatch = st->checksum != batch.seq_checksum[i];
+            printf("session %s %4d tokens %5ld ms %8.1f tok/s  checksum=%08x%s\n", names[i], st->tokens,
+                   st->elapsed_ms, st->tokens_ps, (unsigned)st->checksum, mismatch ? "  MISMATCH" : "");
+            failed |= mismatch;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        llm_session_destroy(sessions[i]);
+        free_sampler(&samplers[i]);
+    }
+    return failed;
+}
+
+typedef struct {
+    LlmSession *session;
+    llm_sem_t done;
+} core_run_t;
+
+static void run_core_dream(void *arg)
+{
+    core_run_t *run = arg;
+    while (llm_session_step(run->session) >= 0) {
+    }
+    llm_sem_give(run->done);
+}
+
+// makes the two dreams of check_llm_sessions() split, one after the other,
+// or per core, at the same time
+static int run_dreams(const LlmContext *ctx, LlmExec exec, llm_sem_t *done, uint32_t *checksums,
+                      int *tokens, long *latency)
+{
+    Config *p = &ctx->transformer->config;
+    Sampler samplers[2];
+    core_run_t runs[2] = {{NULL, done[0]}, {NULL, done[1]}};
+    int failed = 0;
+    for (int i = 0; i < 2; i++) {
+        build_sampler(&samplers[i], p->vocab_size, 0.7f, 0.8f, 1234);
+        sampler_set_deterministic(&samplers[i], BENCH_SEED + i);
+        runs[i].session = llm_session_create(ctx, &samplers[i], BENCH_PROMPT, p->seq_len, exec);
+        failed |= !runs[i].session;
+    }
+    int started = 0;
+    for (int i = 0; i < 2 && !failed; i++) {
+        if (exec == LLM_EXEC_SPLIT) {
+            run_core_dream(&runs[i]);
+        } else if (llm_task_create(run_core_dream, "core_dream", 0, &runs[i], 0, i, NULL) != 0) {
+            printf("cannot start the task of core %d\n", i);
+            failed = 1;
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        llm_sem_take(runs[i].done);
+    }
+    *tokens = 0;
+    *latency = 0;
+    for (int i = 0; i < 2; i++) {
+        if (runs[i].session) {
+            const GenerateStats *st = &runs[i].session->stats;
+            *tokens += st->tokens;
+            *latency += st->elapsed_ms;
+            checksums[i] = st->checksum;
+        }
+        llm_session_destroy(runs[i].session);
+        free_sampler(&samplers[i]);
+    }
+    return failed;
+}
+
+// the two dreams of check_llm_sessions() made both ways: one after the other
+// with every token split over the cores, then one per core at the same time
+// with no handoff; same tokens, compared on aggregate rate and on how long
+// each dream takes
+static int bench_per_core(Transformer *t, Tokenizer *tokenizer)
+{
+    if (t->stream) {
+        printf("per-core skipped: streamed weights need the split forward\n");
+        return 0;
+    }
+#if CONFIG_LLM_PROFILE
+    printf("per-core skipped: the profiler counters take one writer per stage\n");
+    return 0;
+#endif
+    GenerateStats batch = *llm_last_stats(t);
+    LlmContext ctx;
+    llm_context_init(&ctx, t, tokenizer);
+    static const LlmExec exec[2] = {LLM_EXEC_SPLIT, LLM_EXEC_LOCAL};
+    static const char *names[2] = {"split", "per-core"};
+    llm_sem_t done[2] = {llm_sem_create(), llm_sem_create()};
+    int failed = !done[0] || !done[1];
+    for (int mode = 0; mode < 2 && !failed; mode++) {
+        uint32_t checksums[2] = {0, 0};
+        int tokens;
+        long latency;
+        double t0 = now_ns();
+        if (run_dreams(&ctx, exec[mode], done, checksums, &tokens, &latency) != 0) {
+            printf("%s: the dreams could not run\n", names[mode]);
+            failed = 1;
+            break;
+        }
+        double elapsed = now_ns() - t0;
+        int mismatch = checksums[0] != batch.seq_checksum[0] || checksums[1] != batch.seq_checksum[1];
+        printf("%-8s 2 dreams %4d tokens %7.1f ms %8.1f tok/s aggregate %7.1f ms per dream%s\n", names[mode],
+               tokens, elapsed / 1e6, tokens / (elapsed / 1e9), latency / 2.0, mismatch ? "  MISMATCH" : "");
+        failed |= mismatch;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (done[i]) {
+            llm_sem_delete(done[i]);
+        }
+    }
+    return failed;
+}
+
+// one full context per mode with the weight prefetch off and on; with the
+// profiler, the per-matmul cycles show how much of each matmul was waiting
+static void bench_prefetch(Transformer *t, Sampler *sampler)
+{
+    Config *p = &t->config;
+    for (int enabled = 0; enabled < 2; enabled++) {
+        llm_prefetch_enable(t->prefetch, enabled);
+        llm_prefetch_reset_stats(t->prefetch);
+        llm_prof_reset();
+        reset_run_state(&t->state, p);
+        int token = 1;
+        double t0 = now_ns();
+        for (int pos = 0; pos < p->seq_len; pos++) {
+            token = sample(sampler, forward(t, token, pos));
+            LLM_PROF_TOKEN();
+        }
+        double elapsed = now_ns() - t0;
+        const llm_prefetch_stats_t *st = &t->prefetch->stats;
+        printf("prefetch %-3s %8.1f tok/s  %u staged, %u in place, %.1f ms waiting\n",
+               enabled ? "on" : "off", p->seq_len / (elapsed / 1e9), (unsigned)st->staged,
+               (unsigned)st->bypassed, st->wait_cycles / 1e6);
+#if CONFIG_LLM_PROFILE
+        static const llm_prof_stage_t matmuls[] = {LLM_PROF_MATMUL_Q, LLM_PROF_MATMUL_K, LLM_PROF_MATMUL_V,
+                                                   LLM_PROF_MATMUL_O, LLM_PROF_MATMUL_W13, LLM_PROF_MATMUL_W2};
+        static const char *names[] = {"wq", "wk", "wv", "wo", "w1/w3", "w2"};
+        for (int i = 0; i < 6; i++) {
+            printf("  %-6s %10.0f cycles/tok\n", names[i],
+                   (double)llm_prof_counters[matmuls[i]].cycles / p->seq_len);
+        }
+#endif
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char *checkpoint_path = argc > 1 ? argv[1] : LLM_DATA_DIR "/aidreams260K.bin";
+    char *tokenizer_path = argc > 2 ? argv[2] : LLM_DATA_DIR "/tok512.bin";
+    srand(1234);
+
+    Transformer transformer;
+    Tokenizer tokenizer;
+    Sampler sampler;
+    build_transformer(&transformer, checkpoint_path);
+    build_tokenizer(&tokenizer, tokenizer_path, transformer.config.vocab_size);
+    build_sampler(&sampler, transformer.config.vocab_size, 0.7f, 0.8f, 1234);
+
+    Config *p = &transformer.config;
+    RunState *s = &transformer.state;
+    int kv_dim = (p->dim * p->n_kv_heads) / p->n_heads;
+    char name[64];
+    printf("model: dim=%d hidden=%d layers=%d heads=%d kv_heads=%d vocab=%d seq_len=%d\n\n",
+           p->dim, p->hidden_dim, p->n_layers, p->n_heads, p->n_kv_heads, p->vocab_size, p->seq_len);
+
+    // kernels, at the shapes forward() uses them
+    int failed = 0;
+    snprintf(name, sizeof(name), "matmul %dx%d (wq/wo)", p->dim, p->dim);
+    failed |= bench_matmul(transformer.workers, name, p->dim, p->dim);
+    snprintf(name, sizeof(name), "matmul %dx%d (wk/wv)", kv_dim, p->dim);
+    failed |= bench_matmul(transformer.workers, name, p->dim, kv_dim);
+    snprintf(name, sizeof(name), "matmul %dx%d (w1/w3)", p->hidden_dim, p->dim);
+    failed |= bench_matmul(transformer.workers, name, p->dim, p->hidden_dim);
+    snprintf(name, sizeof(name), "matmul %dx%d (w2)", p->dim, p->hidden_dim);
+    failed |= bench_matmul(transformer.workers, name, p->hidden_dim, p->dim);
+    snprintf(name, sizeof(name), "matmul %dx%d (classifier)", p->vocab_size, p->dim);
+    failed |= bench_matmul(transformer.workers, name, p->dim, p->vocab_size);
+
+    fill_random(s->q, p->dim);
+    fill_random(s->key_cache, p->seq_len * kv_dim);
+    fill_random(s->value_cache, p->seq_len * kv_dim);
+    int positions[] = {0, p->seq_len / 2 - 1, p->seq_len - 1};
+    for (int i = 0; i < 3; i++) {
+        int pos = positions[i];
+        snprintf(name, sizeof(name), "attention all heads pos=%d", pos);
+        BENCH(name, attention(s, p, 0, pos, 0, p->n_heads));
+    }
+
+    failed |= check_attention(p, s);
+    failed |= check_fused_kernels(transformer.workers, p, s);
+    failed |= check_backends(p, s);
+    check_accuracy("llm_expf [-87, 88]", llm_expf, exp, -87.0f, 88.0f, 0, 1);
+    check_accuracy("llm_sigmoidf [-20, 20]", llm_sigmoidf, ref_sigmoid, -20.0f, 20.0f, 0, 0);
+    check_accuracy("llm_rsqrtf [1e-6, 1e6]", llm_rsqrtf, ref_rsqrt, 1e-6f, 1e6f, 1, 1);
+    bench_math_kernels(p, s);
+
+    v4sf *logits = malloc(p->vocab_size * sizeof(v4sf));
+    fill_random(logits, p->vocab_size);
+    // sample() works in place, so every iteration also pays for restoring the logits
+    snprintf(name, sizeof(name), "sample %d", p->vocab_size);
+    BENCH(name, { memcpy(s->logits, logits, p->vocab_size * sizeof(v4sf)); sample(&sampler, s->logits); });
+    free(logits);
+
+    char *text = "I dreamed of a city made of glass, where the rivers sang to the moon.";
+    int *tokens = malloc((strlen(text) + 3) * sizeof(int));
+    int n_tokens;
+    BENCH("encode (70 chars)", encode(&tokenizer, text, 1, 0, tokens, &n_tokens));
+    free(tokens);
+    failed |= check_tok_image(tokenizer_path, p->vocab_size);
+
+    // end to end: forward + sample for a full context, like generate() without the LEDs
+    reset_run_state(s, p);
+    BENCH("forward pos=0", forward(&transformer, 1, 0));
+    int rounds = 3;
+    long n = 0;
+    llm_prof_reset();
+    if (transformer.stream) {
+        llm_stream_reset_stats(transformer.stream);
+    }
+    double t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        reset_run_state(s, p);
+        int token = 1;
+        for (int pos = 0; pos < p->seq_len; pos++) {
+            v4sf *out = forward(&transformer, token, pos);
+            LLM_PROF_BEGIN(t_sample);
+            token = sample(&sampler, out);
+            LLM_PROF_END(LLM_PROF_SAMPLE, t_sample);
+            decode(&tokenizer, 1, token);
+            LLM_PROF_TOKEN();
+            n++;
+        }
+    }
+    double elapsed = now_ns() - t0;
+    printf("\nend-to-end: %ld tokens in %.1f ms, %.1f tok/s\n", n, elapsed / 1e6, n / (elapsed / 1e9));
+    if (transformer.stream) {
+        const llm_stream_stats_t *st = &transformer.stream->stats;
+        printf("streamed layers: %u hits, %u misses, %.1f ms waiting, %.1f MB read\n",
+               (unsigned)st->hits, (unsigned)st->misses, st->stall_us / 1000.0, st->bytes / 1048576.0);
+        llm_stream_reset_stats(transformer.stream);
+    }
+
+    if (transformer.prefetch) {
+        bench_prefetch(&transformer, &sampler);
+    }
+
+    // deterministic generate(), twice: the checksums must match
+    sampler_set_deterministic(&sampler, BENCH_SEED);
+    uint32_t checksums[2];
+    for (int r = 0; r < 2; r++) {
+        generate(&transformer, &tokenizer, &sampler, BENCH_PROMPT, p->seq_len, generation_done);
+        checksums[r] = llm_last_stats(&transformer)->checksum;
+    }
+    const GenerateStats *stats = llm_last_stats(&transformer);
+    printf("deterministic: seed=%d prompt=\"%s\" tokens=%d checksum=%08x %ld ms %.1f tok/s%s\n",
+           BENCH_SEED, BENCH_PROMPT, stats->tokens, (unsigned)stats->checksum, stats->elapsed_ms,
+           stats->tokens_ps, checksums[0] == checksums[1] ? "" : "  NOT REPRODUCIBLE");
+    failed |= bench_batch(&transformer, &tokenizer, checksums[0]);
+    failed |= bench_session(&transformer, &tokenizer, checksums[0]);
+    failed |= check_llm_sessions(&transformer, &tokenizer);
+    failed |= bench_per_core(&transformer, &tokenizer);
+
+#if CONFIG_LLM_PROFILE
+    char table[2048];
+    llm_prof_render(table, sizeof(table));
+    printf("\n%s", table);
+#endif
+
+    free_sampler(&sampler);
+    free_tokenizer(&tokenizer);
+    free_transformer(&transformer);
+    return checksums[0] == checksums[1] && !failed ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+#include "llm_port.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+struct llm_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int count;
+};
+
+struct llm_task {
+    pthread_t thread;
+    llm_task_fn fn;
+    void *arg;
+};
+
+llm_sem_t llm_sem_create(void)
+{
+    llm_sem_t sem = calloc(1, sizeof(struct llm_sem));
+    if (!sem) {
+        return NULL;
+    }
+    pthread_mutex_init(&sem->lock, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    return sem;
+}
+
+void llm_sem_give(llm_sem_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    sem->count = 1; // binary semaphore, like xSemaphoreCreateBinary()
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+}
+
+void llm_sem_take(llm_sem_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    while (sem->count == 0) {
+        pthread_cond_wait(&sem->cond, &sem->lock);
+    }
+    sem->count = 0;
+    pthread_mutex_unlock(&sem->lock);
+}
+
+void llm_sem_delete(llm_sem_t sem)
+{
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->lock);
+    free(sem);
+}
+
+static void *task_trampoline(void *arg)
+{
+    struct llm_task *task = arg;
+    task->fn(task->arg);
+    // a FreeRTOS task must not return; a host one that does is gone, handle included
+    free(task);
+    return NULL;
+}
+
+void llm_task_exit(void)
+{
+    // the task function returns right after, and the trampoline ends the thread
+}
+
+int llm_task_create(llm_task_fn fn, const char *name, uint32_t stack_size, void *arg,
+                    int priority, int core, llm_task_t *out)
+{
+    // name, stack size, priority and core only matter to FreeRTOS
+    (void)name;
+    (void)stack_size;
+    (void)priority;
+    (void)core;
+    struct llm_task *task = calloc(1, sizeof(struct llm_task));
+    if (!task) {
+        return -1;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    if (pthread_create(&task->thread, NULL, task_trampoline, task) != 0) {
+        free(task);
+        return -1;
+    }
+    pthread_detach(task->thread);
+    if (out) {
+        *out = task;
+    }
+    return 0;
+}
+
+uint32_t llm_port_random(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+uint32_t llm_port_free_heap(void)
+{
+    return 0;
+}
+
+void *llm_port_malloc_internal(size_t size)
+{
+    return malloc(size);
+}
+
+void *llm_port_malloc_external(size_t size)
+{
+    return malloc(size);
+}
+
+void *llm_port_malloc_external_aligned(size_t size, size_t align)
+{
+    void *ptr;
+    return posix_memalign(&ptr, align, size) == 0 ? ptr : NULL;
+}
+
+size_t llm_port_free_internal(void)
+{
+    return SIZE_MAX;
+}
+
+int llm_port_is_external(const void *ptr)
+{
+    (void)ptr;
+    return 1;
+}
+
+// the host has no DMA engine: one copier thread stands in for it
+static struct {
+    llm_sem_t request;
+    void *dst;
+    const void *src;
+    size_t len;
+    llm_sem_t done;
+} copier;
+
+static void copier_task(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        llm_sem_take(copier.request);
+        memcpy(copier.dst, copier.src, copier.len);
+        llm_sem_give(copier.done);
+    }
+}
+
+int llm_port_memcpy_async(void *dst, const void *src, size_t len, llm_sem_t done)
+{
+    if (!copier.request) {
+        copier.request = llm_sem_create();
+        if (!copier.request) {
+            return -1;
+        }
+        if (llm_task_create(copier_task, "copier", 0, NULL, 0, -1, NULL) != 0) {
+            copier.request = NULL;
+            return -1;
+        }
+    }
+    copier.dst = dst;
+    copier.src = src;
+    copier.len = len;
+    copier.done = done;
+    llm_sem_give(copier.request);
+    return 0;
+}
+
+int llm_port_map_partition(const char *label, const void **ptr, size_t *size, llm_map_t *handle)
+{
+    (void)label;
+    (void)ptr;
+    (void)size;
+    (void)handle;
+    return -1;
+}
+
+void llm_port_unmap_partition(llm_map_t handle)
+{
+    (void)handle;
+}
+
+int llm_port_write_partition(const char *label, const void *data, size_t len)
+{
+    (void)label;
+    (void)data;
+    (void)len;
+    return -1;
+}
+
+int llm_port_activate_node(int x, int y)
+{
+    (void)x;
+    (void)y;
+    return 0;
+}
+
+void llm_port_publish_output(const char *text)
+{
+    (void)text;
+}
@@ -0,0 +1,121 @@
+/**
+ * Replays a phase trace through main/power_policy.c, to check and size the
+ * power governor without a board.
+ *
+ * usage: power_replay <trace.csv>
+ *
+ * A trace is one "t_ms,activity,begin|end" event per line. A device log can
+ * be fed as is: anything before "phase," on a line (the log prefix) is
+ * skipped, as are lines without it. Exits non-zero on a malformed or
+ * out-of-order event, or when the policy picks a level that breaks one of
+ * its invariants: generation at MAX, Wi-Fi never asleep.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "power_policy.h"
+
+static int parse_activity(const char *name, power_activity_t *act)
+{
+    for (int i = 0; i < POWER_ACT_COUNT; i++) {
+        if (strcmp(name, power_activity_name(i)) == 0) {
+            *act = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static const char *check_level(const power_policy_t *p, power_level_t level)
+{
+    if (p->active[POWER_ACT_GENERATE] > 0 && level != POWER_LEVEL_MAX) {
+        return "generation below max";
+    }
+    if (p->active[POWER_ACT_NETWORK] > 0 && level == POWER_LEVEL_SLEEP) {
+        return "light sleep with Wi-Fi up";
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace.csv>\n", argv[0]);
+        return 2;
+    }
+    FILE *f = fopen(argv[1], "r");
+    if (!f) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    power_policy_t policy;
+    int started = 0, events = 0, line_no = 0;
+    long long t0 = 0, last = 0;
+    uint32_t begins[POWER_ACT_COUNT] = {0};
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        const char *ev = strstr(line, "phase,");
+        if (!ev) {
+            continue;
+        }
+        long long t_ms;
+        char name[16], edge[8];
+        power_activity_t act;
+        if (sscanf(ev, "phase,%lld,%15[^,],%7[a-z]", &t_ms, name, edge) != 3 ||
+            parse_activity(name, &act) != 0 ||
+            (strcmp(edge, "begin") != 0 && strcmp(edge, "end") != 0)) {
+            fprintf(stderr, "%s:%d: malformed event\n", argv[1], line_no);
+            fclose(f);
+            return 1;
+        }
+        if (!started) {
+            power_policy_init(&policy, t_ms * 1000);
+            t0 = last = t_ms;
+            started = 1;
+        }
+        if (t_ms < last) {
+            fprintf(stderr, "%s:%d: event at %lld ms before the previous one\n", argv[1], line_no, t_ms);
+            fclose(f);
+            return 1;
+        }
+        last = t_ms;
+
+        power_level_t level;
+        if (edge[0] == 'b') {
+            level = power_policy_begin(&policy, act, t_ms * 1000);
+            begins[act]++;
+        } else {
+            level = power_policy_end(&policy, act, t_ms * 1000);
+        }
+        const char *broken = check_level(&policy, level);
+        if (broken) {
+            fprintf(stderr, "%s:%d: %s (level %s)\n", argv[1], line_no, broken, power_level_name(level));
+            fclose(f);
+            return 1;
+        }
+        events++;
+    }
+    fclose(f);
+    if (!started) {
+        fprintf(stderr, "%s: no phase events\n", argv[1]);
+        return 1;
+    }
+
+    double total_s = (last - t0) / 1000.0;
+    printf("%d events over %.1f s:", events, total_s);
+    for (int i = 0; i < POWER_ACT_COUNT; i++) {
+        printf(" %u %s", (unsigned)begins[i], power_activity_name(i));
+    }
+    printf("\n");
+    for (int i = 0; i < POWER_LEVEL_COUNT; i++) {
+        printf("  %-5s (>= %3d MHz) %8.1f s  %5.1f%%\n", power_level_name(i), power_level_min_mhz(i),
+               policy.time_us[i] / 1e6, total_s > 0 ? 100.0 * policy.time_us[i] / 1e6 / total_s : 0.0);
+    }
+    float always_max = power_level_nominal_ma(POWER_LEVEL_MAX) * (float)total_s;
+    float charge = power_policy_charge_mas(&policy);
+    printf("%u level changes, energy proxy %.0f mAs vs %.0f mAs at a fixed maximum (%.0f%% saved)\n",
+           (unsigned)policy.transitions, charge, always_max,
+           always_max > 0 ? 100.0f * (1.0f - charge / always_max) : 0.0f);
+    return 0;
+}
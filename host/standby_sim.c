@@ -0,0 +1,136 @@
+/**
+ * Replays a standby trace through main/standby.c, to check the policy and
+ * size its savings without a board.
+ *
+ * usage: standby_sim <trace.csv> <idle_dreams>
+ *
+ * A trace is one "standby,t_ms,name" line per event: shown, motion, button
+ * or network as inputs, and enter or resume right after the input that
+ * caused them. A device log can be fed as is (anything before "standby,"
+ * is skipped, as are lines without it), and so can a simulated scenario
+ * such as traces/standby_gallery.csv. Exits non-zero on a malformed line or
+ * when the policy, with idle_dreams as its limit, does not take exactly the
+ * actions the trace records.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "standby.h"
+
+static int parse_event(const char *name, standby_event_t *ev)
+{
+    for (int i = 0; i < STANDBY_EV_COUNT; i++) {
+        if (strcmp(name, standby_event_name(i)) == 0) {
+            *ev = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int parse_action(const char *name, standby_action_t *action)
+{
+    for (int i = STANDBY_ENTER; i <= STANDBY_RESUME; i++) {
+        if (strcmp(name, standby_action_name(i)) == 0) {
+            *action = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <trace.csv> <idle_dreams>\n", argv[0]);
+        return 2;
+    }
+    FILE *f = fopen(argv[1], "r");
+    if (!f) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    int idle_limit = atoi(argv[2]);
+
+    standby_t sb;
+    int started = 0, line_no = 0, failed = 0;
+    long long t0 = 0, last = 0;
+    uint32_t shown = 0;
+    standby_action_t pending = STANDBY_NONE; // action the last input asked for, not yet seen in the trace
+    char line[256];
+    while (!failed && fgets(line, sizeof(line), f)) {
+        line_no++;
+        const char *rec = strstr(line, "standby,");
+        if (!rec) {
+            continue;
+        }
+        long long t_ms;
+        char name[16];
+        if (sscanf(rec, "standby,%lld,%15[a-z]", &t_ms, name) != 2) {
+            fprintf(stderr, "%s:%d: malformed line\n", argv[1], line_no);
+            failed = 1;
+            break;
+        }
+        if (!started) {
+            standby_init(&sb, idle_limit, t_ms * 1000);
+            t0 = last = t_ms;
+            started = 1;
+        }
+        if (t_ms < last) {
+            fprintf(stderr, "%s:%d: event at %lld ms before the previous one\n", argv[1], line_no, t_ms);
+            failed = 1;
+            break;
+        }
+        last = t_ms;
+
+        standby_event_t ev;
+        standby_action_t action;
+        if (parse_action(name, &action) == 0) {
+            if (action != pending) {
+                fprintf(stderr, "%s:%d: trace says %s, the policy said %s\n", argv[1], line_no,
+                        name, standby_action_name(pending));
+                failed = 1;
+            }
+            pending = STANDBY_NONE;
+        } else if (parse_event(name, &ev) == 0) {
+            if (pending != STANDBY_NONE) {
+                fprintf(stderr, "%s:%d: the policy said %s, the trace did not\n", argv[1], line_no,
+                        standby_action_name(pending));
+                failed = 1;
+            }
+            pending = standby_event(&sb, ev, t_ms * 1000);
+            shown += ev == STANDBY_EV_DREAM_SHOWN;
+        } else {
+            fprintf(stderr, "%s:%d: unknown event %s\n", argv[1], line_no, name);
+            failed = 1;
+        }
+    }
+    fclose(f);
+    if (!failed && pending != STANDBY_NONE) {
+        fprintf(stderr, "%s: the policy said %s at the end, the trace did not\n", argv[1],
+                standby_action_name(pending));
+        failed = 1;
+    }
+    if (failed) {
+        return 1;
+    }
+    if (!started) {
+        fprintf(stderr, "%s: no standby events\n", argv[1]);
+        return 1;
+    }
+
+    double total_s = (last - t0) / 1000.0;
+    double asleep_s = sb.time_us[STANDBY_ASLEEP] / 1e6;
+    printf("%u dreams shown over %.1f h, %u standbys, %u resumes\n", (unsigned)shown, total_s / 3600,
+           (unsigned)sb.entries, (unsigned)sb.resumes);
+    printf("  asleep %.1f h (%.1f%%)\n", asleep_s / 3600, total_s > 0 ? 100.0 * asleep_s / total_s : 0.0);
+    if (sb.resumes > 0) {
+        printf("  resume latency %.0f ms average, %.0f ms max (wake to first dream)\n",
+               sb.latency_sum_us / 1000.0 / sb.resumes, sb.latency_max_us / 1000.0);
+    }
+    float never = standby_nominal_ma(STANDBY_ACTIVE) * (float)total_s;
+    float charge = standby_charge_mas(&sb);
+    printf("energy proxy %.0f mAs vs %.0f mAs without standby (%.0f%% saved)\n", charge, never,
+           never > 0 ? 100.0f * (1.0f - charge / never) : 0.0f);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "app_events.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+
+#define APP_EVENTS_DEPTH 16
+
+static const char *TAG = "APP_EVENTS";
+
+static QueueHandle_t queue = NULL;
+static volatile uint32_t dropped = 0;
+
+static const char *names[APP_EV_COUNT] = {
+    [APP_EV_DREAM_READY] = "dream_ready",
+    [APP_EV_ANIMATION_DONE] = "animation_done",
+    [APP_EV_BUTTON_CLICK] = "click",
+    [APP_EV_BUTTON_DOUBLE] = "double_click",
+    [APP_EV_BUTTON_LONG] = "long_press",
+    [APP_EV_SHAKE] = "shake",
+    [APP_EV_MOTION] = "motion",
+    [APP_EV_CLIENT_JOINED] = "client_joined",
+    [APP_EV_CLIENT_LEFT] = "client_left",
+    [APP_EV_PORTAL_IDLE] = "portal_idle",
+};
+
+esp_err_t app_events_init(void) {
+    if (queue != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    queue = xQueueCreate(APP_EVENTS_DEPTH, sizeof(app_event_t));
+    return queue ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+bool app_events_post(app_event_type_t type) {
+    app_event_t ev = {
+        .type = type,
+        .at_us = esp_timer_get_time(),
+    };
+    if (queue == NULL || xQueueSend(queue, &ev, 0) != pdTRUE) {
+        // the app task is stuck or the queue too short: say so, once in a while
+        if (dropped++ % 16 == 0) {
+            ESP_LOGW(TAG, "Queue full, dropped %s (%u so far)", app_event_name(type), (unsigned)dropped);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool app_events_wait(app_event_t *ev, TickType_t timeout) {
+    return xQueueReceive(queue, ev, timeout) == pdTRUE;
+}
+
+uint32_t app_events_dropped(void) {
+    return dropped;
+}
+
+const char *app_event_name(app_event_type_t type) {
+    return type < APP_EV_COUNT ? names[type] : "?";
+}
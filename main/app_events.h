@@ -0,0 +1,64 @@
+#ifndef APP_EVENTS_H
+#define APP_EVENTS_H
+
+/**
+ * Central event queue of the application.
+ *
+ * Drivers, timers and tasks post what happened; the app task in main.c is
+ * the only reader and owns the state machine (booting, generating,
+ * animating, portal, standby). It blocks on the queue and wakes only when
+ * something is posted, so there is no polling loop and timeouts are
+ * one-shot esp_timers that post an event when they expire, to the
+ * microsecond instead of counted in loop iterations.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+    APP_EV_DREAM_READY,     // the producer pushed a dream into the ring
+    APP_EV_ANIMATION_DONE,  // the animator finished a dream
+    APP_EV_BUTTON_CLICK,
+    APP_EV_BUTTON_DOUBLE,
+    APP_EV_BUTTON_LONG,
+    APP_EV_SHAKE,
+    APP_EV_MOTION,          // any movement, for the standby policy
+    APP_EV_CLIENT_JOINED,   // a station joined the access point
+    APP_EV_CLIENT_LEFT,
+    APP_EV_PORTAL_IDLE,     // no station for the whole portal timeout
+    APP_EV_COUNT
+} app_event_type_t;
+
+typedef struct {
+    app_event_type_t type;
+    int64_t at_us;          // esp_timer_get_time() when posted
+} app_event_t;
+
+/**
+ * @brief Creates the queue
+ * @return ESP_OK in caso di successo
+ */
+esp_err_t app_events_init(void);
+
+/**
+ * @brief Posts an event without blocking, from any task or timer callback
+ * @return false if the queue was full and the event was dropped
+ */
+bool app_events_post(app_event_type_t type);
+
+/**
+ * @brief Waits for the next event
+ * @return false on timeout
+ */
+bool app_events_wait(app_event_t *ev, TickType_t timeout);
+
+/**
+ * @brief Events dropped because the queue was full, since boot
+ */
+uint32_t app_events_dropped(void);
+
+const char *app_event_name(app_event_type_t type);
+
+#endif // APP_EVENTS_H
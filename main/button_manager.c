@@ -1,35 +1,133 @@
 #include "button_manager.h"
+#include <stdbool.h>
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_sleep.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 
 static const char *TAG = "BUTTON_MANAGER";
+
+#define EVENT_QUEUE_LEN 4
+
 static TaskHandle_t button_task_handle = NULL;
-static button_callback_t button_cb = NULL;
-
-static void button_monitor_task(void *pvParameters) {
-    while(1) {
-        if (gpio_get_level(BOOT_BUTTON_PIN) == 0) {  // Button pressed
-            vTaskDelay(pdMS_TO_TICKS(50));  // Debounce
-            
-            if (gpio_get_level(BOOT_BUTTON_PIN) == 0) {
-                ESP_LOGI(TAG, "Button press confirmed");
-                
-                if (button_cb) {
-                    button_cb();
-                }
-                
-                // Wait for button release
-                while(gpio_get_level(BOOT_BUTTON_PIN) == 0) {
-                    vTaskDelay(pdMS_TO_TICKS(10));
-                }
+static QueueHandle_t event_queue = NULL;
+static button_handler_t button_handler = NULL;
+static void *button_arg = NULL;
+
+static esp_timer_handle_t debounce_timer = NULL;
+static esp_timer_handle_t long_press_timer = NULL;
+static esp_timer_handle_t gap_timer = NULL;
+
+// Gesture state. Only the esp_timer callbacks touch it, and esp_timer runs
+// them one at a time on its own task, so it needs no lock.
+static int stable_level = 1;        // pulled up: 1 is released
+static bool long_fired = false;     // the current press already reported LONG_PRESS
+static bool click_pending = false;  // released once, waiting to see if a second press follows
+static bool second_press = false;   // the current press is the second of a double click
+
+static const char *event_names[] = {"click", "double click", "long press"};
+
+const char *button_event_name(button_event_t event) {
+    return event <= BUTTON_EVENT_LONG_PRESS ? event_names[event] : "?";
+}
+
+// The ISR masks the pin until the debounce timer has looked at it, so a
+// bouncing contact costs one interrupt and one timer per change
+static void IRAM_ATTR button_isr(void *arg) {
+    gpio_intr_disable(BOOT_BUTTON_PIN);
+    esp_timer_start_once(debounce_timer, BUTTON_DEBOUNCE_MS * 1000);
+}
+
+// Interrupts on the level the button is not at, i.e. on the next change;
+// the same level wakes the chip from light sleep
+static void arm(int level) {
+    gpio_int_type_t next = level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL;
+#if CONFIG_PM_ENABLE
+    gpio_wakeup_enable(BOOT_BUTTON_PIN, next);
+#else
+    gpio_set_intr_type(BOOT_BUTTON_PIN, next);
+#endif
+    gpio_intr_enable(BOOT_BUTTON_PIN);
+}
+
+static void emit(button_event_t event) {
+    if (xQueueSend(event_queue, &event, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Handler busy, %s dropped", button_event_name(event));
+    }
+}
+
+static void on_press(void) {
+    long_fired = false;
+    if (click_pending) {
+        esp_timer_stop(gap_timer);
+        click_pending = false;
+        second_press = true;
+    }
+    esp_timer_start_once(long_press_timer, BUTTON_LONG_PRESS_MS * 1000);
+}
+
+static void on_release(void) {
+    esp_timer_stop(long_press_timer);
+    if (long_fired) {
+        return;
+    }
+    if (second_press) {
+        second_press = false;
+        emit(BUTTON_EVENT_DOUBLE_CLICK);
+    } else {
+        click_pending = true;
+        esp_timer_start_once(gap_timer, BUTTON_DOUBLE_CLICK_MS * 1000);
+    }
+}
+
+static void debounce_done(void *arg) {
+    int level = gpio_get_level(BOOT_BUTTON_PIN);
+    if (level != stable_level) {
+        stable_level = level;
+        if (level == 0) {
+            on_press();
+        } else {
+            on_release();
+        }
+    }
+    arm(stable_level);
+}
+
+static void long_press_done(void *arg) {
+    long_fired = true;
+    second_press = false;
+    emit(BUTTON_EVENT_LONG_PRESS);
+}
+
+static void gap_done(void *arg) {
+    click_pending = false;
+    emit(BUTTON_EVENT_CLICK);
+}
+
+// Runs the handler off the input path: it may start Wi-Fi and the portal
+static void button_event_task(void *pvParameters) {
+    button_event_t event;
+    while (1) {
+        if (xQueueReceive(event_queue, &event, portMAX_DELAY) == pdTRUE) {
+            ESP_LOGI(TAG, "Button %s", button_event_name(event));
+            if (button_handler) {
+                button_handler(event, button_arg);
             }
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
     }
 }
 
-esp_err_t button_manager_init(button_callback_t button_pressed_cb) {
+static esp_err_t create_timer(esp_timer_cb_t cb, const char *name, esp_timer_handle_t *timer) {
+    esp_timer_create_args_t args = {
+        .callback = cb,
+        .name = name,
+    };
+    return esp_timer_create(&args, timer);
+}
+
+esp_err_t button_manager_init(button_handler_t handler, void *arg) {
     if (button_task_handle != NULL) {
         return ESP_ERR_INVALID_STATE;
     }
@@ -41,17 +139,39 @@ esp_err_t button_manager_init(button_callback_t button_pressed_cb) {
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
         .intr_type = GPIO_INTR_DISABLE
     };
-    
+
     esp_err_t ret = gpio_config(&io_conf);
     if (ret != ESP_OK) return ret;
 
-    button_cb = button_pressed_cb;
-    
-    BaseType_t task_ret = xTaskCreate(button_monitor_task, "button_monitor", 
-                                     4096, NULL, tskIDLE_PRIORITY + 3, 
+    button_handler = handler;
+    button_arg = arg;
+    event_queue = xQueueCreate(EVENT_QUEUE_LEN, sizeof(button_event_t));
+    if (!event_queue) return ESP_ERR_NO_MEM;
+
+    if ((ret = create_timer(debounce_done, "btn_debounce", &debounce_timer)) != ESP_OK ||
+        (ret = create_timer(long_press_done, "btn_long", &long_press_timer)) != ESP_OK ||
+        (ret = create_timer(gap_done, "btn_gap", &gap_timer)) != ESP_OK) {
+        return ret;
+    }
+
+    // below the animations: a gesture can wait for the frame being drawn
+    BaseType_t task_ret = xTaskCreate(button_event_task, "button_events",
+                                     4096, NULL, tskIDLE_PRIORITY + 3,
                                      &button_task_handle);
-    
-    return (task_ret == pdPASS) ? ESP_OK : ESP_FAIL;
+    if (task_ret != pdPASS) return ESP_FAIL;
+
+    // the service may already be installed by another driver
+    ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) return ret;
+    ret = gpio_isr_handler_add(BOOT_BUTTON_PIN, button_isr, NULL);
+    if (ret != ESP_OK) return ret;
+#if CONFIG_PM_ENABLE
+    ret = esp_sleep_enable_gpio_wakeup();
+    if (ret != ESP_OK) return ret;
+#endif
+    stable_level = gpio_get_level(BOOT_BUTTON_PIN);
+    arm(stable_level);
+    return ESP_OK;
 }
 
 esp_err_t button_manager_stop(void) {
@@ -59,7 +179,23 @@ esp_err_t button_manager_stop(void) {
         return ESP_ERR_INVALID_STATE;
     }
 
+    gpio_intr_disable(BOOT_BUTTON_PIN);
+    gpio_isr_handler_remove(BOOT_BUTTON_PIN);
+#if CONFIG_PM_ENABLE
+    gpio_wakeup_disable(BOOT_BUTTON_PIN);
+#endif
+    esp_timer_stop(debounce_timer);
+    esp_timer_stop(long_press_timer);
+    esp_timer_stop(gap_timer);
+    esp_timer_delete(debounce_timer);
+    esp_timer_delete(long_press_timer);
+    esp_timer_delete(gap_timer);
+    debounce_timer = long_press_timer = gap_timer = NULL;
+
     vTaskDelete(button_task_handle);
     button_task_handle = NULL;
+    vQueueDelete(event_queue);
+    event_queue = NULL;
+    click_pending = second_press = long_fired = false;
     return ESP_OK;
-}
\ No newline at end of file
+}
@@ -1,19 +1,46 @@
 #ifndef BUTTON_MANAGER_H
 #define BUTTON_MANAGER_H
 
+/**
+ * Interrupt-driven button with gesture recognition.
+ *
+ * The pin interrupt is level-triggered on the level the button is not at,
+ * so it fires once per change. The ISR only masks it and starts a debounce
+ * timer; the esp_timer callbacks turn the settled levels into gestures:
+ *
+ *   press, release within BUTTON_DOUBLE_CLICK_MS, no second press   CLICK
+ *   press, release, second press and release within the gap         DOUBLE_CLICK
+ *   held for BUTTON_LONG_PRESS_MS (reported while still held)       LONG_PRESS
+ *
+ * Gestures go through a queue to a handler task, which is the only place
+ * the handler runs. Nothing wakes up while the button is left alone, and
+ * with power management on the pin also wakes the chip from light sleep.
+ */
+
 #include "esp_err.h"
 #include "driver/gpio.h"
 
 #define BOOT_BUTTON_PIN GPIO_NUM_0
 
-typedef void (*button_callback_t)(void);
+#define BUTTON_DEBOUNCE_MS       30
+#define BUTTON_DOUBLE_CLICK_MS   350   // from a release to the next press
+#define BUTTON_LONG_PRESS_MS     1500
+
+typedef enum {
+    BUTTON_EVENT_CLICK,
+    BUTTON_EVENT_DOUBLE_CLICK,
+    BUTTON_EVENT_LONG_PRESS,
+} button_event_t;
+
+typedef void (*button_handler_t)(button_event_t event, void *arg);
 
 /**
  * @brief Inizializza il gestore dei pulsanti
- * @param button_pressed_cb Callback da chiamare quando il pulsante viene premuto
+ * @param handler Called on the handler task for every gesture; may block
+ * @param arg Passed to handler
  * @return ESP_OK in caso di successo
  */
-esp_err_t button_manager_init(button_callback_t button_pressed_cb);
+esp_err_t button_manager_init(button_handler_t handler, void *arg);
 
 /**
  * @brief Ferma il monitoraggio dei pulsanti
@@ -21,4 +48,6 @@ esp_err_t button_manager_init(button_callback_t button_pressed_cb);
  */
 esp_err_t button_manager_stop(void);
 
-#endif // BUTTON_MANAGER_H
\ No newline at end of file
+const char *button_event_name(button_event_t event);
+
+#endif // BUTTON_MANAGER_H
@@ -10,6 +10,7 @@
 #include "lwip/udp.h"
 #include "esp_netif.h"
 #include "captive_portal.h"
+#include "llm_prof.h"
 
 static const char *TAG = "CAPTIVE_PORTAL";
 
@@ -26,6 +27,8 @@ size_t llm_output_len = 0;
 #define DNS_AA_FLAG            0x0400
 #define DNS_TTL               300
 
+#define PROFILE_TABLE_SIZE     2048
+
 // DNS Structures
 typedef struct __attribute__((__packed__)) {
     uint16_t id;
@@ -101,10 +104,37 @@ static void dns_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
     pbuf_free(p);
 }
 
+// Per-stage inference profile of the last dream
+static esp_err_t profile_handler(httpd_req_t *req) {
+    const char *html_head =
+        "<!DOCTYPE html><html><head>"
+        "<meta name='viewport' content='width=device-width,initial-scale=1'>"
+        "<style>body{font-family:system-ui;margin:20px;background:#f0f0f0}"
+        "pre{background:#fff;padding:15px;border-radius:4px;border:1px solid #ddd}</style>"
+        "</head><body><h1>Inference profile</h1><pre>";
+    const char *html_tail = "</pre></body></html>";
+
+    char *table = malloc(PROFILE_TABLE_SIZE);
+    if (!table) return ESP_ERR_NO_MEM;
+    llm_prof_render(table, PROFILE_TABLE_SIZE);
+
+    httpd_resp_set_type(req, "text/html");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store, no-cache, must-revalidate");
+    httpd_resp_sendstr_chunk(req, html_head);
+    httpd_resp_sendstr_chunk(req, table);
+    httpd_resp_sendstr_chunk(req, html_tail);
+    free(table);
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
 // HTTP handler
 static esp_err_t http_handler(httpd_req_t *req) {
     ESP_LOGI(TAG, "HTTP Request: %s", req->uri);
 
+    if (strcmp(req->uri, "/metrics/profile") == 0) {
+        return profile_handler(req);
+    }
+
     // Root page or detection endpoints
     if (strcmp(req->uri, "/") == 0 ||
         strcmp(req->uri, "/generate_204") == 0 ||
@@ -0,0 +1,61 @@
+#include "ckpt_image.h"
+#include <string.h>
+
+uint32_t ckpt_checksum_update(uint32_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint32_t ckpt_checksum(const void *data, size_t len)
+{
+    return ckpt_checksum_update(CKPT_CHECKSUM_INIT, data, len);
+}
+
+static const ckpt_tensor_t *directory(const ckpt_header_t *hdr)
+{
+    return (const ckpt_tensor_t *)((const uint8_t *)hdr + hdr->dir_off);
+}
+
+int ckpt_validate_directory(const void *data, size_t len)
+{
+    const ckpt_header_t *hdr = data;
+    if (!hdr || len < sizeof(ckpt_header_t)) return 0;
+    if (hdr->magic != CKPT_MAGIC || hdr->version != CKPT_VERSION) return 0;
+    if (hdr->file_size < sizeof(ckpt_header_t)) return 0;
+    if (hdr->alignment < CKPT_MIN_ALIGN || CKPT_ALIGN % hdr->alignment != 0) return 0;
+    size_t dir_end = (size_t)hdr->dir_off + (size_t)hdr->n_tensors * sizeof(ckpt_tensor_t);
+    if (hdr->dir_off < sizeof(ckpt_header_t) || dir_end > hdr->file_size || dir_end > len) {
+        return 0;
+    }
+    const ckpt_tensor_t *dir = directory(hdr);
+    for (uint32_t i = 0; i < hdr->n_tensors; i++) {
+        if (memchr(dir[i].name, '\0', CKPT_NAME_LEN) == NULL) return 0;
+        if (dir[i].offset % hdr->alignment != 0) return 0;
+        if ((size_t)dir[i].offset + dir[i].size > hdr->file_size) return 0;
+    }
+    return 1;
+}
+
+int ckpt_validate(const void *data, size_t len)
+{
+    const ckpt_header_t *hdr = data;
+    if (!ckpt_validate_directory(data, len) || hdr->file_size > len) return 0;
+    return ckpt_checksum((const uint8_t *)data + sizeof(ckpt_header_t),
+                         hdr->file_size - sizeof(ckpt_header_t)) == hdr->checksum;
+}
+
+const ckpt_tensor_t *ckpt_find(const ckpt_header_t *hdr, const char *name)
+{
+    const ckpt_tensor_t *dir = directory(hdr);
+    for (uint32_t i = 0; i < hdr->n_tensors; i++) {
+        if (strcmp(dir[i].name, name) == 0) {
+            return &dir[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,94 @@
+#ifndef CKPT_IMAGE_H
+#define CKPT_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Checkpoint container, version 2.
+ *
+ * A self-describing replacement for the llama2.c .bin layout, where the
+ * weights follow a 28-byte Config and their order is implicit. Layout:
+ *
+ *   ckpt_header_t                   64 bytes
+ *   ckpt_tensor_t dir[n_tensors]    64 bytes each
+ *   tensor data                     each tensor at a CKPT_ALIGN-aligned offset
+ *
+ * Offsets are from the start of the file, so a 64-byte aligned load buffer
+ * keeps every tensor aligned for the dot-product kernels. The checksum covers
+ * everything after the header. Written by host/ckpt_pack.c.
+ */
+
+#define CKPT_MAGIC   0x324B434C  // "LCK2"
+#define CKPT_VERSION 2
+#define CKPT_ALIGN   64
+#define CKPT_MIN_ALIGN 16        // the dot-product kernels load 4 floats at a time
+#define CKPT_NAME_LEN 32
+
+#define CKPT_DTYPE_F32 0
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_size;         // total size in bytes, header included
+    uint32_t checksum;          // FNV-1a of everything after the header
+    uint32_t n_tensors;
+    uint32_t dir_off;
+    uint32_t alignment;         // CKPT_ALIGN when written, at least CKPT_MIN_ALIGN when read
+    // model hyperparameters, same meaning as Config in llm.h
+    int32_t dim;
+    int32_t hidden_dim;
+    int32_t n_layers;
+    int32_t n_heads;
+    int32_t n_kv_heads;
+    int32_t vocab_size;         // always positive; a missing "wcls" means shared weights
+    int32_t seq_len;
+    uint32_t reserved[2];
+} ckpt_header_t;
+
+typedef struct {
+    char name[CKPT_NAME_LEN];   // NUL-terminated, e.g. "wq"
+    uint32_t dtype;             // CKPT_DTYPE_*
+    uint32_t ndim;
+    uint32_t shape[4];          // outermost first, unused dimensions are 0
+    uint32_t offset;            // from the start of the file
+    uint32_t size;              // bytes
+} ckpt_tensor_t;
+
+_Static_assert(sizeof(ckpt_header_t) == 64, "ckpt_header_t must stay 64 bytes");
+_Static_assert(sizeof(ckpt_tensor_t) == 64, "ckpt_tensor_t must stay 64 bytes");
+
+#define CKPT_CHECKSUM_INIT 2166136261u  // FNV-1a offset basis
+
+/**
+ * @brief FNV-1a over a byte range, the checksum used by the container
+ */
+uint32_t ckpt_checksum(const void *data, size_t len);
+
+/**
+ * @brief Continues a checksum over the next chunk, for files read piecewise;
+ *        start from CKPT_CHECKSUM_INIT
+ */
+uint32_t ckpt_checksum_update(uint32_t h, const void *data, size_t len);
+
+/**
+ * @brief Checks magic, version, directory bounds and tensor alignment, but not
+ *        the checksum, so only the header and directory need to be in memory
+ * @param len Bytes available at data, at least up to the end of the directory
+ * @return 1 if the directory can be used, 0 otherwise
+ */
+int ckpt_validate_directory(const void *data, size_t len);
+
+/**
+ * @brief Checks magic, version, directory bounds, tensor alignment and checksum
+ * @return 1 if the file can be used, 0 otherwise
+ */
+int ckpt_validate(const void *data, size_t len);
+
+/**
+ * @brief Looks up a tensor by name in a validated container
+ * @return The directory entry, or NULL if there is no such tensor
+ */
+const ckpt_tensor_t *ckpt_find(const ckpt_header_t *hdr, const char *name);
+
+#endif // CKPT_IMAGE_H
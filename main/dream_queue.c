@@ -0,0 +1,191 @@
+#include "dream_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "DREAM_QUEUE";
+
+#define PRODUCER_IDLE_MS 100
+#define MAX_PRODUCERS 2
+
+static QueueHandle_t queue = NULL;
+static SemaphoreHandle_t space = NULL;  // given on every pop, so a full ring wakes the producer
+static int capacity = 0;
+
+typedef struct {
+    dream_generate_fn fn;
+    void *arg;
+    int per_run;
+    int64_t run_start_us;               // start of the current run, 0 while it waits
+} producer_t;
+
+static producer_t producers[MAX_PRODUCERS];
+static int n_producers = 0;
+static int reserved = 0;                // slots promised to the runs in progress
+
+static dream_queue_stats_t stats;
+static int64_t busy_us = 0;             // producer time spent generating, since the last stats read
+static int64_t window_start_us = 0;
+static bool consumer_waiting = false;   // the last pop found the ring empty
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t dream_queue_init(int size) {
+    // the ring holds pointers, the dreams themselves live on the heap
+    queue = xQueueCreate(size, sizeof(dream_t *));
+    space = xSemaphoreCreateBinary();
+    if (!queue || !space) {
+        ESP_LOGE(TAG, "Failed to create a ring of %d dreams", size);
+        return ESP_ERR_NO_MEM;
+    }
+    capacity = size;
+    window_start_us = esp_timer_get_time();
+    return ESP_OK;
+}
+
+// room for a run, taking into account what the other producers' runs will push
+static bool reserve_run(producer_t *p) {
+    bool ok = false, more = false;
+    portENTER_CRITICAL(&stats_lock);
+    int room = (int)uxQueueSpacesAvailable(queue) - reserved;
+    if (room >= p->per_run) {
+        reserved += p->per_run;
+        p->run_start_us = esp_timer_get_time();
+        ok = true;
+        more = room - p->per_run > 0;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    if (more && n_producers > 1) {
+        // several pops may have been folded into one give: pass the rest on
+        xSemaphoreGive(space);
+    }
+    return ok;
+}
+
+static void producer_task(void *arg) {
+    producer_t *p = arg;
+    for (;;) {
+        if (!reserve_run(p)) {
+            xSemaphoreTake(space, portMAX_DELAY);
+            continue;
+        }
+        int made = p->fn(p->arg);
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&stats_lock);
+        reserved -= p->per_run;
+        busy_us += now - p->run_start_us;
+        p->run_start_us = 0;
+        portEXIT_CRITICAL(&stats_lock);
+        if (made == 0) {
+            vTaskDelay(pdMS_TO_TICKS(PRODUCER_IDLE_MS));
+        }
+    }
+}
+
+esp_err_t dream_queue_start_producer(dream_generate_fn generate, void *arg, int per_run,
+                                     int priority, int core) {
+    if (!queue || per_run < 1 || per_run > capacity) {
+        ESP_LOGE(TAG, "Runs of %d dreams don't fit a ring of %d", per_run, capacity);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (n_producers == MAX_PRODUCERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    producer_t *p = &producers[n_producers];
+    p->fn = generate;
+    p->arg = arg;
+    p->per_run = per_run;
+    char name[20];
+    snprintf(name, sizeof(name), "dream_producer%d", n_producers);
+    // generate() and its worker tasks need a deep stack for the activations on it
+    if (xTaskCreatePinnedToCore(producer_task, name, 16384, p, priority, NULL, core) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the producer");
+        return ESP_ERR_NO_MEM;
+    }
+    n_producers++;
+    ESP_LOGI(TAG, "Producer on core %d, ring of %d dreams, %d per run", core, capacity, per_run);
+    return ESP_OK;
+}
+
+bool dream_queue_push(const char *text, const DreamTrail *trail) {
+    dream_t *dream = malloc(sizeof(dream_t));
+    char *copy = strdup(text);
+    if (!dream || !copy) {
+        ESP_LOGW(TAG, "No memory for a dream, dropped");
+        free(dream);
+        free(copy);
+        return false;
+    }
+    dream->text = copy;
+    dream->trail = *trail;
+    if (xQueueSend(queue, &dream, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Ring full, dream dropped");
+        dream_free(dream);
+        portENTER_CRITICAL(&stats_lock);
+        stats.dropped++;
+        portEXIT_CRITICAL(&stats_lock);
+        return false;
+    }
+    portENTER_CRITICAL(&stats_lock);
+    stats.produced++;
+    portEXIT_CRITICAL(&stats_lock);
+    return true;
+}
+
+dream_t *dream_queue_pop(uint32_t timeout_ms) {
+    dream_t *dream = NULL;
+    if (xQueueReceive(queue, &dream, 0) != pdTRUE) {
+        // counted once per wait, however often the consumer polls
+        if (!consumer_waiting) {
+            consumer_waiting = true;
+            portENTER_CRITICAL(&stats_lock);
+            stats.starved++;
+            portEXIT_CRITICAL(&stats_lock);
+        }
+        if (xQueueReceive(queue, &dream, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+            return NULL;
+        }
+    }
+    consumer_waiting = false;
+    portENTER_CRITICAL(&stats_lock);
+    stats.consumed++;
+    portEXIT_CRITICAL(&stats_lock);
+    xSemaphoreGive(space);
+    return dream;
+}
+
+void dream_free(dream_t *dream) {
+    if (!dream) {
+        return;
+    }
+    free(dream->text);
+    free(dream);
+}
+
+int dream_queue_depth(void) {
+    return (int)uxQueueMessagesWaiting(queue);
+}
+
+void dream_queue_get_stats(dream_queue_stats_t *out) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    for (int i = 0; i < n_producers; i++) {
+        if (producers[i].run_start_us) {
+            // the run in progress counts up to now, the rest of it in the next window
+            busy_us += now - producers[i].run_start_us;
+            producers[i].run_start_us = now;
+        }
+    }
+    int64_t window = (now - window_start_us) * (n_producers > 0 ? n_producers : 1);
+    out->duty_cycle = window > 0 ? (float)busy_us / window : 0.0f;
+    busy_us = 0;
+    window_start_us = now;
+    portEXIT_CRITICAL(&stats_lock);
+    out->depth = dream_queue_depth();
+    out->capacity = capacity;
+}
@@ -0,0 +1,82 @@
+#ifndef DREAM_QUEUE_H
+#define DREAM_QUEUE_H
+
+/**
+ * Ring of dreams ready to be animated, filled ahead of time.
+ *
+ * animate_dream() pulses a dream for more than a minute. Instead of waiting
+ * for it to end before generating the next one, a producer task pinned to
+ * the inference core keeps this ring full at low priority, and the animator
+ * on the other core takes the next dream as soon as an animation ends.
+ * The producer only starts a run when the ring has room for all the dreams
+ * it returns, so none are dropped.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "llm.h"
+
+typedef struct {
+    char *text;
+    DreamTrail trail;   // LEDs to light before animating it
+} dream_t;
+
+/**
+ * @brief Generates one run of dreams and pushes them with dream_queue_push()
+ * @return Number of dreams pushed; 0 when there was nothing to do, in which
+ *         case the producer retries a little later
+ */
+typedef int (*dream_generate_fn)(void *arg);
+
+typedef struct {
+    int depth;           // dreams ready
+    int capacity;
+    uint32_t produced;
+    uint32_t consumed;
+    uint32_t dropped;    // pushes that found the ring full
+    uint32_t starved;    // pops that found it empty
+    float duty_cycle;    // share of the time the producers spent generating, since the last call
+} dream_queue_stats_t;
+
+/**
+ * @brief Creates the ring
+ * @param capacity Number of dreams it holds
+ * @return ESP_OK in caso di successo
+ */
+esp_err_t dream_queue_init(int capacity);
+
+/**
+ * @brief Starts a producer task, which calls generate whenever the ring has
+ *        room for per_run more dreams. Up to two producers, e.g. one per
+ *        core; each run reserves its room, so they never push into a full ring
+ * @param per_run Dreams one call of generate pushes, at most the capacity
+ */
+esp_err_t dream_queue_start_producer(dream_generate_fn generate, void *arg, int per_run,
+                                     int priority, int core);
+
+/**
+ * @brief Copies a dream into the ring
+ * @return false if the ring is full or out of memory, in which case the dream is dropped
+ */
+bool dream_queue_push(const char *text, const DreamTrail *trail);
+
+/**
+ * @brief Takes the oldest dream, waiting up to timeout_ms for one
+ * @return The dream, to release with dream_free(); NULL if the ring stayed empty
+ */
+dream_t *dream_queue_pop(uint32_t timeout_ms);
+
+void dream_free(dream_t *dream);
+
+/**
+ * @brief Number of dreams ready
+ */
+int dream_queue_depth(void);
+
+/**
+ * @brief Fills in the counters; the duty cycle covers the time since the previous call
+ */
+void dream_queue_get_stats(dream_queue_stats_t *stats);
+
+#endif // DREAM_QUEUE_H
@@ -0,0 +1,101 @@
+#include "gesture.h"
+#include <math.h>
+#include <string.h>
+
+void gesture_default_config(gesture_config_t *c, float sample_hz)
+{
+    c->sample_hz = sample_hz;
+    c->hp_cutoff_hz = 0.8f;
+    c->release_ms = 40.0f;
+    c->peak_on_g = 0.7f;
+    c->peak_off_g = 0.3f;
+    c->rearm_ratio = 0.5f;
+    c->min_gap_ms = 60.0f;
+    c->min_peaks = 6;
+    c->window_ms = 1500.0f;
+    c->holdoff_ms = 1000.0f;
+}
+
+static uint32_t to_samples(float ms, float sample_hz)
+{
+    return (uint32_t)(ms * sample_hz / 1000.0f + 0.5f);
+}
+
+void gesture_init(gesture_t *g, const gesture_config_t *c)
+{
+    memset(g, 0, sizeof(*g));
+    float dt = 1.0f / c->sample_hz;
+    float rc = 1.0f / (2.0f * (float)M_PI * c->hp_cutoff_hz);
+    g->hp_a = rc / (rc + dt);
+    g->release = expf(-dt * 1000.0f / c->release_ms);
+    g->peak_on = c->peak_on_g;
+    g->peak_off = c->peak_off_g;
+    g->rearm_ratio = c->rearm_ratio;
+    g->min_gap = to_samples(c->min_gap_ms, c->sample_hz);
+    g->window = to_samples(c->window_ms, c->sample_hz);
+    g->holdoff = to_samples(c->holdoff_ms, c->sample_hz);
+    g->min_peaks = c->min_peaks < GESTURE_RING ? c->min_peaks : GESTURE_RING;
+    g->armed = 1;
+}
+
+// peaks in the ring no older than the window, the one just added included
+static int recent_peaks(const gesture_t *g)
+{
+    int count = 0;
+    for (int i = 0; i < g->ring_count; i++) {
+        uint32_t t = g->ring[(g->ring_head - 1 - i + GESTURE_RING) % GESTURE_RING];
+        if (g->n - t > g->window) {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+gesture_event_t gesture_update(gesture_t *g, float x, float y, float z)
+{
+    float in[3] = {x, y, z};
+    if (!g->primed) {
+        // start from the resting vector, not from a 1 g step
+        memcpy(g->prev, in, sizeof(in));
+        g->primed = 1;
+    }
+    float mag2 = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        g->hp[i] = g->hp_a * (g->hp[i] + in[i] - g->prev[i]);
+        g->prev[i] = in[i];
+        mag2 += g->hp[i] * g->hp[i];
+    }
+    // compare squares first, the square root only while something moves
+    float decayed = g->env * g->release;
+    g->env = mag2 > decayed * decayed ? sqrtf(mag2) : decayed;
+    g->n++;
+
+    if (!g->armed) {
+        if (g->env > g->hump) {
+            g->hump = g->env;
+        }
+        if (g->env < g->peak_off || g->env < g->rearm_ratio * g->hump) {
+            g->armed = 1;
+        }
+        return GESTURE_NONE;
+    }
+    if (g->env < g->peak_on || (g->ring_count > 0 && g->n - g->last_peak < g->min_gap)) {
+        return GESTURE_NONE;
+    }
+
+    g->armed = 0;
+    g->hump = g->env;
+    g->last_peak = g->n;
+    g->ring[g->ring_head] = g->n;
+    g->ring_head = (g->ring_head + 1) % GESTURE_RING;
+    if (g->ring_count < GESTURE_RING) {
+        g->ring_count++;
+    }
+    if ((int32_t)(g->n - g->quiet_until) < 0 || recent_peaks(g) < g->min_peaks) {
+        return GESTURE_MOVE;
+    }
+    g->ring_count = 0;
+    g->quiet_until = g->n + g->holdoff;
+    return GESTURE_SHAKE;
+}
@@ -0,0 +1,85 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+/**
+ * Streaming shake recognizer for the accelerometer, one sample at a time,
+ * with no allocation and no timestamps: time is counted in samples at the
+ * configured rate. Pure C, so host/gesture_bench.c replays recorded traces
+ * through the same code.
+ *
+ *   high-pass     per axis, first order: removes gravity and slow tilts
+ *   envelope      magnitude of the high-passed vector, instant attack and
+ *                 exponential release, so a stroke makes one hump
+ *   peaks         a hump counts when the envelope crosses peak_on after
+ *                 having fallen below peak_off, or below rearm_ratio of
+ *                 the previous hump for fast strokes, at least min_gap apart
+ *   shake         min_peaks peaks within window, from a ring of the last
+ *                 GESTURE_RING peak times; then holdoff before the next
+ *
+ * Every peak is also reported as a movement, which tells the standby
+ * policy that somebody is around.
+ */
+
+#include <stdint.h>
+
+#define GESTURE_RING 16
+
+typedef struct {
+    float sample_hz;
+    float hp_cutoff_hz;
+    float release_ms;   // envelope time constant
+    float peak_on_g;
+    float peak_off_g;
+    float rearm_ratio;  // of the previous hump's height
+    float min_gap_ms;   // between two peaks
+    int min_peaks;      // peaks that make a shake, at most GESTURE_RING
+    float window_ms;
+    float holdoff_ms;   // after a shake
+} gesture_config_t;
+
+typedef enum {
+    GESTURE_NONE,
+    GESTURE_MOVE,   // a peak that is not (yet) part of a shake
+    GESTURE_SHAKE,
+} gesture_event_t;
+
+typedef struct {
+    // from the config, in samples
+    float hp_a;
+    float release;
+    float peak_on;
+    float peak_off;
+    float rearm_ratio;
+    uint32_t min_gap;
+    uint32_t window;
+    uint32_t holdoff;
+    int min_peaks;
+    // filter state
+    int primed;
+    float prev[3];
+    float hp[3];
+    float env;
+    int armed;          // envelope went low enough since the last peak
+    float hump;         // height of the current (or last) hump
+    uint32_t n;         // samples seen
+    uint32_t last_peak;
+    uint32_t quiet_until;
+    uint32_t ring[GESTURE_RING];
+    int ring_head;
+    int ring_count;
+} gesture_t;
+
+/**
+ * @brief Tuning for a shake of the hand-held dreamer: a few strokes of a
+ *        g or more within 1.5 s
+ */
+void gesture_default_config(gesture_config_t *config, float sample_hz);
+
+void gesture_init(gesture_t *g, const gesture_config_t *config);
+
+/**
+ * @brief Feeds one sample, in g
+ */
+gesture_event_t gesture_update(gesture_t *g, float x, float y, float z);
+
+#endif // GESTURE_H
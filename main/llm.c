@@ -7,6 +7,9 @@
  */
 
 #include "llm.h"
+#include "llm_prof.h"
+#include "llm_math.h"
+#include "ckpt_image.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -14,76 +17,52 @@
 #include <math.h>
 #include <string.h>
 #include <fcntl.h>
-#include "esp_log.h"
-#include "esp_system.h"
-#include "esp_dsp.h"
-#include "esp_attr.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "captive_portal.h"
 
 #define MAP_FAILED NULL
 #define munmap(ptr, length) custom_munmap(ptr)
 #define close(fd) custom_close(fd)
 
-#define TASK_0_BIT (1 << 0)
-#define TASK_1_BIT (1 << 1)
-#define FORWARD_TASK_1 (1 << 2)
-#define FORWARD_TASK_2 (1 << 3)
-#define READY_BIT (1 << 3)
-#define ALL_SYNC_BITS (TASK_0_BIT | TASK_1_BIT)
-#define ALL_FORWARD_TASKS (FORWARD_TASK_1 | FORWARD_TASK_2)
-
-#define DISABLE_DSP_OPTIMIZATIONS
-
-static char output_buffer[MAX_LLM_OUTPUT] = {0};
-static size_t output_pos = 0;
-
 v4sf random_f32(unsigned long long *state);
 
-#include "esp_log.h"
-
 typedef struct
 {
-    v4sf *xout;
-    v4sf *x;
+    v4sf *const *xout; // one output vector per sequence
+    v4sf *const *x;    // one input vector per sequence
+    int batch;
     v4sf *w;
+    v4sf *w3;   // set for the fused SwiGLU projection, NULL for a plain matmul
+    int tiled;  // w (and w3) in the LLM_TILE_ROWS-interleaved layout of repack_tiled()
     int start;
     int end;
     int n;
     int d;
-    int task_num;
 } MatMulTaskParams;
 
 typedef struct
 {
     RunState *s;
-    TransformerWeights *w;
     Config *p;
     int pos;
     int start;
     int loff;
     int end;
-    int dim;
-    int kv_dim;
-    int kv_mul;
-    int hidden_dim;
-    int head_size;
-    int task_num;
 } ForwardTaskParams;
 
-EventGroupHandle_t xEventGroup;
-EventGroupHandle_t ForwardEventGroup;
+// the core-1 helpers of a split forward, one pair per transformer: each
+// worker is kicked with its start semaphore and reports back on its done semaphore
+struct LlmWorkers
+{
+    llm_sem_t data_ready;
+    llm_sem_t data_done;
+    llm_sem_t forward_ready;
+    llm_sem_t forward_done;
+    llm_task_t matmul_task;
+    llm_task_t forward_task;
+    MatMulTaskParams matmul;
+    ForwardTaskParams forward;
+};
 
 static const char *TAG = "LLM";
-TaskHandle_t handle_forward_task = NULL;
-TaskHandle_t matmul_task_2 = NULL;
-
-ForwardTaskParams *forward_params = NULL;
-MatMulTaskParams *matmul_params = NULL;
-
-SemaphoreHandle_t semaDataReady;
-SemaphoreHandle_t semaForwardDataReady;
 
 
 void matmul_task(void *params);
@@ -103,40 +82,56 @@ int custom_close(int fd)
 void chat(Transformer *transformer, Tokenizer *tokenizer, Sampler *sampler,
           char *cli_user_prompt, char *cli_system_prompt, int steps);
 
-void malloc_run_state(RunState *s, Config *p)
+void free_run_state(RunState *s)
+{
+    free(s->x);
+    free(s->xb);
+    free(s->xb2);
+    free(s->hb);
+    free(s->hb2);
+    free(s->q);
+    free(s->k);
+    free(s->v);
+    free(s->att);
+    free(s->logits);
+    free(s->key_cache);
+    free(s->value_cache);
+}
+
+// like malloc_run_state(), but a failure frees what was allocated and returns -1
+static int alloc_run_state(RunState *s, Config *p)
 {
     // we calloc instead of malloc to keep valgrind happy
     int kv_dim = (p->dim * p->n_kv_heads) / p->n_heads;
+    memset(s, 0, sizeof(*s));
     s->x = calloc(p->dim, sizeof(v4sf));
     s->xb = calloc(p->dim, sizeof(v4sf));
     s->xb2 = calloc(p->dim, sizeof(v4sf));
     s->hb = calloc(p->hidden_dim, sizeof(v4sf));
     s->hb2 = calloc(p->hidden_dim, sizeof(v4sf));
     s->q = calloc(p->dim, sizeof(v4sf));
+    s->k = calloc(kv_dim, sizeof(v4sf));
+    s->v = calloc(kv_dim, sizeof(v4sf));
+    s->att = calloc(p->n_heads * p->seq_len, sizeof(v4sf));
     s->key_cache = calloc(p->n_layers * p->seq_len * kv_dim, sizeof(v4sf));
     s->value_cache = calloc(p->n_layers * p->seq_len * kv_dim, sizeof(v4sf));
-    s->att = calloc(p->n_heads * p->seq_len, sizeof(v4sf));
     s->logits = calloc(p->vocab_size, sizeof(v4sf));
-    // ensure all mallocs went fine
-    if (!s->x || !s->xb || !s->xb2 || !s->hb || !s->hb2 || !s->q || !s->key_cache || !s->value_cache || !s->att || !s->logits)
+    if (!s->x || !s->xb || !s->xb2 || !s->hb || !s->hb2 || !s->q || !s->k || !s->v || !s->att || !s->key_cache || !s->value_cache || !s->logits)
     {
-        fprintf(stderr, "malloc failed!\n");
-        exit(EXIT_FAILURE);
+        free_run_state(s);
+        memset(s, 0, sizeof(*s));
+        return -1;
     }
+    return 0;
 }
 
-void free_run_state(RunState *s)
+void malloc_run_state(RunState *s, Config *p)
 {
-    free(s->x);
-    free(s->xb);
-    free(s->xb2);
-    free(s->hb);
-    free(s->hb2);
-    free(s->q);
-    free(s->att);
-    free(s->logits);
-    free(s->key_cache);
-    free(s->value_cache);
+    if (alloc_run_state(s, p) != 0)
+    {
+        fprintf(stderr, "malloc failed!\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
 void memory_map_weights(TransformerWeights *w, Config *p, v4sf *ptr, int shared_weights)
@@ -171,6 +166,76 @@ void memory_map_weights(TransformerWeights *w, Config *p, v4sf *ptr, int shared_
     w->wcls = shared_weights ? w->token_embedding_table : ptr;
 }
 
+// v2 directory entry by name; its size must match what forward() expects
+static const ckpt_tensor_t *ckpt_entry(const ckpt_header_t *hdr, const char *name, size_t count, int required)
+{
+    const ckpt_tensor_t *t = ckpt_find(hdr, name);
+    if (!t)
+    {
+        if (required)
+        {
+            ESP_LOGE(TAG, "Checkpoint has no tensor %s", name);
+            exit(EXIT_FAILURE);
+        }
+        return NULL;
+    }
+    if (t->dtype != CKPT_DTYPE_F32 || t->size != count * sizeof(v4sf))
+    {
+        ESP_LOGE(TAG, "Checkpoint tensor %s: unexpected dtype %u or size %u", name,
+                 (unsigned)t->dtype, (unsigned)t->size);
+        exit(EXIT_FAILURE);
+    }
+    return t;
+}
+
+static v4sf *ckpt_tensor(const ckpt_header_t *hdr, const char *name, size_t count)
+{
+    const ckpt_tensor_t *t = ckpt_entry(hdr, name, count, 0);
+    return t ? (v4sf *)((uint8_t *)hdr + t->offset) : NULL;
+}
+
+static v4sf *ckpt_required(const ckpt_header_t *hdr, const char *name, size_t count)
+{
+    const ckpt_tensor_t *t = ckpt_entry(hdr, name, count, 1);
+    return (v4sf *)((uint8_t *)hdr + t->offset);
+}
+
+static void config_from_ckpt(Config *p, const ckpt_header_t *hdr)
+{
+    p->dim = hdr->dim;
+    p->hidden_dim = hdr->hidden_dim;
+    p->n_layers = hdr->n_layers;
+    p->n_heads = hdr->n_heads;
+    p->n_kv_heads = hdr->n_kv_heads;
+    p->vocab_size = hdr->vocab_size;
+    p->seq_len = hdr->seq_len;
+}
+
+static void map_ckpt_v2(TransformerWeights *w, Config *p, const ckpt_header_t *hdr)
+{
+    config_from_ckpt(p, hdr);
+
+    size_t dim = p->dim, hidden_dim = p->hidden_dim, n_layers = p->n_layers;
+    size_t kv_dim = (dim * p->n_kv_heads) / p->n_heads;
+    w->token_embedding_table = ckpt_required(hdr, "token_embedding", p->vocab_size * dim);
+    w->rms_att_weight = ckpt_required(hdr, "rms_att_weight", n_layers * dim);
+    w->wq = ckpt_required(hdr, "wq", n_layers * dim * dim);
+    w->wk = ckpt_required(hdr, "wk", n_layers * dim * kv_dim);
+    w->wv = ckpt_required(hdr, "wv", n_layers * dim * kv_dim);
+    w->wo = ckpt_required(hdr, "wo", n_layers * dim * dim);
+    w->rms_ffn_weight = ckpt_required(hdr, "rms_ffn_weight", n_layers * dim);
+    w->w1 = ckpt_required(hdr, "w1", n_layers * dim * hidden_dim);
+    w->w2 = ckpt_required(hdr, "w2", n_layers * hidden_dim * dim);
+    w->w3 = ckpt_required(hdr, "w3", n_layers * dim * hidden_dim);
+    w->rms_final_weight = ckpt_required(hdr, "rms_final_weight", dim);
+    // no classifier tensor means it is shared with the embedding
+    w->wcls = ckpt_tensor(hdr, "wcls", p->vocab_size * dim);
+    if (!w->wcls)
+    {
+        w->wcls = w->token_embedding_table;
+    }
+}
+
 void read_checkpoint(char *checkpoint, Config *config, TransformerWeights *weights,
                      int *fd, v4sf **data, size_t *file_size)
 {
@@ -180,22 +245,15 @@ void read_checkpoint(char *checkpoint, Config *config, TransformerWeights *weigh
         ESP_LOGE(TAG, "Couldn't open file %s", checkpoint);
         exit(EXIT_FAILURE);
     }
-    // read in the config header
-    if (fread(config, sizeof(Config), 1, file) != 1)
-    {
-        exit(EXIT_FAILURE);
-    }
-    // negative vocab size is hacky way of signaling unshared weights. bit yikes.
-    int shared_weights = config->vocab_size > 0 ? 1 : 0;
-    config->vocab_size = abs(config->vocab_size);
-    ESP_LOGI(TAG, "Vocab size if %d", config->vocab_size);
     // figure out the file size
     fseek(file, 0, SEEK_END); // move file pointer to end of file
     *file_size = ftell(file); // get the file size, in bytes
     fseek(file, 0, SEEK_SET); // move back to beginning for reading
     ESP_LOGI(TAG, "File size: %zu bytes", *file_size);
-    ESP_LOGI(TAG, "Free ram available: %lu", esp_get_free_heap_size());
-    *data = malloc(*file_size);
+    ESP_LOGI(TAG, "Free ram available: %lu", (unsigned long)llm_port_free_heap());
+    // PSRAM, aligned so that v2 tensor offsets stay aligned in memory; the
+    // placement planner copies hot tensors out of it
+    *data = llm_port_malloc_external_aligned(*file_size, CKPT_ALIGN);
     if (*data == NULL)
     {
         ESP_LOGE(TAG, "Malloc operation failed");
@@ -212,34 +270,457 @@ void read_checkpoint(char *checkpoint, Config *config, TransformerWeights *weigh
     fclose(file);
 
     ESP_LOGI(TAG, "Successfully read LLM into memory");
-    ESP_LOGI(TAG, "Free ram available: %lu", esp_get_free_heap_size());
+    ESP_LOGI(TAG, "Free ram available: %lu", (unsigned long)llm_port_free_heap());
+    const ckpt_header_t *hdr = (const ckpt_header_t *)*data;
+    if (*file_size >= sizeof(ckpt_header_t) && hdr->magic == CKPT_MAGIC)
+    {
+        if (!ckpt_validate(*data, *file_size))
+        {
+            ESP_LOGE(TAG, "Checkpoint %s is corrupt or of an unsupported version", checkpoint);
+            exit(EXIT_FAILURE);
+        }
+        map_ckpt_v2(weights, config, hdr);
+        ESP_LOGI(TAG, "Successfully read v2 checkpoint, %u tensors", (unsigned)hdr->n_tensors);
+        return;
+    }
+
+    // legacy llama2.c layout: Config header, then the weights in a fixed order
+    if (*file_size < sizeof(Config))
+    {
+        exit(EXIT_FAILURE);
+    }
+    memcpy(config, *data, sizeof(Config));
+    // negative vocab size is hacky way of signaling unshared weights. bit yikes.
+    int shared_weights = config->vocab_size > 0 ? 1 : 0;
+    config->vocab_size = abs(config->vocab_size);
+    ESP_LOGI(TAG, "Vocab size if %d", config->vocab_size);
     v4sf *weights_ptr = *data + sizeof(Config) / sizeof(v4sf);
     memory_map_weights(weights, config, weights_ptr, shared_weights);
+    ESP_LOGW(TAG, "Legacy checkpoint: weights are not 16-byte aligned, convert it with ckpt_pack");
     ESP_LOGI(TAG, "Successfully read checkpoint");
 }
 
+// the matrices of one layer, in the loaded checkpoint or in a stream slot
+typedef struct
+{
+    v4sf *wq, *wk, *wv, *wo, *w1, *w2, *w3;
+} LayerWeights;
+
+// streamed matrices, in their order inside a stream slot
+enum
+{
+    STREAM_WQ,
+    STREAM_WK,
+    STREAM_WV,
+    STREAM_WO,
+    STREAM_W1,
+    STREAM_W2,
+    STREAM_W3,
+    STREAM_COUNT
+};
+
+static void layer_weights(Transformer *t, int l, LayerWeights *lw)
+{
+    TransformerWeights *w = &t->weights;
+    Config *p = &t->config;
+    if (!t->stream)
+    {
+        size_t dim = p->dim, hidden_dim = p->hidden_dim;
+        size_t kv_dim = (dim * p->n_kv_heads) / p->n_heads;
+        lw->wq = w->wq + l * dim * dim;
+        lw->wk = w->wk + l * dim * kv_dim;
+        lw->wv = w->wv + l * dim * kv_dim;
+        lw->wo = w->wo + l * dim * dim;
+        lw->w1 = w->w1 + l * dim * hidden_dim;
+        lw->w2 = w->w2 + l * dim * hidden_dim;
+        lw->w3 = w->w3 + l * dim * hidden_dim;
+        return;
+    }
+    uint8_t *slot = (uint8_t *)llm_stream_acquire(t->stream, l);
+    if (!slot)
+    {
+        exit(EXIT_FAILURE);
+    }
+    v4sf **dst[STREAM_COUNT] = {&lw->wq, &lw->wk, &lw->wv, &lw->wo, &lw->w1, &lw->w2, &lw->w3};
+    for (int i = 0; i < STREAM_COUNT; i++)
+    {
+        *dst[i] = (v4sf *)(slot + llm_stream_segment_offset(t->stream, i));
+    }
+}
+
+#if CONFIG_LLM_STREAM_WEIGHTS
+// columns and rows of one layer of a streamed matrix
+static void stream_shape(const Config *p, int i, int *n, int *rows)
+{
+    int kv_dim = (p->dim * p->n_kv_heads) / p->n_heads;
+    static const char cols_hidden[STREAM_COUNT] = {[STREAM_W2] = 1};
+    static const char rows_kv[STREAM_COUNT] = {[STREAM_WK] = 1, [STREAM_WV] = 1};
+    static const char rows_hidden[STREAM_COUNT] = {[STREAM_W1] = 1, [STREAM_W3] = 1};
+    *n = cols_hidden[i] ? p->hidden_dim : p->dim;
+    *rows = rows_kv[i] ? kv_dim : rows_hidden[i] ? p->hidden_dim : p->dim;
+}
+
+// runs on the loader task: a streamed layer gets the layout the others have
+static void prepare_layer(float *slot, int layer, void *arg)
+{
+    Transformer *t = arg;
+    if (!t->weights.tiled)
+    {
+        return;
+    }
+    for (int i = 0; i < STREAM_COUNT; i++)
+    {
+        int n, rows;
+        stream_shape(&t->config, i, &n, &rows);
+        repack_tiled((v4sf *)((uint8_t *)slot + llm_stream_segment_offset(t->stream, i)), n, rows);
+    }
+}
+
+static void read_tensor(FILE *file, const ckpt_tensor_t *e, v4sf *dst)
+{
+    if (fseek(file, e->offset, SEEK_SET) != 0 || fread(dst, 1, e->size, file) != e->size)
+    {
+        ESP_LOGE(TAG, "Failed to read tensor %s", e->name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Reads only the header, the directory and the tensors used once per token;
+// the layer matrices stay in the file and go through t->stream
+static void open_checkpoint_stream(Transformer *t, char *checkpoint)
+{
+    Config *p = &t->config;
+    TransformerWeights *w = &t->weights;
+    FILE *file = fopen(checkpoint, "rb");
+    if (!file)
+    {
+        ESP_LOGE(TAG, "Couldn't open file %s", checkpoint);
+        exit(EXIT_FAILURE);
+    }
+    fseek(file, 0, SEEK_END);
+    t->file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    ckpt_header_t hdr;
+    if (fread(&hdr, 1, sizeof(hdr), file) != sizeof(hdr) || hdr.magic != CKPT_MAGIC)
+    {
+        ESP_LOGE(TAG, "Streaming needs a v2 checkpoint, convert %s with ckpt_pack", checkpoint);
+        exit(EXIT_FAILURE);
+    }
+    size_t head_size = hdr.dir_off + (size_t)hdr.n_tensors * sizeof(ckpt_tensor_t);
+    ckpt_header_t *head = head_size <= t->file_size ? malloc(head_size) : NULL;
+    if (!head && head_size <= t->file_size)
+    {
+        ESP_LOGE(TAG, "No memory for the %u-byte directory of %s", (unsigned)head_size, checkpoint);
+        exit(EXIT_FAILURE);
+    }
+    if (!head || fseek(file, 0, SEEK_SET) != 0 || fread(head, 1, head_size, file) != head_size ||
+        !ckpt_validate_directory(head, head_size) || head->file_size != t->file_size)
+    {
+        ESP_LOGE(TAG, "Checkpoint %s is corrupt or of an unsupported version", checkpoint);
+        exit(EXIT_FAILURE);
+    }
+
+    // the checksum covers the whole file, read through a small buffer once at boot
+    uint8_t *chunk = malloc(4096);
+    if (!chunk)
+    {
+        ESP_LOGE(TAG, "No memory to checksum %s", checkpoint);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t sum = CKPT_CHECKSUM_INIT;
+    size_t got;
+    fseek(file, sizeof(ckpt_header_t), SEEK_SET);
+    while ((got = fread(chunk, 1, 4096, file)) > 0)
+    {
+        sum = ckpt_checksum_update(sum, chunk, got);
+    }
+    free(chunk);
+    if (sum != head->checksum)
+    {
+        ESP_LOGE(TAG, "Checkpoint %s is corrupt or of an unsupported version", checkpoint);
+        exit(EXIT_FAILURE);
+    }
+
+    config_from_ckpt(p, head);
+    size_t dim = p->dim, n_layers = p->n_layers;
+    static const char *const stream_names[STREAM_COUNT] = {"wq", "wk", "wv", "wo", "w1", "w2", "w3"};
+    llm_stream_segment_t segments[STREAM_COUNT];
+    for (int i = 0; i < STREAM_COUNT; i++)
+    {
+        int n, rows;
+        stream_shape(p, i, &n, &rows);
+        const ckpt_tensor_t *e = ckpt_entry(head, stream_names[i], n_layers * n * rows, 1);
+        segments[i] = (llm_stream_segment_t){e->offset, (uint32_t)(n * rows * sizeof(v4sf))};
+    }
+
+    // everything else is resident, in one aligned PSRAM block
+    const ckpt_tensor_t *resident[] = {
+        ckpt_entry(head, "token_embedding", p->vocab_size * dim, 1),
+        ckpt_entry(head, "rms_att_weight", n_layers * dim, 1),
+        ckpt_entry(head, "rms_ffn_weight", n_layers * dim, 1),
+        ckpt_entry(head, "rms_final_weight", dim, 1),
+        ckpt_entry(head, "wcls", p->vocab_size * dim, 0),
+    };
+    v4sf **ptrs[] = {&w->token_embedding_table, &w->rms_att_weight, &w->rms_ffn_weight,
+                     &w->rms_final_weight, &w->wcls};
+    int n_resident = sizeof(resident) / sizeof(resident[0]);
+    size_t total = 0;
+    for (int i = 0; i < n_resident; i++)
+    {
+        total += resident[i] ? (resident[i]->size + CKPT_ALIGN - 1) / CKPT_ALIGN * CKPT_ALIGN : 0;
+    }
+    t->data = llm_port_malloc_external_aligned(total, CKPT_ALIGN);
+    if (!t->data)
+    {
+        ESP_LOGE(TAG, "Malloc operation failed");
+        exit(EXIT_FAILURE);
+    }
+    uint8_t *dst = (uint8_t *)t->data;
+    for (int i = 0; i < n_resident; i++)
+    {
+        if (resident[i])
+        {
+            read_tensor(file, resident[i], (v4sf *)dst);
+            *ptrs[i] = (v4sf *)dst;
+            dst += (resident[i]->size + CKPT_ALIGN - 1) / CKPT_ALIGN * CKPT_ALIGN;
+        }
+    }
+    // no classifier tensor means it is shared with the embedding
+    if (!w->wcls)
+    {
+        w->wcls = w->token_embedding_table;
+    }
+    free(head);
+
+    t->stream = llm_stream_open(file, segments, STREAM_COUNT, p->n_layers, prepare_layer, t);
+    if (!t->stream)
+    {
+        ESP_LOGE(TAG, "Malloc operation failed");
+        exit(EXIT_FAILURE);
+    }
+    ESP_LOGI(TAG, "Streaming v2 checkpoint: %u of %u bytes resident", (unsigned)total,
+             (unsigned)t->file_size);
+}
+#endif
+
+#if !CONFIG_LLM_PLACEMENT_MALLOC
+static void add_placement(Transformer *t, const char *name, llm_tensor_kind_t kind, v4sf **ptr, size_t count,
+                          float reads_per_byte)
+{
+    if (t->n_placement == LLM_PLACEMENT_MAX_ENTRIES)
+    {
+        ESP_LOGE(TAG, "No placement entry left for %s, raise LLM_PLACEMENT_MAX_ENTRIES", name);
+        exit(EXIT_FAILURE);
+    }
+    t->placement[t->n_placement++] = (llm_placement_entry_t){
+        .name = name,
+        .kind = kind,
+        .ptr = (void **)ptr,
+        .size = count * sizeof(v4sf),
+        .reads_per_byte = reads_per_byte,
+    };
+}
+
+// Describes every weight group and RunState buffer with its kind and the number
+// of times each of its bytes is read per token, then lets the planner decide
+// between internal SRAM and PSRAM. The estimates follow forward() and sample().
+static void place_transformer(Transformer *t)
+{
+    Config *p = &t->config;
+    TransformerWeights *w = &t->weights;
+    RunState *s = &t->state;
+    size_t dim = p->dim, hidden_dim = p->hidden_dim, n_layers = p->n_layers;
+    size_t kv_dim = (dim * p->n_kv_heads) / p->n_heads;
+    size_t seq_len = p->seq_len, vocab_size = p->vocab_size;
+    int shared_weights = w->wcls == w->token_embedding_table;
+    t->n_placement = 0;
+
+    // weights: every matrix is streamed once per token, the embedding only one
+    // row unless it doubles as the classifier
+    add_placement(t, "token_embedding", LLM_KIND_WEIGHT, &w->token_embedding_table, vocab_size * dim,
+                  (shared_weights ? 1.0f : 0.0f) + 1.0f / vocab_size);
+    add_placement(t, "rms_att_weight", LLM_KIND_WEIGHT, &w->rms_att_weight, n_layers * dim, 1.0f);
+    add_placement(t, "rms_ffn_weight", LLM_KIND_WEIGHT, &w->rms_ffn_weight, n_layers * dim, 1.0f);
+    add_placement(t, "rms_final_weight", LLM_KIND_WEIGHT, &w->rms_final_weight, dim, 1.0f);
+    // streamed layers live in the stream's slots, which are rewritten every token
+    if (!t->stream)
+    {
+        add_placement(t, "wq", LLM_KIND_WEIGHT, &w->wq, n_layers * dim * dim, 1.0f);
+        add_placement(t, "wk", LLM_KIND_WEIGHT, &w->wk, n_layers * dim * kv_dim, 1.0f);
+        add_placement(t, "wv", LLM_KIND_WEIGHT, &w->wv, n_layers * dim * kv_dim, 1.0f);
+        add_placement(t, "wo", LLM_KIND_WEIGHT, &w->wo, n_layers * dim * dim, 1.0f);
+        add_placement(t, "w1", LLM_KIND_WEIGHT, &w->w1, n_layers * dim * hidden_dim, 1.0f);
+        add_placement(t, "w2", LLM_KIND_WEIGHT, &w->w2, n_layers * hidden_dim * dim, 1.0f);
+        add_placement(t, "w3", LLM_KIND_WEIGHT, &w->w3, n_layers * dim * hidden_dim, 1.0f);
+    }
+    if (!shared_weights)
+    {
+        add_placement(t, "wcls", LLM_KIND_WEIGHT, &w->wcls, vocab_size * dim, 1.0f);
+    }
+
+    // activations: a matmul input is read once per output row
+    add_placement(t, "x", LLM_KIND_ACTIVATION, &s->x, dim, vocab_size + 4.0f * n_layers);
+    add_placement(t, "xb", LLM_KIND_ACTIVATION, &s->xb, dim,
+                  n_layers * (2.0f * dim + 2.0f * kv_dim + 2.0f * hidden_dim));
+    add_placement(t, "xb2", LLM_KIND_ACTIVATION, &s->xb2, dim, n_layers);
+    add_placement(t, "hb", LLM_KIND_ACTIVATION, &s->hb, hidden_dim, (float)(n_layers * dim));
+    add_placement(t, "hb2", LLM_KIND_ACTIVATION, &s->hb2, hidden_dim, 0.0f); // unused since w1/w3 are fused
+    add_placement(t, "q", LLM_KIND_ACTIVATION, &s->q, dim, n_layers * seq_len / 2.0f);
+    add_placement(t, "k", LLM_KIND_ACTIVATION, &s->k, kv_dim, 3.0f * n_layers);
+    add_placement(t, "v", LLM_KIND_ACTIVATION, &s->v, kv_dim, 2.0f * n_layers);
+    add_placement(t, "att", LLM_KIND_ACTIVATION, &s->att, p->n_heads * seq_len, n_layers * 1.5f);
+    add_placement(t, "logits", LLM_KIND_ACTIVATION, &s->logits, vocab_size, vocab_size / 2.0f); // sort in sample()
+    // kv cache: on average half the context is attended to
+    add_placement(t, "key_cache", LLM_KIND_KV_CACHE, &s->key_cache, n_layers * seq_len * kv_dim, 0.5f);
+    add_placement(t, "value_cache", LLM_KIND_KV_CACHE, &s->value_cache, n_layers * seq_len * kv_dim, 0.5f);
+
+    size_t budget = llm_placement_budget();
+    size_t used = llm_placement_plan(t->placement, t->n_placement, budget);
+    if (llm_placement_apply(t->placement, t->n_placement) != 0)
+    {
+        ESP_LOGE(TAG, "Tensor placement failed");
+        exit(EXIT_FAILURE);
+    }
+    if (shared_weights)
+    {
+        w->wcls = w->token_embedding_table;
+    }
+    ESP_LOGI(TAG, "Placement: %u of %u budgeted SRAM bytes used", (unsigned)used, (unsigned)budget);
+    llm_placement_log(t->placement, t->n_placement);
+}
+#endif
+
+void repack_tiled(v4sf *w, int n, int rows)
+{
+    // a tile is LLM_TILE_ROWS consecutive rows, i.e. the same contiguous block
+    // in both layouts, so each one is transposed in place through a small buffer
+    v4sf *tmp = malloc(LLM_TILE_ROWS * n * sizeof(v4sf));
+    if (!tmp)
+    {
+        ESP_LOGE(TAG, "Malloc operation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < rows; i += LLM_TILE_ROWS)
+    {
+        v4sf *tile = w + (size_t)i * n;
+        memcpy(tmp, tile, LLM_TILE_ROWS * n * sizeof(v4sf));
+        for (int r = 0; r < LLM_TILE_ROWS; r++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                tile[j * LLM_TILE_ROWS + r] = tmp[r * n + j];
+            }
+        }
+    }
+    free(tmp);
+}
+
+#if CONFIG_LLM_TILED_WEIGHTS
+static void tile_weights(Transformer *t)
+{
+    Config *p = &t->config;
+    TransformerWeights *w = &t->weights;
+    int dim = p->dim, hidden_dim = p->hidden_dim, n_layers = p->n_layers;
+    int kv_dim = (dim * p->n_kv_heads) / p->n_heads;
+    if (dim % LLM_TILE_ROWS || kv_dim % LLM_TILE_ROWS || hidden_dim % LLM_TILE_ROWS ||
+        p->vocab_size % LLM_TILE_ROWS)
+    {
+        ESP_LOGW(TAG, "Row counts not a multiple of %d, keeping row-major weights", LLM_TILE_ROWS);
+        return;
+    }
+    // layers are stacked, so each tensor is n_layers * rows rows of the same width;
+    // streamed layers are repacked by the loader as they arrive
+    if (!t->stream)
+    {
+        repack_tiled(w->wq, dim, n_layers * dim);
+        repack_tiled(w->wk, dim, n_layers * kv_dim);
+        repack_tiled(w->wv, dim, n_layers * kv_dim);
+        repack_tiled(w->wo, dim, n_layers * dim);
+        repack_tiled(w->w1, dim, n_layers * hidden_dim);
+        repack_tiled(w->w2, hidden_dim, n_layers * dim);
+        repack_tiled(w->w3, dim, n_layers * hidden_dim);
+    }
+    w->tiled = 1;
+    // a shared classifier is also the embedding table, whose rows must stay
+    // intact: it is the largest matmul, so it gets its own tiled copy in PSRAM
+    if (w->wcls == w->token_embedding_table)
+    {
+        size_t size = (size_t)p->vocab_size * dim * sizeof(v4sf);
+        w->wcls_copy = llm_port_malloc_external(size);
+        if (w->wcls_copy)
+        {
+            memcpy(w->wcls_copy, w->wcls, size);
+            w->wcls = w->wcls_copy;
+        }
+    }
+    if (w->wcls != w->token_embedding_table)
+    {
+        repack_tiled(w->wcls, dim, p->vocab_size);
+        w->wcls_tiled = 1;
+    }
+    ESP_LOGI(TAG, "Weights repacked into %d-row tiles%s", LLM_TILE_ROWS,
+             w->wcls_tiled ? "" : ", classifier kept row-major");
+}
+#endif
+
 void build_transformer(Transformer *t, char *checkpoint_path)
 {
+    llm_kernels_init();
     // read in the Config and the Weights from the checkpoint
+    memset(&t->weights, 0, sizeof(t->weights));
+    t->stream = NULL;
+    t->prefetch = NULL;
+    memset(t->batch, 0, sizeof(t->batch));
+    t->n_batch = 0;
+#if CONFIG_LLM_STREAM_WEIGHTS
+    open_checkpoint_stream(t, checkpoint_path);
+#else
     read_checkpoint(checkpoint_path, &t->config, &t->weights, &t->fd, &t->data, &t->file_size);
-    // allocate the RunState buffers
+#endif
+#if CONFIG_LLM_TILED_WEIGHTS
+    // before placement, so the copies in SRAM are already tiled
+    tile_weights(t);
+#endif
+#if CONFIG_LLM_PREFETCH
+    // before placement, so the planner only budgets the SRAM the staging buffers leave
+    t->prefetch = llm_prefetch_create((size_t)CONFIG_LLM_PREFETCH_BUF_KB * 1024);
+    if (!t->prefetch)
+    {
+        ESP_LOGW(TAG, "No internal RAM for the prefetch buffers, weights are read in place");
+    }
+#endif
+    // allocate the RunState buffers and decide where every tensor lives
+#if CONFIG_LLM_PLACEMENT_MALLOC
+    t->n_placement = 0;
     malloc_run_state(&t->state, &t->config);
+#else
+    memset(&t->state, 0, sizeof(t->state));
+    place_transformer(t);
+#endif
+    // after tiling, so the loader knows the layout to give each layer
+    if (t->stream && llm_stream_start(t->stream) != 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    t->batch[0] = &t->state;
+    t->n_batch = 1;
+    memset(&t->last_stats, 0, sizeof(t->last_stats));
     ESP_LOGI(TAG, "Transformer successfully built");
 
     // FreeRTos Tasks
-    xEventGroup = xEventGroupCreate();
-    ForwardEventGroup = xEventGroupCreate();
-    semaDataReady = xSemaphoreCreateBinary();
-    semaForwardDataReady = xSemaphoreCreateBinary();
-    xSemaphoreGive(semaDataReady);
-    xSemaphoreTake(semaDataReady, portMAX_DELAY);
-    xSemaphoreGive(semaForwardDataReady);
-    xSemaphoreTake(semaForwardDataReady, portMAX_DELAY);
-
-    matmul_params = malloc(sizeof(MatMulTaskParams));
-    forward_params = malloc(sizeof(ForwardTaskParams));
-    xTaskCreatePinnedToCore(matmul_task, "MatMul2", 2048, matmul_params, 19, &matmul_task_2, 1);             // Run on Core 1
-    xTaskCreatePinnedToCore(forward_task, "ForwardTask", 2048, forward_params, 19, &handle_forward_task, 1); // Run on Core 1
+    LlmWorkers *wk = calloc(1, sizeof(LlmWorkers));
+    if (!wk)
+    {
+        ESP_LOGE(TAG, "No memory for the worker tasks");
+        exit(EXIT_FAILURE);
+    }
+    wk->data_ready = llm_sem_create();
+    wk->data_done = llm_sem_create();
+    wk->forward_ready = llm_sem_create();
+    wk->forward_done = llm_sem_create();
+    llm_task_create(matmul_task, "MatMul2", 2048, wk, 19, 1, &wk->matmul_task);       // Run on Core 1
+    llm_task_create(forward_task, "ForwardTask", 2048, wk, 19, 1, &wk->forward_task); // Run on Core 1
+    t->workers = wk;
     ESP_LOGI(TAG, "Created FreeRTOS Tasks");
 }
 
@@ -254,8 +735,28 @@ void free_transformer(Transformer *t)
     {
         close(t->fd);
     }
-    // free the RunState buffers
-    free_run_state(&t->state);
+    llm_prefetch_free(t->prefetch);
+    t->prefetch = NULL;
+    llm_stream_close(t->stream);
+    t->stream = NULL;
+    free(t->weights.wcls_copy);
+    t->weights.wcls_copy = NULL;
+    for (int b = 1; b < t->n_batch; b++)
+    {
+        free_run_state(t->batch[b]);
+        free(t->batch[b]);
+    }
+    t->n_batch = 0;
+    // free the RunState buffers and the weights copied into SRAM
+    if (t->n_placement > 0)
+    {
+        llm_placement_release(t->placement, t->n_placement);
+        t->n_placement = 0;
+    }
+    else
+    {
+        free_run_state(&t->state);
+    }
 }
 
 // ----------------------------------------------------------------------------
@@ -263,16 +764,17 @@ void free_transformer(Transformer *t)
 
 void rmsnorm(v4sf *o, v4sf *x, v4sf *weight, int size)
 {
-    // calculate sum of squares
-    v4sf ss = 0.0f;
-    for (int j = 0; j < size; j++)
-    {
-        ss += x[j] * x[j];
-    }
+    llm_kernels_active->rmsnorm(o, x, weight, size);
+}
+
+void residual_rmsnorm(v4sf *o, v4sf *x, v4sf *delta, v4sf *weight, int size)
+{
+    // residual add and sum of squares in one pass, then normalize in a second;
+    // o may alias x or delta
+    v4sf ss = llm_residual_sum_squares(x, delta, size);
     ss /= size;
     ss += 1e-5f;
-    ss = 1.0f / sqrtf(ss);
-    // normalize and scale
+    ss = llm_inv_sqrt(ss);
     for (int j = 0; j < size; j++)
     {
         o[j] = weight[j] * (ss * x[j]);
@@ -281,186 +783,345 @@ void rmsnorm(v4sf *o, v4sf *x, v4sf *weight, int size)
 
 void softmax(v4sf *x, int size)
 {
-    // find max value (for numerical stability)
-    v4sf max_val = x[0];
-    for (int i = 1; i < size; i++)
+    llm_kernels_active->softmax(x, size);
+}
+
+// rows [start, end) of xout = W x, or xout = silu(W x) * (W3 x) when w3 is set,
+// for every sequence of the batch; tiled matrices need start and end on a tile boundary
+static void matmul_rows(const MatMulTaskParams *p, int start, int end)
+{
+    const llm_kernels_t *k = llm_kernels_active;
+    if (!p->w3 && p->batch == 1)
+    {
+        k->gemv(&p->xout[0][start], p->x[0], &p->w[start * p->n], p->tiled, p->n, end - start);
+        return;
+    }
+    // a tile of rows at a time, applied to every sequence before moving on: the
+    // rows come from PSRAM once and the other sequences read them from cache.
+    // Chunks start at start like a single gemv would group them, so a batched
+    // row sums in the same order as an unbatched one.
+    for (int i = start; i < end; i += LLM_TILE_ROWS)
     {
-        if (x[i] > max_val)
+        int rows = end - i < LLM_TILE_ROWS ? end - i : LLM_TILE_ROWS;
+        for (int b = 0; b < p->batch; b++)
         {
-            max_val = x[i];
+            v4sf *xout = p->xout[b];
+            k->gemv(&xout[i], p->x[b], &p->w[i * p->n], p->tiled, p->n, rows);
+            if (!p->w3)
+            {
+                continue;
+            }
+            // a tile of both projections at a time, so the up rows fit on the stack
+            v4sf up[LLM_TILE_ROWS];
+            k->gemv(up, p->x[b], &p->w3[i * p->n], p->tiled, p->n, rows);
+            for (int r = 0; r < rows; r++)
+            {
+                xout[i + r] = llm_silu(xout[i + r]) * up[r];
+            }
         }
     }
-    // exp and sum
-    v4sf sum = 0.0f;
-    for (int i = 0; i < size; i++)
+}
+
+void matmul_task(void *params)
+{
+    LlmWorkers *wk = (LlmWorkers *)params;
+    for (;;)
     {
-        x[i] = expf(x[i] - max_val);
-        sum += x[i];
+        llm_sem_take(wk->data_ready);
+        matmul_rows(&wk->matmul, wk->matmul.start, wk->matmul.end);
+        llm_sem_give(wk->data_done);
     }
-    // normalize
-    for (int i = 0; i < size; i++)
+}
+
+void attention_three_pass(RunState *s, Config *p, int loff, int pos, int h_start, int h_end)
+{
+    int kv_mul = p->n_heads / p->n_kv_heads; // integer multiplier of the kv sharing in multiquery
+    int head_size = p->dim / p->n_heads;
+    const llm_kernels_t *kernels = llm_kernels_active;
+    int h;
+    // #pragma omp parallel for private(h)
+    for (h = h_start; h < h_end; h++)
     {
-        x[i] /= sum;
+        // get the query vector for this head
+        v4sf *q = s->q + h * head_size;
+        // attention scores for this head
+        v4sf *att = s->att + h * p->seq_len;
+        // the keys of this head are pos + 1 contiguous rows, so all the scores
+        // are one gemv of them with q
+        v4sf *k = s->key_cache + loff + (h / kv_mul) * p->seq_len * head_size;
+        kernels->gemv(att, q, k, 0, head_size, pos + 1);
+        v4sf norm = sqrtf(head_size);
+        for (int t = 0; t <= pos; t++)
+        {
+            att[t] /= norm;
+        }
+
+        // softmax the scores to get attention weights, from 0..pos inclusively
+        softmax(att, pos + 1);
+
+        // weighted sum of the values, store back into xb: with V transposed
+        // every output is a dot of the weights with one contiguous row
+        v4sf *xb = s->xb + h * head_size;
+        v4sf *vt = s->value_cache + loff + (h / kv_mul) * head_size * p->seq_len;
+        for (int i = 0; i < head_size; i++)
+        {
+            kernels->dot(att, vt + i * p->seq_len, &xb[i], pos + 1);
+        }
     }
 }
 
-void matmul_task(void *params)
+// Timesteps scored at once by attention_online(), on the stack
+#define LLM_ATTN_TILE 16
+
+// Online softmax: one pass over the keys and values of each head, a tile of
+// timesteps at a time. The running max and sum are rescaled whenever a tile
+// raises the max, so the weights are never stored for the whole context
+void attention_online(RunState *s, Config *p, int loff, int pos, int h_start, int h_end)
 {
-    const TickType_t xDelay = 1 / portTICK_PERIOD_MS;
-    MatMulTaskParams *p = (MatMulTaskParams *)params;
-    TaskHandle_t current_task = xTaskGetCurrentTaskHandle();
-    //char *tName = pcTaskGetName(current_task);
-    // ESP_LOGI(TAG, "Created Task %s", tName);
-    for (;;)
+    int kv_mul = p->n_heads / p->n_kv_heads; // integer multiplier of the kv sharing in multiquery
+    int head_size = p->dim / p->n_heads;
+    const llm_kernels_t *kernels = llm_kernels_active;
+    v4sf inv_norm = 1.0f / sqrtf(head_size);
+    v4sf tile[LLM_ATTN_TILE];
+    int h;
+    // #pragma omp parallel for private(h)
+    for (h = h_start; h < h_end; h++)
     {
-        if (xSemaphoreTake(semaDataReady, portMAX_DELAY) == pdTRUE)
+        // get the query vector for this head
+        v4sf *q = s->q + h * head_size;
+        // keys of this head as contiguous rows, values transposed
+        v4sf *k = s->key_cache + loff + (h / kv_mul) * p->seq_len * head_size;
+        v4sf *vt = s->value_cache + loff + (h / kv_mul) * head_size * p->seq_len;
+        // unnormalized weighted sum of the values, accumulated in xb
+        v4sf *xb = s->xb + h * head_size;
+        v4sf max_score = 0.0f, sum = 0.0f;
+        for (int t0 = 0; t0 <= pos; t0 += LLM_ATTN_TILE)
         {
-            //   ESP_LOGI(TAG, "Started Task %s", tName);
-            for (int i = p->start; i < p->end; i++)
+            int n = pos + 1 - t0 < LLM_ATTN_TILE ? pos + 1 - t0 : LLM_ATTN_TILE;
+            kernels->gemv(tile, q, k + t0 * head_size, 0, head_size, n);
+            llm_vscale(tile, inv_norm, n);
+            v4sf tile_max = llm_vmax(tile, n);
+            // the weights so far were taken relative to the old max
+            v4sf rescale = 1.0f;
+            if (t0 == 0)
+            {
+                max_score = tile_max;
+            }
+            else if (tile_max > max_score)
             {
-                v4sf val = 0.0f;
-                v4sf *row = &p->w[i * p->n]; // Pointer to the start of the current row in matrix w
-                dsps_dotprod_f32_aes3(row, p->x, &val, p->n);
-                p->xout[i] = val;
+                rescale = llm_exp(max_score - tile_max);
+                max_score = tile_max;
+            }
+            sum = sum * rescale + llm_exp_sum(tile, max_score, n);
+            for (int i = 0; i < head_size; i++)
+            {
+                v4sf d;
+                kernels->dot(tile, vt + i * p->seq_len + t0, &d, n);
+                xb[i] = t0 == 0 ? d : xb[i] * rescale + d;
             }
-            //    ESP_LOGI(TAG, "Completed task %s", tName);
-            xSemaphoreGive(semaDataReady);
-            xEventGroupSync(xEventGroup, p->task_num, ALL_SYNC_BITS, portMAX_DELAY);
         }
+        llm_vscale(xb, 1.0f / sum, head_size);
     }
 }
 
-void forward_task(void *params)
+void attention(RunState *s, Config *p, int loff, int pos, int h_start, int h_end)
 {
-    const TickType_t xDelay = 1 / portTICK_PERIOD_MS;
-    ForwardTaskParams *t_params = (ForwardTaskParams *)params;
-    TaskHandle_t current_task = xTaskGetCurrentTaskHandle();
-    //char *tName = pcTaskGetName(current_task);
-    // ESP_LOGI(TAG, "Created Task %s", tName);
-    for (;;)
+#if CONFIG_LLM_ATTN_ONLINE
+    attention_online(s, p, loff, pos, h_start, h_end);
+#else
+    attention_three_pass(s, p, loff, pos, h_start, h_end);
+#endif
+}
+
+// copies the key and value of this position into the head-major cache,
+// the value into column pos of its transposed head
+static void kv_cache_store(RunState *s, Config *p, int loff, int pos)
+{
+    int head_size = p->dim / p->n_heads;
+    for (int h = 0; h < p->n_kv_heads; h++)
     {
-        if (xSemaphoreTake(semaForwardDataReady, portMAX_DELAY) == pdTRUE)
+        memcpy(s->key_cache + loff + (h * p->seq_len + pos) * head_size, s->k + h * head_size,
+               head_size * sizeof(v4sf));
+        v4sf *vt = s->value_cache + loff + h * head_size * p->seq_len;
+        for (int i = 0; i < head_size; i++)
         {
-            //   ESP_LOGI(TAG, "Started Task %s", tName);
-            int h;
-            // #pragma omp parallel for private(h)
-            for (h = t_params->start; h < t_params->end; h++)
-            {
-                // get the query vector for this head
-                v4sf *q = t_params->s->q + h * t_params->head_size;
-                // attention scores for this head
-                v4sf *att = t_params->s->att + h * t_params->p->seq_len;
-                // iterate over all timesteps, including the current one
-                for (int t = 0; t <= t_params->pos; t++)
-                {
-                    // get the key vector for this head and at this timestep
-                    v4sf *k = t_params->s->key_cache + t_params->loff + t * t_params->kv_dim + (h / t_params->kv_mul) * t_params->head_size;
-                    // calculate the attention score as the dot product of q and k
-                    v4sf score = 0.0f;
-                    for (int i = 0; i < t_params->head_size; i++)
-                    {
-                        score += q[i] * k[i];
-                    }
-                    score /= sqrtf(t_params->head_size);
-                    // save the score to the attention buffer
-                    att[t] = score;
-                }
+            vt[i * p->seq_len + pos] = s->v[h * head_size + i];
+        }
+    }
+}
 
-                // softmax the scores to get attention weights, from 0..pos inclusively
-                softmax(att, t_params->pos + 1);
+void forward_task(void *params)
+{
+    LlmWorkers *wk = (LlmWorkers *)params;
+    ForwardTaskParams *t_params = &wk->forward;
+    for (;;)
+    {
+        llm_sem_take(wk->forward_ready);
+        LLM_PROF_BEGIN(t0);
+        attention(t_params->s, t_params->p, t_params->loff, t_params->pos, t_params->start, t_params->end);
+        LLM_PROF_END(LLM_PROF_ATTN_CORE1, t0);
+        llm_sem_give(wk->forward_done);
+    }
+}
 
-                // weighted sum of the values, store back into xb
-                v4sf *xb = t_params->s->xb + h * t_params->head_size;
-                memset(xb, 0, t_params->head_size * sizeof(v4sf));
-                for (int t = 0; t <= t_params->pos; t++)
-                {
-                    // get the value vector for this head and at this timestep
-                    v4sf *v = t_params->s->value_cache + t_params->loff + t * t_params->kv_dim + (h / t_params->kv_mul) * t_params->head_size;
-                    // get the attention weight for this timestep
-                    v4sf a = att[t];
-                    // accumulate the weighted value into xb
-                    for (int i = 0; i < t_params->head_size; i++)
-                    {
-                        xb[i] += a * v[i];
-                    }
-                }
-            }
-            //   ESP_LOGI(TAG, "Completed task %s", tName);
-            xSemaphoreGive(semaForwardDataReady);
-            xEventGroupSync(ForwardEventGroup, t_params->task_num, ALL_FORWARD_TASKS, portMAX_DELAY);
-        }
+// core 1 takes the upper half of the rows while core 0 computes the lower half;
+// tiled matrices are split on a tile boundary. Without workers every row
+// runs on the calling core
+static void matmul_split(LlmWorkers *wk, v4sf *const *xout, v4sf *const *x, int batch, v4sf *w, v4sf *w3,
+                         int tiled, int n, int d)
+{
+    if (!wk)
+    {
+        MatMulTaskParams all = {xout, x, batch, w, w3, tiled, 0, d, n, d};
+        matmul_rows(&all, 0, d);
+        return;
     }
+    int half = tiled ? d / LLM_TILE_ROWS / 2 * LLM_TILE_ROWS : d / 2;
+    wk->matmul = (MatMulTaskParams){xout, x, batch, w, w3, tiled, half, d, n, d};
+    llm_sem_give(wk->data_ready);
+    matmul_rows(&wk->matmul, 0, half);
+    LLM_PROF_BEGIN(t0);
+    llm_sem_take(wk->data_done);
+    LLM_PROF_END(LLM_PROF_SYNC_WAIT, t0);
+}
+
+void matmul(LlmWorkers *wk, v4sf *xout, v4sf *x, v4sf *w, int n, int d)
+{
+    // d is the number of rows
+    // n is the number of columns
+    // d X n
+    matmul_split(wk, &xout, &x, 1, w, NULL, 0, n, d);
+}
+
+void matmul_tiled(LlmWorkers *wk, v4sf *xout, v4sf *x, v4sf *w, int n, int d)
+{
+    // w repacked by repack_tiled(), d a multiple of LLM_TILE_ROWS
+    matmul_split(wk, &xout, &x, 1, w, NULL, 1, n, d);
+}
+
+void matmul_swiglu(LlmWorkers *wk, v4sf *xout, v4sf *x, v4sf *w1, v4sf *w3, int tiled, int n, int d)
+{
+    // both projections of a row on the same core, so hb2 and the separate
+    // SwiGLU pass go away and the FFN costs one cross-core handoff instead of two
+    matmul_split(wk, &xout, &x, 1, w1, w3, tiled, n, d);
 }
 
-void matmul(v4sf *xout, v4sf *x, v4sf *w, int n, int d)
+void matmul_local(v4sf *xout, v4sf *x, v4sf *w, int tiled, int n, int d)
 {
+    // all rows on the calling core, no handoff: the kernel cost alone
+    MatMulTaskParams params = {&xout, &x, 1, w, NULL, tiled, 0, d, n, d};
+    matmul_rows(&params, 0, d);
+}
 
-    // d is the number of rows
-    // n is the number of columns
-    // d X n
-    *matmul_params = (MatMulTaskParams){xout, x, w, d / 2, d, n, d, TASK_1_BIT};
-    xSemaphoreGive(semaDataReady);
-    for (int i = 0; i < d / 2; i++)
+// Where the matmul about to run reads m from: its SRAM copy if the prefetcher
+// staged it, m itself otherwise. Then the next matrix starts copying into the
+// other buffer, so it overlaps this matmul.
+static v4sf *stage(llm_prefetch_t *prefetch, v4sf *m, v4sf *next, size_t next_count)
+{
+    if (!prefetch)
     {
-        v4sf val = 0.0f;
-        v4sf *row = &w[i * n]; // Pointer to the start of the current row in matrix w
-        dsps_dotprod_f32_aes3(row, x, &val, n);
-        xout[i] = val;
+        return m;
     }
-    if (xSemaphoreTake(semaDataReady, portMAX_DELAY) == pdTRUE)
+    v4sf *src = (v4sf *)llm_prefetch_take(prefetch, m);
+    if (next)
     {
-        xEventGroupSync(xEventGroup,
-                        TASK_0_BIT,
-                        ALL_SYNC_BITS,
-                        portMAX_DELAY);
-
-        xEventGroupClearBits(xEventGroup, ALL_SYNC_BITS);
+        llm_prefetch_issue(prefetch, next, next_count * sizeof(v4sf));
     }
-    //   ESP_LOGI(TAG, "Completed MatMul tasks");
+    return src;
 }
 
-v4sf *forward(Transformer *transformer, int token, int pos)
+// a weight matrix of the model, in whichever layout it was loaded, applied to
+// the input of every sequence of the batch
+static void project(TransformerWeights *w, LlmWorkers *wk, v4sf *const *xout, v4sf *const *x, int batch,
+                    v4sf *m, int n, int d)
+{
+    matmul_split(wk, xout, x, batch, m, NULL, w->tiled, n, d);
+}
+
+// forward_batch() with an explicit worker pair. Without one (wk NULL) the
+// whole token runs on the calling core and touches nothing of the transformer
+// but its weights, so such forwards on different cores can overlap; the
+// prefetch buffers then stay with the split forward
+static void forward_states(Transformer *transformer, LlmWorkers *wk, RunState *const *states, const int *tokens,
+                           int pos, int batch)
 {
-    ESP_LOGD(TAG, "ram available: %lu", esp_get_free_heap_size());
+    llm_prefetch_t *prefetch = wk ? transformer->prefetch : NULL;
+    ESP_LOGD(TAG, "ram available: %lu", (unsigned long)llm_port_free_heap());
 
     // a few convenience variables
     Config *p = &transformer->config;
     TransformerWeights *w = &transformer->weights;
-    RunState *s = &transformer->state;
-    v4sf *x = s->x;
     int dim = p->dim;
     int kv_dim = (p->dim * p->n_kv_heads) / p->n_heads;
-    int kv_mul = p->n_heads / p->n_kv_heads; // integer multiplier of the kv sharing in multiquery
     int hidden_dim = p->hidden_dim;
     int head_size = dim / p->n_heads;
 
+    // the buffers every batched matmul reads from or writes to, one per sequence
+    v4sf *x[LLM_MAX_BATCH], *xb[LLM_MAX_BATCH], *xb2[LLM_MAX_BATCH], *hb[LLM_MAX_BATCH];
+    v4sf *q[LLM_MAX_BATCH], *k[LLM_MAX_BATCH], *v[LLM_MAX_BATCH], *logits[LLM_MAX_BATCH];
+    for (int b = 0; b < batch; b++)
+    {
+        x[b] = states[b]->x;
+        xb[b] = states[b]->xb;
+        xb2[b] = states[b]->xb2;
+        hb[b] = states[b]->hb;
+        q[b] = states[b]->q;
+        logits[b] = states[b]->logits;
+    }
+
     // copy the token embedding into x
-    v4sf *content_row = w->token_embedding_table + token * dim;
-    ESP_LOGD(TAG, "Content row: %f", *content_row);
-    memcpy(x, content_row, dim * sizeof(*x));
+    LLM_PROF_BEGIN(t_embed);
+    for (int b = 0; b < batch; b++)
+    {
+        v4sf *content_row = w->token_embedding_table + tokens[b] * dim;
+        ESP_LOGD(TAG, "Content row: %f", *content_row);
+        memcpy(x[b], content_row, dim * sizeof(v4sf));
+
+        for (int i = 0; i < dim; i++) {
+            x[b][i] += random_f32(&states[b]->rng_state) * 0.01f;
+        }
+    }
+    LLM_PROF_END(LLM_PROF_EMBED, t_embed);
 
-    for (int i = 0; i < dim; i++) {
-        x[i] += random_f32(&transformer->state.rng_state) * 0.01f;
+    // attention rmsnorm of the first layer; later ones are fused with the ffn residual
+    ESP_LOGD(TAG, "X: %f, Weights %f", *x[0], *w->rms_att_weight);
+    LLM_PROF_BEGIN(t0);
+    for (int b = 0; b < batch; b++)
+    {
+        rmsnorm(xb[b], x[b], w->rms_att_weight, dim);
     }
+    LLM_PROF_END(LLM_PROF_RMSNORM, t0);
 
     // forward all the layers
     for (unsigned long long l = 0; l < p->n_layers; l++)
     {
-        ESP_LOGD(TAG, "X: %f, Weights %f", *x, *w->rms_att_weight);
-        // attention rmsnorm
-        rmsnorm(s->xb, x, w->rms_att_weight + l * dim, dim);
 
-        // key and value point to the kv cache
+        // this layer's matrices; when streaming, waits for the read if it isn't done
+        LayerWeights lw;
+        layer_weights(transformer, l, &lw);
+
+        // key and value of this position, stored into the kv cache after RoPE
         int loff = l * p->seq_len * kv_dim; // kv cache layer offset for convenience
-        s->k = s->key_cache + loff + pos * kv_dim;
-        s->v = s->value_cache + loff + pos * kv_dim;
+        for (int b = 0; b < batch; b++)
+        {
+            k[b] = states[b]->k;
+            v[b] = states[b]->v;
+        }
 
         // qkv matmuls for this position
-        matmul(s->q, s->xb, w->wq + l * dim * dim, dim, dim);
-        matmul(s->k, s->xb, w->wk + l * dim * kv_dim, dim, kv_dim);
-        matmul(s->v, s->xb, w->wv + l * dim * kv_dim, dim, kv_dim);
-
-        // RoPE relative positional encoding: complex-valued rotate q and k in each head
+        LLM_PROF_BEGIN(t1);
+        project(w, wk, q, xb, batch, stage(prefetch, lw.wq, lw.wk, dim * kv_dim), dim, dim);
+        LLM_PROF_END(LLM_PROF_MATMUL_Q, t1);
+        LLM_PROF_BEGIN(t2);
+        project(w, wk, k, xb, batch, stage(prefetch, lw.wk, lw.wv, dim * kv_dim), dim, kv_dim);
+        LLM_PROF_END(LLM_PROF_MATMUL_K, t2);
+        LLM_PROF_BEGIN(t3);
+        project(w, wk, v, xb, batch, stage(prefetch, lw.wv, lw.wo, dim * dim), dim, kv_dim);
+        LLM_PROF_END(LLM_PROF_MATMUL_V, t3);
+
+        // RoPE relative positional encoding: complex-valued rotate q and k in each head;
+        // the sequences share the position, so the rotation too
+        LLM_PROF_BEGIN(t4);
         for (int i = 0; i < dim; i += 2)
         {
             int head_dim = i % head_size;
@@ -469,283 +1130,264 @@ v4sf *forward(Transformer *transformer, int token, int pos)
             v4sf fcr = cosf(val);
             v4sf fci = sinf(val);
             int rotn = i < kv_dim ? 2 : 1; // how many vectors? 2 = q & k, 1 = q only
-            for (int v = 0; v < rotn; v++)
-            {
-                v4sf *vec = v == 0 ? s->q : s->k; // the vector to rotate (query or key)
-                v4sf v0 = vec[i];
-                v4sf v1 = vec[i + 1];
-                vec[i] = v0 * fcr - v1 * fci;
-                vec[i + 1] = v0 * fci + v1 * fcr;
-            }
-        }
-        // start task
-        *forward_params = (ForwardTaskParams){
-            .s = s,
-            .w = w,
-            .p = p,
-            .pos = pos,
-            .start = p->n_heads / 2,
-            .loff = loff,
-            .end = p->n_heads,
-            .dim = dim,
-            .kv_dim = kv_dim,
-            .kv_mul = kv_mul,
-            .hidden_dim = hidden_dim,
-            .head_size = head_size,
-            .task_num = FORWARD_TASK_1,
-        };
-        xSemaphoreGive(semaForwardDataReady);
-
-        // multihead attention. iterate over all heads
-        int h;
-        // #pragma omp parallel for private(h)
-        for (h = 0; h < (p->n_heads / 2); h++)
-        {
-            // get the query vector for this head
-            v4sf *q = s->q + h * head_size;
-            // attention scores for this head
-            v4sf *att = s->att + h * p->seq_len;
-            // iterate over all timesteps, including the current one
-            for (int t = 0; t <= pos; t++)
-            {
-                // get the key vector for this head and at this timestep
-                v4sf *k = s->key_cache + loff + t * kv_dim + (h / kv_mul) * head_size;
-                // calculate the attention score as the dot product of q and k
-                v4sf score = 0.0f;
-                for (int i = 0; i < head_size; i++)
-                {
-                    score += q[i] * k[i];
-                }
-                score /= sqrtf(head_size);
-                // save the score to the attention buffer
-                att[t] = score;
-            }
-
-            // softmax the scores to get attention weights, from 0..pos inclusively
-            softmax(att, pos + 1);
-
-            // weighted sum of the values, store back into xb
-            v4sf *xb = s->xb + h * head_size;
-            memset(xb, 0, head_size * sizeof(v4sf));
-            for (int t = 0; t <= pos; t++)
+            for (int b = 0; b < batch; b++)
             {
-                // get the value vector for this head and at this timestep
-                v4sf *v = s->value_cache + loff + t * kv_dim + (h / kv_mul) * head_size;
-                // get the attention weight for this timestep
-                v4sf a = att[t];
-                // accumulate the weighted value into xb
-                for (int i = 0; i < head_size; i++)
+                for (int r = 0; r < rotn; r++)
                 {
-                    xb[i] += a * v[i];
+                    v4sf *vec = r == 0 ? q[b] : k[b]; // the vector to rotate (query or key)
+                    v4sf v0 = vec[i];
+                    v4sf v1 = vec[i + 1];
+                    vec[i] = v0 * fcr - v1 * fci;
+                    vec[i + 1] = v0 * fci + v1 * fcr;
                 }
             }
         }
-        if (xSemaphoreTake(semaForwardDataReady, portMAX_DELAY) == pdTRUE)
+        for (int b = 0; b < batch; b++)
         {
+            kv_cache_store(states[b], p, loff, pos);
+        }
+        LLM_PROF_END(LLM_PROF_ROPE, t4);
 
-            xEventGroupSync(ForwardEventGroup,
-                            FORWARD_TASK_2,
-                            ALL_FORWARD_TASKS,
-                            portMAX_DELAY);
-
-            xEventGroupClearBits(ForwardEventGroup, ALL_FORWARD_TASKS);
-
-            // final matmul to get the output of the attention
-            matmul(s->xb2, s->xb, w->wo + l * dim * dim, dim, dim);
-
-            // residual connection back into x
-            for (int i = 0; i < dim; i++)
+        // each sequence attends over its own kv cache
+        for (int b = 0; b < batch; b++)
+        {
+            if (!wk)
             {
-                x[i] += s->xb2[i];
+                LLM_PROF_BEGIN(t5);
+                attention(states[b], p, loff, pos, 0, p->n_heads);
+                LLM_PROF_END(LLM_PROF_ATTN_CORE0, t5);
+                continue;
             }
+            // start task: core 1 takes the second half of the heads
+            wk->forward = (ForwardTaskParams){
+                .s = states[b],
+                .p = p,
+                .pos = pos,
+                .start = p->n_heads / 2,
+                .loff = loff,
+                .end = p->n_heads,
+            };
+            llm_sem_give(wk->forward_ready);
+
+            // multihead attention over the first half of the heads
+            LLM_PROF_BEGIN(t5);
+            attention(states[b], p, loff, pos, 0, p->n_heads / 2);
+            LLM_PROF_BEGIN(t6);
+            llm_sem_take(wk->forward_done);
+            LLM_PROF_END(LLM_PROF_SYNC_WAIT, t6);
+            LLM_PROF_END(LLM_PROF_ATTN_CORE0, t5);
+        }
 
-            // ffn rmsnorm
-            rmsnorm(s->xb, x, w->rms_ffn_weight + l * dim, dim);
-
-            // Now for FFN in PyTorch we have: self.w2(F.silu(self.w1(x)) * self.w3(x))
-            // first calculate self.w1(x) and self.w3(x)
-            matmul(s->hb, s->xb, w->w1 + l * dim * hidden_dim, dim, hidden_dim);
-            matmul(s->hb2, s->xb, w->w3 + l * dim * hidden_dim, dim, hidden_dim);
+        // final matmul to get the output of the attention
+        // w2 is prefetched next: w1 and w3 are read together by the fused SwiGLU,
+        // and the two of them would need both buffers, so they are read in place
+        LLM_PROF_BEGIN(t7);
+        project(w, wk, xb2, xb, batch, stage(prefetch, lw.wo, lw.w2, dim * hidden_dim), dim, dim);
+        LLM_PROF_END(LLM_PROF_MATMUL_O, t7);
 
-            // SwiGLU non-linearity
-            for (int i = 0; i < hidden_dim; i++)
+        // residual connection back into x, fused with the ffn rmsnorm
+        LLM_PROF_BEGIN(t8);
+        for (int b = 0; b < batch; b++)
+        {
+            residual_rmsnorm(xb[b], x[b], xb2[b], w->rms_ffn_weight + l * dim, dim);
+        }
+        LLM_PROF_END(LLM_PROF_RESIDUAL_NORM, t8);
+
+        // Now for FFN in PyTorch we have: self.w2(F.silu(self.w1(x)) * self.w3(x))
+        // w1 and w3 run as one fused projection that applies the SwiGLU per row
+        LLM_PROF_BEGIN(t10);
+        matmul_split(wk, hb, xb, batch, lw.w1, lw.w3, w->tiled, dim, hidden_dim);
+        LLM_PROF_END(LLM_PROF_MATMUL_W13, t10);
+
+        // final matmul to get the output of the ffn, prefetching the next
+        // layer's wq, or layer 0's for the next token; a streamed layer's
+        // slot isn't known before it is acquired
+        v4sf *next_wq = transformer->stream ? NULL
+                        : w->wq + (l + 1 < p->n_layers ? l + 1 : 0) * dim * dim;
+        LLM_PROF_BEGIN(t13);
+        project(w, wk, xb, hb, batch, stage(prefetch, lw.w2, next_wq, dim * dim), hidden_dim, dim);
+        LLM_PROF_END(LLM_PROF_MATMUL_W2, t13);
+
+        // residual connection, fused with the next layer's attention rmsnorm
+        // or, after the last layer, with the final rmsnorm (in place into x)
+        LLM_PROF_BEGIN(t14);
+        for (int b = 0; b < batch; b++)
+        {
+            if (l + 1 < p->n_layers)
             {
-                v4sf val = s->hb[i];
-                // silu(x)=x*σ(x), where σ(x) is the logistic sigmoid
-                val *= (1.0f / (1.0f + expf(-val)));
-                // elementwise multiply with w3(x)
-                val *= s->hb2[i];
-                s->hb[i] = val;
+                residual_rmsnorm(xb[b], x[b], xb[b], w->rms_att_weight + (l + 1) * dim, dim);
             }
-
-            // final matmul to get the output of the ffn
-            matmul(s->xb, s->hb, w->w2 + l * dim * hidden_dim, hidden_dim, dim);
-
-            // residual connection
-            for (int i = 0; i < dim; i++)
+            else
             {
-                x[i] += s->xb[i];
+                residual_rmsnorm(x[b], x[b], xb[b], w->rms_final_weight, dim);
             }
         }
+        LLM_PROF_END(LLM_PROF_RESIDUAL_NORM, t14);
     }
 
-    // final rmsnorm
-    rmsnorm(x, x, w->rms_final_weight, dim);
-
     // classifier into logits
-    matmul(s->logits, x, w->wcls, p->dim, p->vocab_size);
+    LLM_PROF_BEGIN(t16);
+    matmul_split(wk, logits, x, batch, w->wcls, NULL, w->wcls_tiled, p->dim, p->vocab_size);
+    LLM_PROF_END(LLM_PROF_CLASSIFIER, t16);
+}
+
+void forward_batch(Transformer *transformer, RunState *const *states, const int *tokens, int pos, int batch)
+{
+    forward_states(transformer, transformer->workers, states, tokens, pos, batch);
+}
+
+v4sf *forward(Transformer *transformer, int token, int pos)
+{
+    RunState *s = &transformer->state;
+    forward_batch(transformer, &s, &token, pos, 1);
     return s->logits;
 }
 
 // ----------------------------------------------------------------------------
 // The Byte Pair Encoding (BPE) Tokenizer that translates strings <-> tokens
 
-int compare_tokens(const void *a, const void *b)
+#define TOKENIZER_PARTITION_LABEL "tokenizer"
+
+static int map_tokenizer_image(Tokenizer *t, int vocab_size, const uint8_t *legacy, size_t legacy_len)
+{
+    const void *ptr;
+    size_t size;
+    llm_map_t handle;
+    if (llm_port_map_partition(TOKENIZER_PARTITION_LABEL, &ptr, &size, &handle) != 0)
+    {
+        return 0;
+    }
+    if (!tok_image_validate(ptr, size, vocab_size, legacy, legacy_len))
+    {
+        llm_port_unmap_partition(handle);
+        return 0;
+    }
+    t->image = ptr;
+    t->map_handle = handle;
+    t->mapped = 1;
+    return 1;
+}
+
+// reads the whole legacy tokenizer file, or returns NULL if it is not there
+static uint8_t *read_legacy_tokenizer(const char *tokenizer_path, size_t *file_size)
 {
-    return strcmp(((TokenIndex *)a)->str, ((TokenIndex *)b)->str);
+    FILE *file = fopen(tokenizer_path, "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *legacy = malloc(*file_size);
+    if (!legacy || fread(legacy, 1, *file_size, file) != *file_size)
+    {
+        ESP_LOGE(TAG, "failed read %s", tokenizer_path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+    return legacy;
 }
 
 void build_tokenizer(Tokenizer *t, char *tokenizer_path, int vocab_size)
 {
-    // i should have written the vocab_size into the tokenizer file... sigh
     ESP_LOGI(TAG, "Vocab size is %d\n", vocab_size);
     t->vocab_size = vocab_size;
-    // malloc space to hold the scores and the strings
-    t->vocab = (char **)malloc(vocab_size * sizeof(char *));
-    t->vocab_scores = (v4sf *)malloc(vocab_size * sizeof(v4sf));
-    t->sorted_vocab = NULL; // initialized lazily
-    for (int i = 0; i < 256; i++)
+    t->image_heap = NULL;
+    t->mapped = 0;
+
+    // the legacy file is small and read in a single go: its hash tells whether
+    // the image in the partition is stale. Without it any valid image is used
+    size_t file_size = 0;
+    uint8_t *legacy = read_legacy_tokenizer(tokenizer_path, &file_size);
+
+    // fast path: a precomputed image of this file already sits in the tokenizer partition
+    if (map_tokenizer_image(t, vocab_size, legacy, file_size))
     {
-        t->byte_pieces[i * 2] = (unsigned char)i;
-        t->byte_pieces[i * 2 + 1] = '\0';
+        free(legacy);
+        t->max_token_length = t->image->max_token_length;
+        ESP_LOGI(TAG, "Tokenizer image mapped from flash (%lu bytes)", (unsigned long)t->image->image_size);
+        return;
     }
-    // read in the file
-    FILE *file = fopen(tokenizer_path, "rb");
-    if (!file)
+
+    // otherwise build it from the legacy tokenizer file
+    if (!legacy)
     {
         ESP_LOGE(TAG, "couldn't load %s", tokenizer_path);
         exit(EXIT_FAILURE);
     }
-    ESP_LOGI(TAG, "Opened Tokenizer File");
-    if (fread(&t->max_token_length, sizeof(int), 1, file) != 1)
+    t->image_heap = tok_image_build(legacy, file_size, vocab_size);
+    if (!t->image_heap)
     {
-        ESP_LOGE(TAG, "failed read");
+        ESP_LOGE(TAG, "malformed tokenizer file %s", tokenizer_path);
         exit(EXIT_FAILURE);
     }
-    int len;
-    for (int i = 0; i < vocab_size; i++)
+
+    // persist the image so the next boot can map it zero-copy
+    if (llm_port_write_partition(TOKENIZER_PARTITION_LABEL, t->image_heap, t->image_heap->image_size) == 0 &&
+        map_tokenizer_image(t, vocab_size, legacy, file_size))
     {
-        if (fread(t->vocab_scores + i, sizeof(v4sf), 1, file) != 1)
-        {
-            ESP_LOGE(TAG, "failed read vocab scores");
-            exit(EXIT_FAILURE);
-        }
-        if (fread(&len, sizeof(int), 1, file) != 1)
-        {
-            ESP_LOGE(TAG, "failed read len");
-            exit(EXIT_FAILURE);
-        }
-        t->vocab[i] = (char *)malloc(len + 1);
-        if (fread(t->vocab[i], len, 1, file) != 1)
-        {
-            ESP_LOGE(TAG, "failed read vocab");
-            exit(EXIT_FAILURE);
-        }
-        t->vocab[i][len] = '\0'; // add the string terminating token
+        free(t->image_heap);
+        t->image_heap = NULL;
     }
-    fclose(file);
-    ESP_LOGI(TAG, "Tokenizer successfully built");
+    free(legacy);
+    if (!t->mapped)
+    {
+        t->image = t->image_heap;
+    }
+    t->max_token_length = t->image->max_token_length;
+    ESP_LOGI(TAG, "Tokenizer successfully built (%s)", t->mapped ? "flash" : "heap");
 }
 
 void free_tokenizer(Tokenizer *t)
 {
-    for (int i = 0; i < t->vocab_size; i++)
+    if (t->mapped)
     {
-        free(t->vocab[i]);
+        llm_port_unmap_partition(t->map_handle);
+        t->mapped = 0;
     }
-    free(t->vocab);
-    free(t->vocab_scores);
-    free(t->sorted_vocab);
+    free(t->image_heap);
+    t->image_heap = NULL;
+    t->image = NULL;
 }
 
-char *decode(Tokenizer *t, int prev_token, int token)
+const char *decode(Tokenizer *t, int prev_token, int token)
 {
-    char *piece = t->vocab[token];
+    const char *piece = tok_image_text(t->image, token);
     // following BOS (1) token, sentencepiece decoder strips any leading whitespace (see PR #89)
-    if (prev_token == 1 && piece[0] == ' ')
+    if (prev_token == 1 && (tok_image_flags(t->image, token) & TOK_FLAG_LEADING_SPACE))
     {
         piece++;
     }
-    // careful, some tokens designate raw bytes, and look like e.g. '<0x01>'
-    // parse this and convert and return the actual byte
-    unsigned char byte_val;
-    if (sscanf(piece, "<0x%02hhX>", &byte_val) == 1)
-    {
-        piece = (char *)t->byte_pieces + byte_val * 2;
-    }
+    // raw byte tokens ('<0x01>') and <s> / </s> markers are already resolved in the image
     return piece;
 }
 
-void safe_printf(char *piece) {
-    if (piece == NULL || piece[0] == '\0') {
-        return;
-    }
-
-    // Make a copy of the piece so we don't modify the original
-    char *temp_piece = malloc(strlen(piece) + 1);
-    if (!temp_piece) {
-        return;  // Memory allocation failed
+// appends a decoded piece to the text of a dream; returns what was appended,
+// NULL if the piece isn't printable
+static const char *append_piece(char *text, size_t *text_len, const char *piece, uint8_t flags) {
+    if (piece == NULL || piece[0] == '\0' || !(flags & TOK_FLAG_PRINTABLE)) {
+        return NULL;
     }
-    strcpy(temp_piece, piece);
 
     // Ignore the initial " if it's the first character
-    if (output_pos == 0 && temp_piece[0] == '"') {
-        memmove(temp_piece, temp_piece + 1, strlen(temp_piece));
-    }
-
-    // Ignore special tokens "<s>" and "</s>"
-    if (strcmp(temp_piece, "<s>") == 0 || strcmp(temp_piece, "</s>") == 0) {
-        free(temp_piece);
-        return;
-    }
-
-    // Handle the case where <s> or </s> is part of the string
-    char *pos;
-    while ((pos = strstr(temp_piece, "<s>")) != NULL) {
-        memmove(pos, pos + 3, strlen(pos + 3) + 1);
-    }
-    while ((pos = strstr(temp_piece, "</s>")) != NULL) {
-        memmove(pos, pos + 4, strlen(pos + 4) + 1);
-    }
-
-    // Single character handling
-    if (strlen(temp_piece) == 1) {
-        unsigned char byte_val = temp_piece[0];
-        if (!(isprint(byte_val) || isspace(byte_val))) {
-            free(temp_piece);
-            return;
-        }
+    if (*text_len == 0 && piece[0] == '"') {
+        piece++;
     }
 
-    // Save to buffer and print
-    size_t len = strlen(temp_piece);
-    if (output_pos + len < MAX_LLM_OUTPUT - 1) {
-        memcpy(output_buffer + output_pos, temp_piece, len);
-        output_pos += len;
-        output_buffer[output_pos] = '\0';
+    size_t len = strlen(piece);
+    if (*text_len + len < MAX_LLM_OUTPUT - 1) {
+        memcpy(text + *text_len, piece, len);
+        *text_len += len;
+        text[*text_len] = '\0';
     }
-
-    printf("%s", temp_piece);
-    free(temp_piece);
+    return piece;
 }
 
-
-int str_lookup(char *str, TokenIndex *sorted_vocab, int vocab_size)
+int str_lookup(char *str, Tokenizer *t)
 {
     // efficiently find the perfect match for str in vocab, return its index or -1 if not found
-    TokenIndex tok = {.str = str}; // acts as the key to search for
-    TokenIndex *res = bsearch(&tok, sorted_vocab, vocab_size, sizeof(TokenIndex), compare_tokens);
-    return res != NULL ? res->id : -1;
+    return tok_image_lookup(t->image, str);
 }
 
 void encode(Tokenizer *t, char *text, int8_t bos, int8_t eos, int *tokens, int *n_tokens)
@@ -758,18 +1400,6 @@ void encode(Tokenizer *t, char *text, int8_t bos, int8_t eos, int *tokens, int *
         exit(EXIT_FAILURE);
     }
 
-    if (t->sorted_vocab == NULL)
-    {
-        // lazily malloc and sort the vocabulary
-        t->sorted_vocab = malloc(t->vocab_size * sizeof(TokenIndex));
-        for (int i = 0; i < t->vocab_size; i++)
-        {
-            t->sorted_vocab[i].str = t->vocab[i];
-            t->sorted_vocab[i].id = i;
-        }
-        qsort(t->sorted_vocab, t->vocab_size, sizeof(TokenIndex), compare_tokens);
-    }
-
     // create a temporary buffer that will store merge candidates of always two consecutive tokens
     // *2 for concat, +1 for null terminator +2 for UTF8 (in case max_token_length is 1)
     char *str_buffer = malloc((t->max_token_length * 2 + 1 + 2) * sizeof(char));
@@ -788,7 +1418,7 @@ void encode(Tokenizer *t, char *text, int8_t bos, int8_t eos, int *tokens, int *
     // energy to read more of the sentencepiece code to figure out what it's doing
     if (text[0] != '\0')
     {
-        int dummy_prefix = str_lookup(" ", t->sorted_vocab, t->vocab_size);
+        int dummy_prefix = str_lookup(" ", t);
         tokens[(*n_tokens)++] = dummy_prefix;
     }
 
@@ -828,7 +1458,7 @@ void encode(Tokenizer *t, char *text, int8_t bos, int8_t eos, int *tokens, int *
         }
 
         // ok c+1 is not a continuation byte, so we've read in a full codepoint
-        int id = str_lookup(str_buffer, t->sorted_vocab, t->vocab_size);
+        int id = str_lookup(str_buffer, t);
 
         if (id != -1)
         {
@@ -849,6 +1479,7 @@ void encode(Tokenizer *t, char *text, int8_t bos, int8_t eos, int *tokens, int *
     }
 
     // merge the best consecutive pair each iteration, according the scores in vocab_scores
+    const float *vocab_scores = tok_image_scores(t->image);
     while (1)
     {
         v4sf best_score = -1e10;
@@ -858,12 +1489,12 @@ void encode(Tokenizer *t, char *text, int8_t bos, int8_t eos, int *tokens, int *
         for (int i = 0; i < (*n_tokens - 1); i++)
         {
             // check if we can merge the pair (tokens[i], tokens[i+1])
-            sprintf(str_buffer, "%s%s", t->vocab[tokens[i]], t->vocab[tokens[i + 1]]);
-            int id = str_lookup(str_buffer, t->sorted_vocab, t->vocab_size);
-            if (id != -1 && t->vocab_scores[id] > best_score)
+            sprintf(str_buffer, "%s%s", tok_image_piece(t->image, tokens[i]), tok_image_piece(t->image, tokens[i + 1]));
+            int id = str_lookup(str_buffer, t);
+            if (id != -1 && vocab_scores[id] > best_score)
             {
                 // this merge pair exists in vocab! record its score and position
-                best_score = t->vocab_scores[id];
+                best_score = vocab_scores[id];
                 best_id = id;
                 best_idx = i;
             }
@@ -1018,18 +1649,27 @@ void build_sampler(Sampler *sampler, int vocab_size, float temperature, float to
     sampler->topp = topp;
 
     // Usa un seed casuale unico per ogni generazione, basato sull'orologio interno
-    unsigned long long true_random_seed = (unsigned long long)time(NULL) ^ esp_random();
+    unsigned long long true_random_seed = (unsigned long long)time(NULL) ^ llm_port_random();
     sampler->rng_state = rng_seed ? rng_seed : true_random_seed;
+    sampler->deterministic = 0;
+    sampler->seed = sampler->rng_state;
 
     ESP_LOGI(TAG, "Building sampler with temperature: %f, topp: %f, rng_seed: %llu", temperature, topp, sampler->rng_state);
 
     // Allocazione della memoria per probindex
-    sampler->probindex = heap_caps_malloc(vocab_size * sizeof(ProbIndex), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    sampler->probindex = llm_port_malloc_internal(vocab_size * sizeof(ProbIndex));
     if (!sampler->probindex) {
         ESP_LOGE(TAG, "Failed to allocate probindex");
         abort();
     }
 }
+void sampler_set_deterministic(Sampler *sampler, unsigned long long seed)
+{
+    sampler->deterministic = 1;
+    sampler->seed = seed ? seed : 1; // xorshift never leaves an all-zero state
+    sampler->rng_state = sampler->seed;
+}
+
 void free_sampler(Sampler *sampler)
 {
     free(sampler->probindex);
@@ -1077,9 +1717,7 @@ int sample(Sampler *sampler, v4sf *logits) {
         sampler->temperature = 1.0f;
     }
     if (sampler->temperature != 1.0f) {
-        for (int q = 0; q < sampler->vocab_size; q++) {
-            logits[q] /= sampler->temperature;
-        }
+        llm_vscale(logits, 1.0f / sampler->temperature, sampler->vocab_size);
     }
 
     for (int i = 0; i < sampler->vocab_size; i++) {
@@ -1130,7 +1768,7 @@ long time_in_ms()
 {
     // return time in milliseconds, for benchmarking the model speed
     struct timespec time;
-    clock_gettime(CLOCK_REALTIME, &time);
+    clock_gettime(CLOCK_MONOTONIC, &time);
     return time.tv_sec * 1000 + time.tv_nsec / 1000000;
 }
 
@@ -1138,181 +1776,483 @@ long time_in_ms()
 // ----------------------------------------------------------------------------
 // generation loop
 
-void generate(Transformer *transformer, Tokenizer *tokenizer, Sampler *sampler,
-             char *prompt, int steps, generated_complete_cb cb_done) {
-    // Reset output buffer
-    output_pos = 0;
-    output_buffer[0] = '\0';
-
-    sampler->rng_state = (unsigned long long)time(NULL) ^ esp_random();
+static void seed_sequence(Sampler *sampler, RunState *s)
+{
+    if (sampler->deterministic) {
+        // fixed seed: the sampling noise and the embedding noise in forward()
+        // are two streams derived from it, so runs are comparable token by token
+        sampler->rng_state = sampler->seed;
+        s->rng_state = sampler->seed ^ 0x9E3779B97F4A7C15ULL;
+    } else {
+        sampler->rng_state = (unsigned long long)time(NULL) ^ llm_port_random();
+        s->rng_state = sampler->rng_state ^ ((unsigned long long)llm_port_random() << 32);
+    }
     ESP_LOGI(TAG, "Sampler RNG state reset: %llu", sampler->rng_state);
-    
-    reset_run_state(&transformer->state, &transformer->config);
-    char *empty_prompt = "";
-    if (prompt == NULL) {
-        prompt = empty_prompt;
+}
+
+static bool ends_sentence(const char *piece)
+{
+    return piece && (piece[0] == '.' || piece[0] == '!' || piece[0] == '?');
+}
+
+// whether a dream is in the middle of a sentence once piece is appended;
+// generation only stops between sentences
+static bool sentence_open(const char *piece, bool in_sentence)
+{
+    if (!piece || piece[0] == '\0') {
+        return in_sentence;
+    }
+    if (ends_sentence(piece)) {
+        return false;
     }
+    return in_sentence || !isspace((unsigned char)piece[0]);
+}
 
-    int num_prompt_tokens = 0;
-    int *prompt_tokens = (int *)malloc((strlen(prompt) + 3) * sizeof(int));
-    encode(tokenizer, prompt, 1, 0, prompt_tokens, &num_prompt_tokens);
-    if (num_prompt_tokens < 1) {
-        ESP_LOGE(TAG, "something is wrong, expected at least 1 prompt token");
-        exit(EXIT_FAILURE);
+// LEDs lit while a dream is generated, one node every fourth token
+typedef struct LedTrail
+{
+    bool lit[MATRIX_ROWS][MATRIX_COLS]; // Tiene traccia dei LED accesi
+    int active_nodes;
+    int prev_x, prev_y;
+    int live;        // light the nodes as they come, or only record them
+    DreamTrail path; // the nodes in the order they were lit
+} LedTrail;
+
+static bool trail_light(LedTrail *trail, int x, int y)
+{
+    if (trail->live && llm_port_activate_node(x, y) != 0) {
+        return false;
     }
+    trail->path.x[trail->path.n] = x;
+    trail->path.y[trail->path.n] = y;
+    trail->path.n++;
+    return true;
+}
 
-    long start = 0;               
-    int next;                     
-    int token = prompt_tokens[0]; 
-    int pos = 0;                  
-    int prev_x = -1, prev_y = -1;
-    
+static void led_trail_step(LedTrail *trail, const v4sf *logits, int next, int vocab_size)
+{
     const int MIN_ACTIVE_NODES = 45;  // Minimo numero di LED da mantenere accesi
     const int MAX_ACTIVE_NODES = 55;  // Massimo numero di LED accesi
-    int active_nodes = 0;
-    bool led_matrix[MATRIX_ROWS][MATRIX_COLS] = {0};  // Tiene traccia dei LED accesi
-    
-    int tokens_since_last_end = 0;
-    bool in_sentence = false;
-
-    while (pos < steps) {
-        sampler->rng_state ^= (unsigned long long)pos * 6364136223846793005ULL + 1;
-
-        v4sf *logits = forward(transformer, token, pos);
-
-        if (pos < num_prompt_tokens - 1) {
-            next = prompt_tokens[pos + 1];
-        } else {
-            next = sample(sampler, logits);
+    if (trail->active_nodes < MAX_ACTIVE_NODES) {
+        // Usa i logits per determinare le coordinate 2D
+        v4sf max_logit = -1e10;
+        v4sf min_logit = 1e10;
+        
+        for (int i = 0; i < vocab_size; i++) {
+            if (logits[i] > max_logit) max_logit = logits[i];
+            if (logits[i] < min_logit) min_logit = logits[i];
         }
-        pos++;
-        tokens_since_last_end++;
-
-        char *piece = decode(tokenizer, token, next);
         
-        if (piece && piece[0] != '\0') {
-            if (piece[0] == '.' || piece[0] == '!' || piece[0] == '?') {
-                tokens_since_last_end = 0;
-                in_sentence = false;
-            } else if (!isspace((unsigned char)piece[0])) {
-                in_sentence = true;
+        v4sf l1 = logits[next];
+        v4sf l2 = logits[(next + 1) % vocab_size];
+        
+        int x = (int)(((l1 - min_logit) / (max_logit - min_logit)) * (MATRIX_COLS - 1));
+        int y = (int)(((l2 - min_logit) / (max_logit - min_logit)) * (MATRIX_ROWS - 1));
+        
+        bool led_activated = false;
+        
+        if (!trail->lit[y][x]) {
+            trail->lit[y][x] = true;
+            if (trail_light(trail, x, y)) {
+                trail->active_nodes++;
+                trail->prev_x = x;
+                trail->prev_y = y;
+                led_activated = true;
             }
         }
-
-        // LED Matrix logic - ora solo ogni 10 token
-        if (pos % 4 == 0) {
-            if (active_nodes < MAX_ACTIVE_NODES) {
-                // Usa i logits per determinare le coordinate 2D
-                v4sf max_logit = -1e10;
-                v4sf min_logit = 1e10;
-                
-                for (int i = 0; i < transformer->config.vocab_size; i++) {
-                    if (logits[i] > max_logit) max_logit = logits[i];
-                    if (logits[i] < min_logit) min_logit = logits[i];
-                }
-                
-                v4sf l1 = logits[next];
-                v4sf l2 = logits[(next + 1) % transformer->config.vocab_size];
-                
-                int x = (int)(((l1 - min_logit) / (max_logit - min_logit)) * (MATRIX_COLS - 1));
-                int y = (int)(((l2 - min_logit) / (max_logit - min_logit)) * (MATRIX_ROWS - 1));
-                
-                bool led_activated = false;
-                
-                if (!led_matrix[y][x]) {
-                    led_matrix[y][x] = true;
-                    int *coords = malloc(2 * sizeof(int));
-                    if (coords != NULL) {
-                        coords[0] = x;
-                        coords[1] = y;
-                        xTaskCreate(activate_new_node_task, "activate_node", 2048, coords, 5, NULL);
-                        active_nodes++;
-                        prev_x = x;
-                        prev_y = y;
-                        led_activated = true;
-                    }
-                }
-                
-                // Se non abbiamo attivato il LED e siamo sotto il minimo, cerca altre posizioni
-                if (!led_activated && active_nodes < MIN_ACTIVE_NODES) {
-                    // Prima prova posizioni adiacenti
-                    for (int dy = -1; dy <= 1 && !led_activated; dy++) {
-                        for (int dx = -1; dx <= 1 && !led_activated; dx++) {
-                            if (dx == 0 && dy == 0) continue;
-                            
-                            int new_x = (prev_x + dx + MATRIX_COLS) % MATRIX_COLS;
-                            int new_y = (prev_y + dy + MATRIX_ROWS) % MATRIX_ROWS;
-                            
-                            if (!led_matrix[new_y][new_x]) {
-                                led_matrix[new_y][new_x] = true;
-                                int *coords = malloc(2 * sizeof(int));
-                                if (coords != NULL) {
-                                    coords[0] = new_x;
-                                    coords[1] = new_y;
-                                    xTaskCreate(activate_new_node_task, "activate_node", 2048, coords, 5, NULL);
-                                    active_nodes++;
-                                    prev_x = new_x;
-                                    prev_y = new_y;
-                                    led_activated = true;
-                                }
-                            }
+        
+        // Se non abbiamo attivato il LED e siamo sotto il minimo, cerca altre posizioni
+        if (!led_activated && trail->active_nodes < MIN_ACTIVE_NODES) {
+            // Prima prova posizioni adiacenti
+            for (int dy = -1; dy <= 1 && !led_activated; dy++) {
+                for (int dx = -1; dx <= 1 && !led_activated; dx++) {
+                    if (dx == 0 && dy == 0) continue;
+                    
+                    int new_x = (trail->prev_x + dx + MATRIX_COLS) % MATRIX_COLS;
+                    int new_y = (trail->prev_y + dy + MATRIX_ROWS) % MATRIX_ROWS;
+                    
+                    if (!trail->lit[new_y][new_x]) {
+                        trail->lit[new_y][new_x] = true;
+                        if (trail_light(trail, new_x, new_y)) {
+                            trail->active_nodes++;
+                            trail->prev_x = new_x;
+                            trail->prev_y = new_y;
+                            led_activated = true;
                         }
                     }
+                }
+            }
+            
+            // Se ancora non abbiamo attivato un LED, prova posizioni casuali
+            if (!led_activated) {
+                int attempts = 0;
+                while (!led_activated && attempts < 10) {
+                    int new_x = llm_port_random() % MATRIX_COLS;
+                    int new_y = llm_port_random() % MATRIX_ROWS;
                     
-                    // Se ancora non abbiamo attivato un LED, prova posizioni casuali
-                    if (!led_activated) {
-                        int attempts = 0;
-                        while (!led_activated && attempts < 10) {
-                            int new_x = esp_random() % MATRIX_COLS;
-                            int new_y = esp_random() % MATRIX_ROWS;
-                            
-                            if (!led_matrix[new_y][new_x]) {
-                                led_matrix[new_y][new_x] = true;
-                                int *coords = malloc(2 * sizeof(int));
-                                if (coords != NULL) {
-                                    coords[0] = new_x;
-                                    coords[1] = new_y;
-                                    xTaskCreate(activate_new_node_task, "activate_node", 2048, coords, 5, NULL);
-                                    active_nodes++;
-                                    prev_x = new_x;
-                                    prev_y = new_y;
-                                    led_activated = true;
-                                }
-                            }
-                            attempts++;
+                    if (!trail->lit[new_y][new_x]) {
+                        trail->lit[new_y][new_x] = true;
+                        if (trail_light(trail, new_x, new_y)) {
+                            trail->active_nodes++;
+                            trail->prev_x = new_x;
+                            trail->prev_y = new_y;
+                            led_activated = true;
                         }
                     }
+                    attempts++;
                 }
             }
         }
+    }
+}
 
-        safe_printf(piece);
-        fflush(stdout);
-        token = next;
+// bytes of the buffers malloc_run_state() allocates
+static size_t run_state_bytes(const Config *p)
+{
+    size_t kv_dim = (p->dim * p->n_kv_heads) / p->n_heads;
+    size_t floats = 4 * (size_t)p->dim + 2 * (size_t)p->hidden_dim + 2 * kv_dim + (size_t)p->n_heads * p->seq_len +
+                    p->vocab_size + 2 * (size_t)p->n_layers * p->seq_len * kv_dim;
+    return floats * sizeof(v4sf);
+}
 
-        if (start == 0) {
-            start = time_in_ms();
+void reserve_batch(Transformer *t, int batch)
+{
+    if (batch > t->n_batch)
+    {
+        ESP_LOGI(TAG, "Batch: %d more states of %u bytes on the heap, outside the placement plan",
+                 batch - t->n_batch, (unsigned)run_state_bytes(&t->config));
+    }
+    for (int b = t->n_batch; b < batch; b++)
+    {
+        // plain heap: the placement planner only budgets the single-sequence state
+        RunState *s = calloc(1, sizeof(RunState));
+        if (!s)
+        {
+            ESP_LOGE(TAG, "No memory for the state of sequence %d", b);
+            exit(EXIT_FAILURE);
         }
+        malloc_run_state(s, &t->config);
+        t->batch[b] = s;
+        t->n_batch = b + 1;
+    }
+}
 
-        if (pos > steps * 0.8 && !in_sentence) {
-            break;
+// frees what session_start() allocated; the session may be partly built
+static void session_free(GenSession *s) {
+    for (int b = 0; b < s->batch; b++) {
+        free(s->text[b]);
+        s->text[b] = NULL;
+    }
+    free(s->trail);
+    free(s->prompt_tokens);
+    s->trail = NULL;
+    s->prompt_tokens = NULL;
+    if (s->own_state) {
+        free_run_state(s->own_state);
+        free(s->own_state);
+        s->own_state = NULL;
+    }
+}
+
+// allocates and resets what a session needs once its fields are set
+// @return 0, or -1 with everything freed
+static int session_start(GenSession *s) {
+    Transformer *transformer = s->transformer;
+    s->prompt = s->prompt ? s->prompt : "";
+    s->prompt_tokens = (int *)malloc((strlen(s->prompt) + 3) * sizeof(int));
+    // without live LEDs each dream gets its own trail, for whoever shows it to replay
+    s->trail = calloc(s->batch, sizeof(LedTrail));
+    if (!s->prompt_tokens || !s->trail) {
+        ESP_LOGE(TAG, "No memory for the session");
+        session_free(s);
+        return -1;
+    }
+    s->stats = (GenerateStats){.checksum = 2166136261u, .batch = s->batch};
+    for (int b = 0; b < s->batch; b++) {
+        s->text[b] = malloc(MAX_LLM_OUTPUT);
+        if (!s->text[b]) {
+            ESP_LOGE(TAG, "No memory for the text of sequence %d", b);
+            session_free(s);
+            return -1;
         }
+        s->text[b][0] = '\0';
+        s->trail[b].prev_x = -1;
+        s->trail[b].prev_y = -1;
+        s->trail[b].live = s->live;
+        s->stats.seq_checksum[b] = 2166136261u;
+        reset_run_state(s->states[b], &transformer->config);
+        seed_sequence(&s->samplers[b], s->states[b]);
+    }
+    encode(s->tokenizer, s->prompt, 1, 0, s->prompt_tokens, &s->num_prompt_tokens);
+    if (s->num_prompt_tokens < 1) {
+        ESP_LOGE(TAG, "something is wrong, expected at least 1 prompt token");
+        session_free(s);
+        return -1;
     }
 
-    if (in_sentence) {
-        printf(".");
+    // the sequences still running; all of them are at the same position, and
+    // one that stops just leaves the batch
+    s->n_active = s->batch;
+    for (int b = 0; b < s->batch; b++) {
+        s->seq[b] = b;
+        s->token[b] = s->prompt_tokens[0];
+    }
+    // the profiler and the weight pipelines are the split forward's
+    if (s->workers) {
+        llm_prof_reset();
+        if (transformer->stream) {
+            llm_stream_reset_stats(transformer->stream);
+        }
+        if (transformer->prefetch) {
+            llm_prefetch_reset_stats(transformer->prefetch);
+        }
     }
-    printf("\n");
+    return 0;
+}
 
-    if (pos > 1) {
-        long end = time_in_ms();
-        float tks = (pos - 1) / (double)(end - start) * 1000;
-        fprintf(stderr, "achieved tok/s: %f\n", tks);
-        cb_done(tks);
+static void session_begin(GenSession *s, Transformer *transformer, Tokenizer *tokenizer, Sampler *samplers,
+                          int batch, char *prompt, int steps, dream_ready_cb on_dream, void *arg, int live) {
+    if (batch < 1 || batch > LLM_MAX_BATCH) {
+        ESP_LOGE(TAG, "Batch of %d sequences, at most %d are supported", batch, LLM_MAX_BATCH);
+        exit(EXIT_FAILURE);
     }
-    
-    captive_portal_set_llm_output(output_buffer);
-    free(prompt_tokens);
+    reserve_batch(transformer, batch);
+
+    memset(s, 0, sizeof(*s));
+    s->transformer = transformer;
+    s->tokenizer = tokenizer;
+    s->workers = transformer->workers;
+    s->samplers = samplers;
+    s->batch = batch;
+    s->prompt = prompt;
+    s->steps = steps;
+    s->live = live;
+    s->on_dream = on_dream;
+    s->arg = arg;
+    for (int b = 0; b < batch; b++) {
+        s->states[b] = transformer->batch[b];
+    }
+    if (session_start(s) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+void gen_session_begin(GenSession *s, Transformer *transformer, Tokenizer *tokenizer, Sampler *samplers,
+                       int batch, char *prompt, int steps, dream_ready_cb on_dream, void *arg) {
+    // nothing is lit while a batch runs, so it can run during an animation
+    session_begin(s, transformer, tokenizer, samplers, batch, prompt, steps, on_dream, arg, 0);
+}
+
+bool gen_session_done(const GenSession *s) {
+    return s->n_active == 0 || s->pos >= s->steps;
+}
+
+bool gen_session_step(GenSession *s) {
+    if (gen_session_done(s)) {
+        return false;
+    }
+    Transformer *transformer = s->transformer;
+    GenerateStats *st = &s->stats;
+    int pos = s->pos;
+    RunState *states[LLM_MAX_BATCH];
+    int tokens[LLM_MAX_BATCH];
+    for (int i = 0; i < s->n_active; i++) {
+        states[i] = s->states[s->seq[i]];
+        tokens[i] = s->token[s->seq[i]];
+        s->samplers[s->seq[i]].rng_state ^= (unsigned long long)pos * 6364136223846793005ULL + 1;
+    }
+
+    forward_states(transformer, s->workers, states, tokens, pos, s->n_active);
+
+    int kept = 0;
+    for (int i = 0; i < s->n_active; i++) {
+        int b = s->seq[i];
+        v4sf *logits = states[i]->logits;
+        int next;
+        LLM_PROF_BEGIN(t_sample);
+        if (pos < s->num_prompt_tokens - 1) {
+            next = s->prompt_tokens[pos + 1];
+        } else {
+            next = sample(&s->samplers[b], logits);
+        }
+        LLM_PROF_END(LLM_PROF_SAMPLE, t_sample);
+        LLM_PROF_TOKEN();
+        st->seq_checksum[b] = (st->seq_checksum[b] ^ (uint32_t)next) * 16777619u;
+        st->tokens++;
+        s->length[b] = pos + 1;
+
+        const char *piece = decode(s->tokenizer, s->token[b], next);
+        s->in_sentence[b] = sentence_open(piece, s->in_sentence[b]);
+
+        LLM_PROF_BEGIN(t_led);
+        if ((pos + 1) % 4 == 0) {
+            led_trail_step(&s->trail[b], logits, next, transformer->config.vocab_size);
+        }
+        LLM_PROF_END(LLM_PROF_LED, t_led);
+
+        LLM_PROF_BEGIN(t_decode);
+        piece = append_piece(s->text[b], &s->text_len[b], piece, tok_image_flags(s->tokenizer->image, next));
+        if (s->live && piece) {
+            printf("%s", piece);
+            fflush(stdout);
+        }
+        LLM_PROF_END(LLM_PROF_DECODE, t_decode);
+        s->token[b] = next;
+
+        if ((pos + 1 > s->steps * 0.8 && !s->in_sentence[b]) || pos + 1 == s->steps) {
+            printf("%s%s\n", s->live ? "" : s->text[b], s->in_sentence[b] ? "." : "");
+            if (s->on_dream) {
+                s->on_dream(s->text[b], &s->trail[b].path, s->arg);
+            }
+        } else {
+            s->seq[kept++] = b;
+        }
+    }
+    st->checksum = st->seq_checksum[0];
+    s->n_active = kept;
+    s->pos++;
+
+    // the clock starts after the first step, so the first token of each
+    // sequence is left out of the rate
+    if (s->start == 0) {
+        s->start = time_in_ms();
+    } else {
+        long elapsed = time_in_ms() - s->start - s->paused_ms;
+        st->elapsed_ms = elapsed > 0 ? elapsed : 1;
+        st->tokens_ps = (st->tokens - s->batch) / (double)st->elapsed_ms * 1000;
+    }
+    return true;
+}
+
+bool gen_session_run(GenSession *s, gen_yield_fn should_yield, void *arg) {
+    if (s->paused_at != 0) {
+        s->paused_ms += time_in_ms() - s->paused_at;
+        s->paused_at = 0;
+    }
+    while (!gen_session_done(s)) {
+        if (should_yield && should_yield(arg)) {
+            s->paused_at = time_in_ms();
+            s->yields++;
+            return false;
+        }
+        gen_session_step(s);
+    }
+    return true;
+}
+
+void gen_session_end(GenSession *s) {
+    Transformer *transformer = s->transformer;
+    GenerateStats *last_stats = &transformer->last_stats;
+    *last_stats = s->stats;
+    ESP_LOGI(TAG, "batch of %d: %d tokens in %ld ms, %.2f tok/s aggregate",
+             s->batch, last_stats->tokens, last_stats->elapsed_ms, last_stats->tokens_ps);
+    if (s->yields > 0) {
+        ESP_LOGI(TAG, "yielded %d times, %ld ms paused", s->yields, s->paused_ms);
+    }
+    for (int b = 0; b < s->batch; b++) {
+        if (s->samplers[b].deterministic) {
+            ESP_LOGI(TAG, "bench: seed=%llu prompt=\"%s\" tokens=%d checksum=%08lx",
+                     s->samplers[b].seed, s->prompt, s->length[b], (unsigned long)last_stats->seq_checksum[b]);
+        }
+    }
+    if (transformer->stream) {
+        llm_stream_log(transformer->stream);
+    }
+    if (transformer->prefetch) {
+        llm_prefetch_log(transformer->prefetch);
+    }
+    session_free(s);
+}
+
+void generate_batch(Transformer *transformer, Tokenizer *tokenizer, Sampler *samplers, int batch,
+                    char *prompt, int steps, dream_ready_cb on_dream, void *arg) {
+    GenSession session;
+    gen_session_begin(&session, transformer, tokenizer, samplers, batch, prompt, steps, on_dream, arg);
+    gen_session_run(&session, NULL, NULL);
+    gen_session_end(&session);
+}
+
+void llm_context_init(LlmContext *ctx, Transformer *transformer, Tokenizer *tokenizer) {
+    ctx->transformer = transformer;
+    ctx->tokenizer = tokenizer;
+    ESP_LOGI(TAG, "Sessions: a state of %u bytes each on the heap, outside the placement plan",
+             (unsigned)run_state_bytes(&transformer->config));
+}
+
+LlmSession *llm_session_create(const LlmContext *ctx, Sampler *sampler, char *prompt, int steps, LlmExec exec) {
+    Transformer *t = ctx->transformer;
+    if (exec == LLM_EXEC_LOCAL && t->stream) {
+        ESP_LOGE(TAG, "Streamed weights need the split forward");
+        return NULL;
+    }
+    LlmSession *s = calloc(1, sizeof(LlmSession));
+    if (!s) {
+        return NULL;
+    }
+    // plain heap like reserve_batch(): the planner only budgets transformer->state
+    s->own_state = calloc(1, sizeof(RunState));
+    if (!s->own_state || alloc_run_state(s->own_state, &t->config) != 0) {
+        ESP_LOGE(TAG, "No memory for the state of a session");
+        free(s->own_state);
+        free(s);
+        return NULL;
+    }
+    s->transformer = t;
+    s->tokenizer = ctx->tokenizer;
+    s->workers = exec == LLM_EXEC_SPLIT ? t->workers : NULL;
+    s->samplers = sampler;
+    s->batch = 1;
+    s->prompt = prompt;
+    s->steps = steps;
+    s->states[0] = s->own_state;
+    if (session_start(s) != 0) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+int llm_session_step(LlmSession *s) {
+    return gen_session_step(s) ? s->token[0] : -1;
+}
+
+const char *llm_session_text(const LlmSession *s) {
+    return s->text[0];
+}
+
+const DreamTrail *llm_session_trail(const LlmSession *s) {
+    return &s->trail[0].path;
+}
+
+void llm_session_destroy(LlmSession *s) {
+    if (!s) {
+        return;
+    }
+    session_free(s);
+    free(s);
+}
+
+// generate() publishes its dream once it ends
+static void publish_dream(const char *text, const DreamTrail *trail, void *arg) {
+    llm_port_publish_output(text);
+}
+
+void generate(Transformer *transformer, Tokenizer *tokenizer, Sampler *sampler,
+             char *prompt, int steps, generated_complete_cb cb_done) {
+    // one sequence on transformer->state, its LEDs lit and its text printed as it comes
+    GenSession session;
+    session_begin(&session, transformer, tokenizer, sampler, 1, prompt, steps, publish_dream, NULL, 1);
+    gen_session_run(&session, NULL, NULL);
+    gen_session_end(&session);
+    const GenerateStats *stats = llm_last_stats(transformer);
+    if (stats->tokens > 1) {
+        cb_done(stats->tokens_ps);
+    }
+}
+
+const GenerateStats *llm_last_stats(const Transformer *transformer)
+{
+    return &transformer->last_stats;
 }
 
 void read_stdin(const char *guide, char *buffer, size_t bufsize)
@@ -10,15 +10,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/semphr.h"
-#include "freertos/task.h"
-#include "freertos/event_groups.h"
-#include "ws_matrix.h"
-#include "esp_random.h" 
+#include <stdint.h>
+#include <stdbool.h>
+#include "llm_port.h"
+#include "tok_image.h"
+#include "llm_placement.h"
+#include "llm_kernels.h"
+#include "llm_stream.h"
+#include "llm_prefetch.h"
 
+#ifdef LLM_HOST_BUILD
+// the over-aligned typedef lets x86 compilers emit aligned SIMD loads for
+// row pointers that are only 4-byte aligned, so the host uses a plain float
+typedef float v4sf;
+#else
 typedef float v4sf __attribute__((aligned(16)));
+#endif
 
 typedef struct {
     float prob;
@@ -31,20 +38,17 @@ typedef struct {
     float temperature;    // Cambiato da v4sf a float
     float topp;          // Cambiato da v4sf a float
     unsigned long long rng_state;
+    int deterministic;   // benchmark mode: every noise stream derives from seed only
+    unsigned long long seed;
 } Sampler;
 
 typedef struct {
-    char *str;
-    int id;
-} TokenIndex;
-
-typedef struct {
-    char** vocab;
-    v4sf* vocab_scores;
-    TokenIndex *sorted_vocab;
+    const tok_image_header_t *image; // precomputed tokenizer image, see tok_image.h
     int vocab_size;
     unsigned int max_token_length;
-    unsigned char byte_pieces[512]; // stores all single-byte strings
+    tok_image_header_t *image_heap; // heap copy, used when the flash partition can't be mapped
+    llm_map_t map_handle;
+    int mapped;
 } Tokenizer;
 
 typedef struct {
@@ -76,6 +80,9 @@ typedef struct {
     v4sf* rms_final_weight; // (dim,)
     // (optional) classifier weights for the logits, on the last layer
     v4sf* wcls;
+    int tiled;      // layer matrices repacked by repack_tiled()
+    int wcls_tiled; // wcls repacked too
+    v4sf* wcls_copy; // tiled copy of a classifier shared with the embedding, or NULL
 } TransformerWeights;
 
 typedef struct {
@@ -86,17 +93,33 @@ typedef struct {
     v4sf *hb; // buffer for hidden dimension in the ffn (hidden_dim,)
     v4sf *hb2; // buffer for hidden dimension in the ffn (hidden_dim,)
     v4sf *q; // query (dim,)
-    v4sf *k; // key (dim,)
-    v4sf *v; // value (dim,)
+    v4sf *k; // key of this position (kv_dim,), copied into the cache after RoPE
+    v4sf *v; // value of this position (kv_dim,)
     v4sf *att; // buffer for scores/attention values (n_heads, seq_len)
     v4sf *logits; // output logits
     // kv cache
-    v4sf* key_cache;   // (layer, seq_len, dim)
-    v4sf* value_cache; // (layer, seq_len, dim)
+    v4sf* key_cache;   // (layer, kv_head, seq_len, head_size)
+    v4sf* value_cache; // (layer, kv_head, head_size, seq_len), transposed
     unsigned long long rng_state;
 } RunState;
 
 
+#define LLM_PLACEMENT_MAX_ENTRIES 24 // weight groups and RunState buffers, see place_transformer()
+#define LLM_MAX_BATCH 4 // sequences generate_batch() decodes in lock-step
+
+typedef struct {
+    int tokens;           // tokens produced, prompt included, summed over the batch
+    uint32_t checksum;    // FNV-1a over the token ids, comparable across builds
+    long elapsed_ms;      // from the first generated token to the last
+    float tokens_ps;      // aggregate over the batch
+    int batch;            // sequences generated together, 1 for generate()
+    uint32_t seq_checksum[LLM_MAX_BATCH]; // checksum of each sequence; [0] is checksum
+} GenerateStats;
+
+// the pair of core-1 tasks that takes half of every matmul and attention of a
+// forward; it serves one forward at a time
+typedef struct LlmWorkers LlmWorkers;
+
 typedef struct {
     Config config; // the hyperparameters of the architecture (the blueprint)
     TransformerWeights weights; // the weights of the model
@@ -105,20 +128,188 @@ typedef struct {
     int fd; // file descriptor for memory mapping
     v4sf* data; // memory mapped data pointer
     size_t file_size; // size of the checkpoint file in bytes
+    // where each weight group and RunState buffer lives, see llm_placement.h
+    llm_placement_entry_t placement[LLM_PLACEMENT_MAX_ENTRIES];
+    int n_placement; // 0 when the planner is off (CONFIG_LLM_PLACEMENT_MALLOC)
+    llm_stream_t *stream; // layer matrices read per token from the file (CONFIG_LLM_STREAM_WEIGHTS), or NULL
+    llm_prefetch_t *prefetch; // SRAM staging of the next matrix (CONFIG_LLM_PREFETCH), or NULL
+    RunState *batch[LLM_MAX_BATCH]; // per-sequence state of batched generation, batch[0] is &state
+    int n_batch; // entries of batch set up by reserve_batch()
+    LlmWorkers *workers; // of forward() and forward_batch()
+    GenerateStats last_stats; // of the last generate() or generate_batch()
 } Transformer;
 
 
 
 typedef void (*generated_complete_cb)(float tokens_ps);
 
+// the LEDs a dream lit while it was generated, in order
+typedef struct {
+    int n;
+    uint8_t x[MATRIX_ROWS * MATRIX_COLS];
+    uint8_t y[MATRIX_ROWS * MATRIX_COLS];
+} DreamTrail;
+
+// a finished dream of generate_batch(), handed over as soon as its sequence stops;
+// its LEDs were not lit, trail says which to light before animating it
+typedef void (*dream_ready_cb)(const char *text, const DreamTrail *trail, void *arg);
+
 void reset_run_state(RunState *s, Config *p);
 void build_transformer(Transformer *t, char* checkpoint_path);
 void build_tokenizer(Tokenizer* t, char* tokenizer_path, int vocab_size);
 void build_sampler(Sampler* sampler, int vocab_size, float temperature, float topp, unsigned long long rng_seed);
 void generate(Transformer *transformer, Tokenizer *tokenizer, Sampler *sampler, char *prompt, int steps, generated_complete_cb cb_done);
+void sampler_set_deterministic(Sampler* sampler, unsigned long long seed);
+/**
+ * @brief Allocates the RunState (activations and KV cache) of sequences 1..batch-1;
+ *        sequence 0 uses transformer->state
+ */
+void reserve_batch(Transformer *transformer, int batch);
+/**
+ * @brief Generates batch dreams from the same prompt in lock-step, so every
+ *        weight matrix is read once per step for all of them. Sequence b samples
+ *        with samplers[b] and is handed to on_dream when it stops; with the same
+ *        seed it produces the same tokens as generate(). Lights no LEDs, so it
+ *        can run while another dream is being animated.
+ */
+void generate_batch(Transformer *transformer, Tokenizer *tokenizer, Sampler *samplers, int batch,
+                    char *prompt, int steps, dream_ready_cb on_dream, void *arg);
+
+/**
+ * A generation in progress, resumable at token boundaries: what
+ * generate_batch() and generate() run to completion, and, at batch 1, an
+ * LlmSession. It holds the position, the tokens, texts and LED trails so far.
+ * The KV caches are transformer->batch[] unless the session owns its state,
+ * and the sampler state is in samplers[], so nothing else may run those until
+ * the session ends. A paused session resumes exactly where it stopped, with
+ * the same tokens as an uninterrupted one and no token computed twice.
+ */
+typedef struct {
+    Transformer *transformer;
+    Tokenizer *tokenizer;
+    LlmWorkers *workers;    // split forward, or NULL for the calling core only
+    Sampler *samplers;
+    int batch;
+    char *prompt;
+    int steps;
+    int live;               // light the LEDs and print the text as it comes
+    dream_ready_cb on_dream;
+    void *arg;
+    RunState *states[LLM_MAX_BATCH];
+    RunState *own_state;    // an LlmSession's state, freed with it
+    int *prompt_tokens;
+    int num_prompt_tokens;
+    char *text[LLM_MAX_BATCH];
+    size_t text_len[LLM_MAX_BATCH];
+    int token[LLM_MAX_BATCH];
+    int length[LLM_MAX_BATCH];
+    bool in_sentence[LLM_MAX_BATCH];
+    struct LedTrail *trail;
+    int seq[LLM_MAX_BATCH]; // sequences still running, all at pos
+    int n_active;
+    int pos;
+    long start;             // ms, after the first step
+    long paused_at;         // ms, 0 while running
+    long paused_ms;         // left out of the tokens/s
+    int yields;
+    GenerateStats stats;    // updated at every step
+} GenSession;
+
+// asked at every token boundary of gen_session_run(); true pauses the session
+typedef bool (*gen_yield_fn)(void *arg);
+
+/**
+ * @brief Starts a session with the arguments of generate_batch(); no token yet
+ */
+void gen_session_begin(GenSession *s, Transformer *transformer, Tokenizer *tokenizer, Sampler *samplers,
+                       int batch, char *prompt, int steps, dream_ready_cb on_dream, void *arg);
+/**
+ * @brief One token for every running sequence
+ * @return false if the session was already done
+ */
+bool gen_session_step(GenSession *s);
+/**
+ * @brief Steps until the session is done or should_yield (may be NULL) returns
+ *        true; call again to resume
+ * @return true when done, false when it yielded
+ */
+bool gen_session_run(GenSession *s, gen_yield_fn should_yield, void *arg);
+bool gen_session_done(const GenSession *s);
+/**
+ * @brief Sets llm_last_stats(), logs and frees; the session may be unfinished
+ */
+void gen_session_end(GenSession *s);
+
+/**
+ * A loaded model that any number of sessions generate from. The weights,
+ * config and tokenizer are only read once built; each session brings its
+ * own activations, KV cache, sampler, text and stats. What a context does
+ * not hold is shared by all of them: llm_kernels_active, the llm_math
+ * fast/libm switch and the llm_prof counters.
+ */
+typedef struct {
+    Transformer *transformer;
+    Tokenizer *tokenizer;
+} LlmContext;
+
+typedef enum {
+    LLM_EXEC_SPLIT, // both cores on every token, through the transformer's workers: one session at a time
+    LLM_EXEC_LOCAL, // the calling core only: sessions on different cores step concurrently
+} LlmExec;
+
+/**
+ * One dream generated token by token: a GenSession of batch 1 with its own
+ * activations and KV cache. Sessions of the same context are independent:
+ * they can be interleaved, or stepped from different tasks when they run
+ * LLM_EXEC_LOCAL. The kernel backend, the fast-math switch and the profiler
+ * counters stay process-wide.
+ */
+typedef GenSession LlmSession;
+
+void llm_context_init(LlmContext *ctx, Transformer *transformer, Tokenizer *tokenizer);
+/**
+ * @brief Starts a dream from prompt (NULL for none) that stops at a sentence
+ *        end past 80% of steps, like generate_batch()
+ * @return NULL if out of memory or the prompt does not encode, with nothing
+ *         left allocated, or for LLM_EXEC_LOCAL with streamed weights, whose
+ *         slots only the split forward drives
+ */
+LlmSession *llm_session_create(const LlmContext *ctx, Sampler *sampler, char *prompt, int steps, LlmExec exec);
+/**
+ * @brief Generates the next token and appends it to the text
+ * @return The token, or -1 once the dream is over
+ */
+int llm_session_step(LlmSession *s);
+const char *llm_session_text(const LlmSession *s);
+/**
+ * @brief The LEDs the dream lit so far, for whoever shows it to replay
+ */
+const DreamTrail *llm_session_trail(const LlmSession *s);
+void llm_session_destroy(LlmSession *s);
+const GenerateStats *llm_last_stats(const Transformer *transformer);
 void free_sampler(Sampler* sampler);
 void free_transformer(Transformer* t);
 void free_tokenizer(Tokenizer* t);
 
+// building blocks, exposed for the host benchmark (host/llm_bench.c)
+void rmsnorm(v4sf *o, v4sf *x, v4sf *weight, int size);
+void residual_rmsnorm(v4sf *o, v4sf *x, v4sf *delta, v4sf *weight, int size);
+void softmax(v4sf *x, int size);
+// split with the workers, or all on the calling core when they are NULL
+void matmul(LlmWorkers *workers, v4sf *xout, v4sf *x, v4sf *w, int n, int d);
+void matmul_tiled(LlmWorkers *workers, v4sf *xout, v4sf *x, v4sf *w, int n, int d);
+void matmul_local(v4sf *xout, v4sf *x, v4sf *w, int tiled, int n, int d);
+void matmul_swiglu(LlmWorkers *workers, v4sf *xout, v4sf *x, v4sf *w1, v4sf *w3, int tiled, int n, int d);
+void repack_tiled(v4sf *w, int n, int rows);
+// attention_three_pass() unless CONFIG_LLM_ATTN_ONLINE selects attention_online()
+void attention(RunState *s, Config *p, int loff, int pos, int h_start, int h_end);
+void attention_three_pass(RunState *s, Config *p, int loff, int pos, int h_start, int h_end);
+void attention_online(RunState *s, Config *p, int loff, int pos, int h_start, int h_end);
+v4sf *forward(Transformer *transformer, int token, int pos);
+void forward_batch(Transformer *transformer, RunState *const *states, const int *tokens, int pos, int batch);
+void encode(Tokenizer *t, char *text, int8_t bos, int8_t eos, int *tokens, int *n_tokens);
+const char *decode(Tokenizer *t, int prev_token, int token);
+int sample(Sampler *sampler, v4sf *logits);
+
 
 #endif
\ No newline at end of file
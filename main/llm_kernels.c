@@ -0,0 +1,385 @@
+#include "llm_kernels.h"
+#include "llm_port.h"
+#include "llm_math.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const char *TAG = "LLM_KERNELS";
+
+// ----------------------------------------------------------------------------
+// reference: the obvious loop for every kernel, libm for exp and sqrt
+
+static void ref_dot(const float *a, const float *b, float *out, int n)
+{
+    float acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += a[i] * b[i];
+    }
+    *out = acc;
+}
+
+static void ref_gemv(float *xout, const float *x, const float *w, int tiled, int n, int rows)
+{
+    for (int r = 0; r < rows; r++) {
+        float acc = 0.0f;
+        for (int j = 0; j < n; j++) {
+            // tile r / 4 holds column j of its four rows side by side
+            float wrj = tiled ? w[(r / LLM_TILE_ROWS) * LLM_TILE_ROWS * n + j * LLM_TILE_ROWS + r % LLM_TILE_ROWS]
+                              : w[r * n + j];
+            acc += wrj * x[j];
+        }
+        xout[r] = acc;
+    }
+}
+
+static void ref_axpy(float *y, float a, const float *x, int n)
+{
+    for (int i = 0; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static void ref_softmax(float *x, int n)
+{
+    float max_val = x[0];
+    for (int i = 1; i < n; i++) {
+        if (x[i] > max_val) {
+            max_val = x[i];
+        }
+    }
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++) {
+        x[i] = expf(x[i] - max_val);
+        sum += x[i];
+    }
+    for (int i = 0; i < n; i++) {
+        x[i] /= sum;
+    }
+}
+
+static void ref_rmsnorm(float *o, const float *x, const float *weight, int n)
+{
+    float ss = 0.0f;
+    for (int j = 0; j < n; j++) {
+        ss += x[j] * x[j];
+    }
+    ss = 1.0f / sqrtf(ss / n + 1e-5f);
+    for (int j = 0; j < n; j++) {
+        o[j] = weight[j] * (ss * x[j]);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// shared by esp-dsp and optimized
+
+// one pass over x per tile: x[j] is loaded once for four rows. Even and odd
+// columns go to separate accumulators, so eight multiply-adds are independent
+// and the FPU pipeline never waits on the previous sum
+static inline void dot_tile(const float *tile, const float *x, int n, float *out)
+{
+    float a0 = 0.0f, a1 = 0.0f, a2 = 0.0f, a3 = 0.0f;
+    float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f, b3 = 0.0f;
+    int j = 0;
+    for (; j + 2 <= n; j += 2) {
+        float x0 = x[j];
+        float x1 = x[j + 1];
+        a0 += tile[0] * x0;
+        a1 += tile[1] * x0;
+        a2 += tile[2] * x0;
+        a3 += tile[3] * x0;
+        b0 += tile[4] * x1;
+        b1 += tile[5] * x1;
+        b2 += tile[6] * x1;
+        b3 += tile[7] * x1;
+        tile += 2 * LLM_TILE_ROWS;
+    }
+    if (j < n) {
+        a0 += tile[0] * x[j];
+        a1 += tile[1] * x[j];
+        a2 += tile[2] * x[j];
+        a3 += tile[3] * x[j];
+    }
+    out[0] = a0 + b0;
+    out[1] = a1 + b1;
+    out[2] = a2 + b2;
+    out[3] = a3 + b3;
+}
+
+static void gemv_tiled(float *xout, const float *x, const float *w, int n, int rows)
+{
+    for (int r = 0; r < rows; r += LLM_TILE_ROWS) {
+        dot_tile(&w[r * n], x, n, &xout[r]);
+    }
+}
+
+static void fast_softmax(float *x, int n)
+{
+    // max, exp and sum, then one multiply by 1/sum; fast or libm exp per llm_math
+    llm_softmax(x, n);
+}
+
+static void fast_rmsnorm(float *o, const float *x, const float *weight, int n)
+{
+    float ss = llm_inv_sqrt(llm_sum_squares(x, n) / n + 1e-5f);
+    for (int j = 0; j < n; j++) {
+        o[j] = weight[j] * (ss * x[j]);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// esp-dsp: one dsps_dotprod_f32_aes3 call per row
+
+static void dsp_dot(const float *a, const float *b, float *out, int n)
+{
+    llm_dotprod_f32(a, b, out, n);
+}
+
+static void dsp_gemv(float *xout, const float *x, const float *w, int tiled, int n, int rows)
+{
+    if (tiled) {
+        // esp-dsp has no interleaved kernel
+        gemv_tiled(xout, x, w, n, rows);
+        return;
+    }
+    for (int r = 0; r < rows; r++) {
+        llm_dotprod_f32(&w[r * n], x, &xout[r], n);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// optimized: the S3 FPU has no float SIMD, but madd.s on independent
+// accumulators issues every cycle, a dependent chain only every few
+
+static void opt_dot(const float *a, const float *b, float *out, int n)
+{
+    float a0 = 0.0f, a1 = 0.0f, a2 = 0.0f, a3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a0 += a[i] * b[i];
+        a1 += a[i + 1] * b[i + 1];
+        a2 += a[i + 2] * b[i + 2];
+        a3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++) {
+        a0 += a[i] * b[i];
+    }
+    *out = (a0 + a1) + (a2 + a3);
+}
+
+static void opt_gemv(float *xout, const float *x, const float *w, int tiled, int n, int rows)
+{
+    if (tiled) {
+        gemv_tiled(xout, x, w, n, rows);
+        return;
+    }
+    // four rows per pass over x, as in dot_tile() but with strided rows
+    int r = 0;
+    for (; r + 4 <= rows; r += 4) {
+        const float *w0 = &w[r * n];
+        const float *w1 = w0 + n;
+        const float *w2 = w1 + n;
+        const float *w3 = w2 + n;
+        float a0 = 0.0f, a1 = 0.0f, a2 = 0.0f, a3 = 0.0f;
+        for (int j = 0; j < n; j++) {
+            float xj = x[j];
+            a0 += w0[j] * xj;
+            a1 += w1[j] * xj;
+            a2 += w2[j] * xj;
+            a3 += w3[j] * xj;
+        }
+        xout[r] = a0;
+        xout[r + 1] = a1;
+        xout[r + 2] = a2;
+        xout[r + 3] = a3;
+    }
+    for (; r < rows; r++) {
+        opt_dot(&w[r * n], x, &xout[r], n);
+    }
+}
+
+static void opt_axpy(float *y, float a, const float *x, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float y0 = y[i] + a * x[i];
+        float y1 = y[i + 1] + a * x[i + 1];
+        float y2 = y[i + 2] + a * x[i + 2];
+        float y3 = y[i + 3] + a * x[i + 3];
+        y[i] = y0;
+        y[i + 1] = y1;
+        y[i + 2] = y2;
+        y[i + 3] = y3;
+    }
+    for (; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+static const llm_kernels_t backends[LLM_KERNELS_COUNT] = {
+    [LLM_KERNELS_REFERENCE] = {"reference", ref_dot, ref_gemv, ref_axpy, ref_softmax, ref_rmsnorm},
+    [LLM_KERNELS_ESP_DSP] = {"esp-dsp", dsp_dot, dsp_gemv, ref_axpy, fast_softmax, fast_rmsnorm},
+    [LLM_KERNELS_OPTIMIZED] = {"optimized", opt_dot, opt_gemv, opt_axpy, fast_softmax, fast_rmsnorm},
+};
+
+#if CONFIG_LLM_KERNELS_REFERENCE
+#define LLM_KERNELS_DEFAULT LLM_KERNELS_REFERENCE
+#elif CONFIG_LLM_KERNELS_OPTIMIZED
+#define LLM_KERNELS_DEFAULT LLM_KERNELS_OPTIMIZED
+#else
+#define LLM_KERNELS_DEFAULT LLM_KERNELS_ESP_DSP
+#endif
+
+const llm_kernels_t *llm_kernels_active = &backends[LLM_KERNELS_DEFAULT];
+
+const llm_kernels_t *llm_kernels_get(llm_kernels_id_t id)
+{
+    return id >= 0 && id < LLM_KERNELS_COUNT ? &backends[id] : NULL;
+}
+
+int llm_kernels_select(llm_kernels_id_t id)
+{
+    const llm_kernels_t *k = llm_kernels_get(id);
+    if (!k) {
+        return -1;
+    }
+    llm_kernels_active = k;
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// self-test
+
+// the largest shapes of the 260K model: hidden_dim 172, vocab 512
+#define TEST_MAX_N 512
+#define TEST_MAX_GEMV (172 * 64)
+
+static uint32_t test_rng;
+
+static void fill_uniform(float *x, int n, float scale)
+{
+    for (int i = 0; i < n; i++) {
+        // xorshift32, so the inputs are the same on every run and platform
+        test_rng ^= test_rng << 13;
+        test_rng ^= test_rng >> 17;
+        test_rng ^= test_rng << 5;
+        x[i] = ((float)(test_rng >> 8) / (1u << 24) * 2.0f - 1.0f) * scale;
+    }
+}
+
+// worst |got - want| / (1 + |want|)
+static float worst_error(const float *want, const float *got, int n)
+{
+    float worst = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float e = fabsf(got[i] - want[i]) / (1.0f + fabsf(want[i]));
+        // a NaN compares false, so it has to be caught explicitly
+        worst = e > worst || e != e ? e : worst;
+    }
+    return worst;
+}
+
+static int check(const llm_kernels_t *k, const char *op, int n, float err, float tol)
+{
+    if (err <= tol) {
+        return 0;
+    }
+    ESP_LOGE(TAG, "%s %s n=%d: error %.3g over tolerance %.3g", k->name, op, n, err, tol);
+    return 1;
+}
+
+int llm_kernels_self_test(llm_kernels_id_t id)
+{
+    const llm_kernels_t *k = llm_kernels_get(id);
+    const llm_kernels_t *ref = &backends[LLM_KERNELS_REFERENCE];
+    if (!k) {
+        return 1;
+    }
+    float *a = malloc(TEST_MAX_N * sizeof(float));
+    float *b = malloc(TEST_MAX_N * sizeof(float));
+    float *want = malloc(TEST_MAX_N * sizeof(float));
+    float *got = malloc(TEST_MAX_N * sizeof(float));
+    float *w = malloc(TEST_MAX_GEMV * sizeof(float));
+    if (!a || !b || !want || !got || !w) {
+        ESP_LOGE(TAG, "self-test: out of memory");
+        free(a);
+        free(b);
+        free(want);
+        free(got);
+        free(w);
+        return 1;
+    }
+    test_rng = 0x2545F491u;
+    int failed = 0;
+
+    // summation order differs between backends, so dot products get a bound
+    // that grows with n; the elementwise kernels only see llm_math's error
+    static const int lengths[] = {1, 3, 7, 16, 64, 172, 512};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        int n = lengths[i];
+        float dot_tol = 1e-5f + 1e-6f * n;
+        fill_uniform(a, n, 1.0f);
+        fill_uniform(b, n, 1.0f);
+        ref->dot(a, b, &want[0], n);
+        k->dot(a, b, &got[0], n);
+        failed += check(k, "dot", n, worst_error(want, got, 1), dot_tol);
+
+        memcpy(want, b, n * sizeof(float));
+        memcpy(got, b, n * sizeof(float));
+        ref->axpy(want, 0.37f, a, n);
+        k->axpy(got, 0.37f, a, n);
+        failed += check(k, "axpy", n, worst_error(want, got, n), 1e-6f);
+
+        // logits of a few units, like the classifier output
+        fill_uniform(want, n, 8.0f);
+        memcpy(got, want, n * sizeof(float));
+        ref->softmax(want, n);
+        k->softmax(got, n);
+        failed += check(k, "softmax", n, worst_error(want, got, n), 1e-5f);
+
+        fill_uniform(a, n, 2.0f);
+        ref->rmsnorm(want, a, b, n);
+        k->rmsnorm(got, a, b, n);
+        failed += check(k, "rmsnorm", n, worst_error(want, got, n), 1e-5f);
+    }
+
+    // (n, rows) of wq, w1, w2 and an odd shape; rows stay multiples of 4 for the tiled pass
+    static const int shapes[][2] = {{64, 64}, {64, 172}, {172, 64}, {7, 8}};
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        int n = shapes[i][0], rows = shapes[i][1];
+        float dot_tol = 1e-5f + 1e-6f * n;
+        fill_uniform(w, n * rows, 1.0f);
+        fill_uniform(a, n, 1.0f);
+        for (int tiled = 0; tiled < 2; tiled++) {
+            ref->gemv(want, a, w, tiled, n, rows);
+            k->gemv(got, a, w, tiled, n, rows);
+            failed += check(k, tiled ? "gemv tiled" : "gemv", n, worst_error(want, got, rows), dot_tol);
+        }
+        // a row count that is not a multiple of 4 exercises the tail of row-major kernels
+        ref->gemv(want, a, w, 0, n, rows - 1);
+        k->gemv(got, a, w, 0, n, rows - 1);
+        failed += check(k, "gemv", n, worst_error(want, got, rows - 1), dot_tol);
+    }
+
+    free(a);
+    free(b);
+    free(want);
+    free(got);
+    free(w);
+    return failed;
+}
+
+void llm_kernels_init(void)
+{
+    llm_kernels_select(LLM_KERNELS_DEFAULT);
+#if CONFIG_LLM_KERNEL_SELF_TEST
+    if (LLM_KERNELS_DEFAULT != LLM_KERNELS_REFERENCE && llm_kernels_self_test(LLM_KERNELS_DEFAULT) != 0) {
+        ESP_LOGE(TAG, "%s kernels disagree with the reference, falling back to it",
+                 llm_kernels_active->name);
+        llm_kernels_select(LLM_KERNELS_REFERENCE);
+    }
+#endif
+    ESP_LOGI(TAG, "Kernel backend: %s", llm_kernels_active->name);
+}
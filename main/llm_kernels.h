@@ -0,0 +1,76 @@
+#ifndef LLM_KERNELS_H
+#define LLM_KERNELS_H
+
+/**
+ * Kernel dispatch table for the transformer step.
+ *
+ * forward() and attention() reach the dense math only through the active
+ * backend, so a faster kernel can be tried without touching the model code:
+ *
+ *   reference   plain scalar C with libm; the yardstick, never the fastest
+ *   esp-dsp     dsps_dotprod_f32_aes3 per row (a scalar loop on the host),
+ *               tiled matrices and the elementwise kernels as in "optimized"
+ *   optimized   C written for the S3 FPU: independent accumulators so madd.s
+ *               pipelines, 4 rows per pass over x, llm_math approximations
+ *
+ * CONFIG_LLM_KERNELS_* picks the backend at build time; llm_kernels_select()
+ * switches at run time. llm_kernels_self_test() cross-checks a backend against
+ * the reference on random inputs and runs at boot with
+ * CONFIG_LLM_KERNEL_SELF_TEST, falling back to the reference on a mismatch.
+ */
+
+// output rows interleaved per tile by repack_tiled()
+#define LLM_TILE_ROWS 4
+
+typedef enum {
+    LLM_KERNELS_REFERENCE,
+    LLM_KERNELS_ESP_DSP,
+    LLM_KERNELS_OPTIMIZED,
+    LLM_KERNELS_COUNT,
+} llm_kernels_id_t;
+
+typedef struct {
+    const char *name;
+    // *out = sum(a[i] * b[i])
+    void (*dot)(const float *a, const float *b, float *out, int n);
+    // xout[r] = row r of w times x for r < rows; tiled w is in the layout of
+    // repack_tiled() and rows a multiple of LLM_TILE_ROWS
+    void (*gemv)(float *xout, const float *x, const float *w, int tiled, int n, int rows);
+    // y[i] += a * x[i]
+    void (*axpy)(float *y, float a, const float *x, int n);
+    // in place
+    void (*softmax)(float *x, int n);
+    // o[i] = weight[i] * x[i] / sqrt(mean(x^2) + 1e-5); o may alias x
+    void (*rmsnorm)(float *o, const float *x, const float *weight, int n);
+} llm_kernels_t;
+
+/**
+ * @brief The backend in use; never NULL
+ */
+extern const llm_kernels_t *llm_kernels_active;
+
+/**
+ * @brief Returns the table of a backend, NULL for an unknown id
+ */
+const llm_kernels_t *llm_kernels_get(llm_kernels_id_t id);
+
+/**
+ * @brief Makes a backend the active one
+ * @return 0 on success, -1 for an unknown id
+ */
+int llm_kernels_select(llm_kernels_id_t id);
+
+/**
+ * @brief Compares every kernel of a backend with the reference on random
+ *        inputs of the model's shapes and logs the mismatches
+ * @return Number of kernels out of tolerance, 0 if the backend is usable
+ */
+int llm_kernels_self_test(llm_kernels_id_t id);
+
+/**
+ * @brief Selects the configured backend and, with CONFIG_LLM_KERNEL_SELF_TEST,
+ *        checks it first; a failing backend is replaced by the reference
+ */
+void llm_kernels_init(void);
+
+#endif // LLM_KERNELS_H
@@ -0,0 +1,154 @@
+#include "llm_math.h"
+
+#if CONFIG_LLM_FAST_MATH
+static int libm_enabled = 0;
+#else
+static int libm_enabled = 1;
+#endif
+
+void llm_math_use_libm(int use_libm)
+{
+    libm_enabled = use_libm;
+}
+
+int llm_math_is_libm(void)
+{
+    return libm_enabled;
+}
+
+float llm_vmax(const float *x, int n)
+{
+    float m0 = x[0], m1 = x[0], m2 = x[0], m3 = x[0];
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        m0 = x[i] > m0 ? x[i] : m0;
+        m1 = x[i + 1] > m1 ? x[i + 1] : m1;
+        m2 = x[i + 2] > m2 ? x[i + 2] : m2;
+        m3 = x[i + 3] > m3 ? x[i + 3] : m3;
+    }
+    for (; i < n; i++) {
+        m0 = x[i] > m0 ? x[i] : m0;
+    }
+    m0 = m1 > m0 ? m1 : m0;
+    m2 = m3 > m2 ? m3 : m2;
+    return m2 > m0 ? m2 : m0;
+}
+
+float llm_exp_sum(float *x, float shift, int n)
+{
+    if (libm_enabled) {
+        for (int i = 0; i < n; i++) {
+            x[i] = expf(x[i] - shift);
+        }
+    } else {
+        // exp and sum stay separate loops: the exp loop has no loop-carried
+        // dependency, the sum loop runs on four independent accumulators
+        for (int i = 0; i < n; i++) {
+            x[i] = llm_expf(x[i] - shift);
+        }
+    }
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += x[i];
+        s1 += x[i + 1];
+        s2 += x[i + 2];
+        s3 += x[i + 3];
+    }
+    for (; i < n; i++) {
+        s0 += x[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+void llm_softmax(float *x, int n)
+{
+    llm_vscale(x, 1.0f / llm_exp_sum(x, llm_vmax(x, n), n), n);
+}
+
+float llm_sum_squares(const float *x, int n)
+{
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += x[i] * x[i];
+        s1 += x[i + 1] * x[i + 1];
+        s2 += x[i + 2] * x[i + 2];
+        s3 += x[i + 3] * x[i + 3];
+    }
+    for (; i < n; i++) {
+        s0 += x[i] * x[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+float llm_residual_sum_squares(float *x, const float *delta, int n)
+{
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float v0 = x[i] + delta[i];
+        float v1 = x[i + 1] + delta[i + 1];
+        float v2 = x[i + 2] + delta[i + 2];
+        float v3 = x[i + 3] + delta[i + 3];
+        x[i] = v0;
+        x[i + 1] = v1;
+        x[i + 2] = v2;
+        x[i + 3] = v3;
+        s0 += v0 * v0;
+        s1 += v1 * v1;
+        s2 += v2 * v2;
+        s3 += v3 * v3;
+    }
+    for (; i < n; i++) {
+        x[i] += delta[i];
+        s0 += x[i] * x[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+float llm_exp(float x)
+{
+    return libm_enabled ? expf(x) : llm_expf(x);
+}
+
+float llm_inv_sqrt(float x)
+{
+    return libm_enabled ? 1.0f / sqrtf(x) : llm_rsqrtf(x);
+}
+
+float llm_silu(float x)
+{
+    return libm_enabled ? x * (1.0f / (1.0f + expf(-x))) : x * llm_sigmoidf(x);
+}
+
+void llm_swiglu(float *hb, const float *hb2, int n)
+{
+    if (libm_enabled) {
+        for (int i = 0; i < n; i++) {
+            float val = hb[i];
+            // silu(x)=x*σ(x), where σ(x) is the logistic sigmoid
+            val *= (1.0f / (1.0f + expf(-val)));
+            // elementwise multiply with w3(x)
+            hb[i] = val * hb2[i];
+        }
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        hb[i] = hb[i] * llm_sigmoidf(hb[i]) * hb2[i];
+    }
+}
+
+void llm_vscale(float *x, float scale, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        x[i] *= scale;
+        x[i + 1] *= scale;
+        x[i + 2] *= scale;
+        x[i + 3] *= scale;
+    }
+    for (; i < n; i++) {
+        x[i] *= scale;
+    }
+}
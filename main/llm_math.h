@@ -0,0 +1,137 @@
+#ifndef LLM_MATH_H
+#define LLM_MATH_H
+
+/**
+ * Fast elementwise math for the transformer step (softmax, rmsnorm, SwiGLU,
+ * sampling).
+ *
+ * Error bounds, measured against double precision (host/llm_bench.c):
+ *   llm_expf      relative error < 4e-6, input clamped to [-87, 88]
+ *   llm_sigmoidf  absolute error < 1e-6
+ *   llm_rsqrtf    relative error < 5e-6 (bit-trick seed + two Newton steps)
+ *
+ * The vector helpers are branch-free loops, and reductions run on four
+ * independent accumulators. The S3 FPU has no float SIMD, but it pipelines
+ * independent madd.s, which is what the unrolling buys; on the host the same
+ * loops auto-vectorize 4 floats at a time.
+ *
+ * CONFIG_LLM_FAST_MATH selects the approximations by default; llm_math_use_libm()
+ * switches every helper back to libm at run time for accuracy comparisons.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define LLM_LOG2E  1.44269504f
+#define LLM_LN2_HI 0.693145752f
+#define LLM_LN2_LO 1.42860677e-6f
+#define LLM_ROUND_MAGIC 12582912.0f
+
+// e^x for x in [-87, 88], no range checks
+static inline float llm_expf_core(float x)
+{
+    // x = n * ln2 + r with |r| <= ln2 / 2, then e^x = 2^n * e^r; adding 1.5 * 2^23
+    // rounds x * log2(e) to the nearest integer and leaves it in the low mantissa bits
+    float fn = x * LLM_LOG2E + LLM_ROUND_MAGIC;
+    uint32_t n_bits;
+    memcpy(&n_bits, &fn, sizeof(n_bits));
+    fn -= LLM_ROUND_MAGIC;
+    float r = x - fn * LLM_LN2_HI - fn * LLM_LN2_LO;
+    float p = 1.0f + r * (1.0f + r * (0.5f + r * (1.0f / 6 + r * (1.0f / 24 + r * (1.0f / 120)))));
+    uint32_t bits = (n_bits - 0x4B400000u + 127u) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+static inline float llm_expf(float x)
+{
+    x = x < -87.0f ? -87.0f : x;
+    x = x > 88.0f ? 88.0f : x;
+    return llm_expf_core(x);
+}
+
+static inline float llm_sigmoidf(float x)
+{
+    // beyond +-30 the result is within 1e-13 of 0 or 1. Clamping here rather
+    // than in llm_expf() matters: GCC folds a clamped lane into x * sigmoid(-88),
+    // a denormal, which stalls the vectorized SwiGLU loop
+    x = x < -30.0f ? -30.0f : x;
+    x = x > 30.0f ? 30.0f : x;
+    return 1.0f / (1.0f + llm_expf_core(-x));
+}
+
+static inline float llm_rsqrtf(float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5f3759df - (bits >> 1);
+    float y;
+    memcpy(&y, &bits, sizeof(y));
+    float half = 0.5f * x;
+    y = y * (1.5f - half * y * y);
+    y = y * (1.5f - half * y * y);
+    return y;
+}
+
+/**
+ * @brief Switches all helpers between the approximations and libm
+ * @param use_libm Non-zero to use expf()/sqrtf(), zero for the fast versions
+ */
+void llm_math_use_libm(int use_libm);
+int llm_math_is_libm(void);
+
+/**
+ * @brief Returns max(x[i])
+ */
+float llm_vmax(const float *x, int n);
+
+/**
+ * @brief x[i] = e^(x[i] - shift) with the selected implementation
+ * @return sum(x[i]) of the result
+ */
+float llm_exp_sum(float *x, float shift, int n);
+
+/**
+ * @brief In-place softmax: max, exp and sum, then one multiply by 1/sum
+ */
+void llm_softmax(float *x, int n);
+
+/**
+ * @brief Returns sum(x[i]^2)
+ */
+float llm_sum_squares(const float *x, int n);
+
+/**
+ * @brief Residual add fused with the rmsnorm reduction: x[i] += delta[i]
+ * @return sum(x[i]^2) of the updated x
+ */
+float llm_residual_sum_squares(float *x, const float *delta, int n);
+
+/**
+ * @brief Returns e^x with the selected implementation
+ */
+float llm_exp(float x);
+
+/**
+ * @brief Returns 1/sqrt(x) with the selected implementation
+ */
+float llm_inv_sqrt(float x);
+
+/**
+ * @brief Returns x * sigmoid(x) with the selected implementation
+ */
+float llm_silu(float x);
+
+/**
+ * @brief SwiGLU: hb[i] = silu(hb[i]) * hb2[i]
+ */
+void llm_swiglu(float *hb, const float *hb2, int n);
+
+/**
+ * @brief x[i] *= scale
+ */
+void llm_vscale(float *x, float scale, int n);
+
+#endif // LLM_MATH_H
@@ -0,0 +1,117 @@
+#include "llm_placement.h"
+#include <stdlib.h>
+#include <string.h>
+#include "llm_port.h"
+
+static const char *TAG = "PLACEMENT";
+
+// internal RAM the plan never takes, for Wi-Fi, the HTTP server and task stacks
+#define SRAM_RESERVE (48 * 1024)
+
+#ifndef CONFIG_LLM_SRAM_BUDGET_KB
+#define CONFIG_LLM_SRAM_BUDGET_KB 0
+#endif
+
+size_t llm_placement_budget(void)
+{
+#if CONFIG_LLM_PLACEMENT_PLANNED
+    size_t budget = (size_t)CONFIG_LLM_SRAM_BUDGET_KB * 1024;
+    size_t free_internal = llm_port_free_internal();
+    size_t available = free_internal > SRAM_RESERVE ? free_internal - SRAM_RESERVE : 0;
+    return budget < available ? budget : available;
+#else
+    return 0;
+#endif
+}
+
+static int compare_rank(const void *a, const void *b)
+{
+    const llm_placement_entry_t *ea = a;
+    const llm_placement_entry_t *eb = b;
+    if (ea->kind != eb->kind) {
+        return ea->kind < eb->kind ? -1 : 1;
+    }
+    if (ea->reads_per_byte != eb->reads_per_byte) {
+        return ea->reads_per_byte > eb->reads_per_byte ? -1 : 1;
+    }
+    // equally hot: the smaller tensor first, more of them fit
+    return ea->size < eb->size ? -1 : ea->size > eb->size;
+}
+
+size_t llm_placement_plan(llm_placement_entry_t *entries, int n, size_t sram_budget)
+{
+    qsort(entries, n, sizeof(*entries), compare_rank);
+    size_t used = 0;
+    for (int i = 0; i < n; i++) {
+        // first fit: a big tensor that doesn't fit doesn't stop smaller, colder ones
+        if (used + entries[i].size <= sram_budget) {
+            entries[i].tier = LLM_TIER_SRAM;
+            used += entries[i].size;
+        } else {
+            entries[i].tier = LLM_TIER_PSRAM;
+        }
+    }
+    return used;
+}
+
+int llm_placement_apply(llm_placement_entry_t *entries, int n)
+{
+    for (int i = 0; i < n; i++) {
+        llm_placement_entry_t *e = &entries[i];
+        void *src = *e->ptr;
+        if (e->tier == LLM_TIER_PSRAM && src) {
+            continue; // weights stay where the checkpoint was loaded
+        }
+        void *buf = NULL;
+        if (e->tier == LLM_TIER_SRAM) {
+            buf = llm_port_malloc_internal(e->size);
+            if (!buf) {
+                ESP_LOGW(TAG, "%s: no internal RAM for %u bytes, using PSRAM", e->name, (unsigned)e->size);
+                e->tier = LLM_TIER_PSRAM;
+                if (src) {
+                    continue;
+                }
+            }
+        }
+        if (!buf) {
+            buf = llm_port_malloc_external(e->size);
+        }
+        if (!buf) {
+            ESP_LOGE(TAG, "%s: allocation of %u bytes failed", e->name, (unsigned)e->size);
+            return -1;
+        }
+        if (src) {
+            memcpy(buf, src, e->size);
+        } else {
+            memset(buf, 0, e->size);
+        }
+        *e->ptr = buf;
+        e->allocated = 1;
+    }
+    return 0;
+}
+
+void llm_placement_log(const llm_placement_entry_t *entries, int n)
+{
+    size_t totals[2] = {0, 0};
+    ESP_LOGI(TAG, "%-16s %8s %10s  %s", "tensor", "bytes", "reads/B", "tier");
+    for (int i = 0; i < n; i++) {
+        const llm_placement_entry_t *e = &entries[i];
+        ESP_LOGI(TAG, "%-16s %8u %10.3f  %s", e->name, (unsigned)e->size, e->reads_per_byte,
+                 e->tier == LLM_TIER_SRAM ? "SRAM" : "PSRAM");
+        totals[e->tier] += e->size;
+    }
+    ESP_LOGI(TAG, "SRAM %u bytes, PSRAM %u bytes", (unsigned)totals[LLM_TIER_SRAM],
+             (unsigned)totals[LLM_TIER_PSRAM]);
+}
+
+void llm_placement_release(llm_placement_entry_t *entries, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (entries[i].allocated) {
+            free(*entries[i].ptr);
+            *entries[i].ptr = NULL;
+            entries[i].allocated = 0;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef LLM_PLACEMENT_H
+#define LLM_PLACEMENT_H
+
+/**
+ * Memory placement planner for the transformer buffers.
+ *
+ * Every tensor (weight group, KV cache, activation) is described by its kind,
+ * its size and how often each of its bytes is read per generated token. The
+ * planner ranks activations first, then the KV cache, then the weights, and
+ * within a kind by that density. It fills internal SRAM in that order, within
+ * a budget; the rest goes to PSRAM. The KV cache ranks above the weights
+ * although fewer of its bytes are read per token: it is also written every
+ * token, and a PSRAM write costs a cache line writeback. Weights placed in SRAM are copied out of the
+ * checkpoint (which itself lives in PSRAM), activations are allocated zeroed.
+ *
+ * CONFIG_LLM_PLACEMENT_* picks the policy at build time:
+ *   PLANNED     ranked fill of CONFIG_LLM_SRAM_BUDGET_KB of internal SRAM
+ *   ALL_PSRAM   budget 0, the baseline for tokens/s comparisons
+ *   MALLOC      planner off, plain malloc/calloc decides (previous behaviour)
+ */
+
+#include <stddef.h>
+
+typedef enum {
+    LLM_TIER_SRAM,
+    LLM_TIER_PSRAM,
+} llm_tier_t;
+
+// in ranking order
+typedef enum {
+    LLM_KIND_ACTIVATION,
+    LLM_KIND_KV_CACHE,
+    LLM_KIND_WEIGHT,
+} llm_tensor_kind_t;
+
+typedef struct {
+    const char *name;
+    llm_tensor_kind_t kind;
+    void **ptr;             // the tensor pointer; weights point into the checkpoint, activations start NULL
+    size_t size;            // bytes
+    float reads_per_byte;   // expected reads of each byte per generated token
+    llm_tier_t tier;        // set by llm_placement_plan()
+    int allocated;          // buffer owned by the planner, released by llm_placement_release()
+} llm_placement_entry_t;
+
+/**
+ * @brief Returns the SRAM budget in bytes for the configured policy
+ */
+size_t llm_placement_budget(void);
+
+/**
+ * @brief Sorts entries by kind, then by reads_per_byte (densest first), and
+ *        assigns tiers
+ * @param sram_budget Bytes of internal SRAM the plan may use
+ * @return Bytes assigned to SRAM
+ */
+size_t llm_placement_plan(llm_placement_entry_t *entries, int n, size_t sram_budget);
+
+/**
+ * @brief Allocates every entry in its tier; SRAM entries that fail to allocate
+ *        fall back to PSRAM
+ * @return 0 on success, -1 if a buffer could not be allocated at all
+ */
+int llm_placement_apply(llm_placement_entry_t *entries, int n);
+
+/**
+ * @brief Logs the placement map, one line per tensor, and the totals per tier
+ */
+void llm_placement_log(const llm_placement_entry_t *entries, int n);
+
+/**
+ * @brief Frees the buffers the planner allocated
+ */
+void llm_placement_release(llm_placement_entry_t *entries, int n);
+
+#endif // LLM_PLACEMENT_H
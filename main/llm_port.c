@@ -0,0 +1,159 @@
+#include "llm_port.h"
+#include <stdlib.h>
+#include "esp_system.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "esp_async_memcpy.h"
+#include "esp32s3/rom/cache.h"
+
+llm_sem_t llm_sem_create(void)
+{
+    return xSemaphoreCreateBinary();
+}
+
+void llm_sem_give(llm_sem_t sem)
+{
+    xSemaphoreGive(sem);
+}
+
+void llm_sem_take(llm_sem_t sem)
+{
+    xSemaphoreTake(sem, portMAX_DELAY);
+}
+
+void llm_sem_delete(llm_sem_t sem)
+{
+    vSemaphoreDelete(sem);
+}
+
+void llm_task_exit(void)
+{
+    vTaskDelete(NULL);
+}
+
+int llm_task_create(llm_task_fn fn, const char *name, uint32_t stack_size, void *arg,
+                    int priority, int core, llm_task_t *out)
+{
+    BaseType_t ret = xTaskCreatePinnedToCore(fn, name, stack_size, arg, priority, out,
+                                             core < 0 ? tskNO_AFFINITY : core);
+    return ret == pdPASS ? 0 : -1;
+}
+
+uint32_t llm_port_random(void)
+{
+    return esp_random();
+}
+
+uint32_t llm_port_free_heap(void)
+{
+    return esp_get_free_heap_size();
+}
+
+void *llm_port_malloc_internal(size_t size)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+void *llm_port_malloc_external(size_t size)
+{
+    void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return ptr ? ptr : malloc(size);
+}
+
+void *llm_port_malloc_external_aligned(size_t size, size_t align)
+{
+    void *ptr = heap_caps_aligned_alloc(align, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return ptr ? ptr : heap_caps_aligned_alloc(align, size, MALLOC_CAP_8BIT);
+}
+
+size_t llm_port_free_internal(void)
+{
+    return heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+int llm_port_is_external(const void *ptr)
+{
+    return esp_ptr_external_ram(ptr);
+}
+
+static async_memcpy_handle_t memcpy_handle = NULL;
+
+static bool IRAM_ATTR memcpy_done_isr(async_memcpy_handle_t mcp, async_memcpy_event_t *event, void *arg)
+{
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR((SemaphoreHandle_t)arg, &woken);
+    return woken == pdTRUE;
+}
+
+int llm_port_memcpy_async(void *dst, const void *src, size_t len, llm_sem_t done)
+{
+    if (!memcpy_handle) {
+        async_memcpy_config_t config = ASYNC_MEMCPY_DEFAULT_CONFIG();
+        // GDMA reads PSRAM in cache-line bursts: src and len must be 64-byte aligned
+        config.psram_trans_align = 64;
+        config.sram_trans_align = 4;
+        if (esp_async_memcpy_install(&config, &memcpy_handle) != ESP_OK) {
+            memcpy_handle = NULL;
+            return -1;
+        }
+    }
+    if (esp_ptr_external_ram(src)) {
+        // the DMA bypasses the cache: anything written through it (tiling,
+        // streamed layers) has to reach PSRAM first
+        Cache_WriteBack_Addr((uint32_t)src, len);
+    }
+    return esp_async_memcpy(memcpy_handle, dst, (void *)src, len, memcpy_done_isr, done) == ESP_OK ? 0 : -1;
+}
+
+static const esp_partition_t *find_partition(const char *label)
+{
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+}
+
+int llm_port_map_partition(const char *label, const void **ptr, size_t *size, llm_map_t *handle)
+{
+    const esp_partition_t *part = find_partition(label);
+    if (!part ||
+        esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, ptr, handle) != ESP_OK) {
+        return -1;
+    }
+    *size = part->size;
+    return 0;
+}
+
+void llm_port_unmap_partition(llm_map_t handle)
+{
+    esp_partition_munmap(handle);
+}
+
+int llm_port_write_partition(const char *label, const void *data, size_t len)
+{
+    const esp_partition_t *part = find_partition(label);
+    if (!part || len > part->size) {
+        return -1;
+    }
+    size_t erase_size = (len + part->erase_size - 1) / part->erase_size * part->erase_size;
+    if (esp_partition_erase_range(part, 0, erase_size) != ESP_OK ||
+        esp_partition_write(part, 0, data, len) != ESP_OK) {
+        return -1;
+    }
+    return 0;
+}
+
+int llm_port_activate_node(int x, int y)
+{
+    int *coords = malloc(2 * sizeof(int));
+    if (coords == NULL) {
+        return -1;
+    }
+    coords[0] = x;
+    coords[1] = y;
+    xTaskCreate(activate_new_node_task, "activate_node", 2048, coords, 5, NULL);
+    return 0;
+}
+
+void llm_port_publish_output(const char *text)
+{
+    captive_portal_set_llm_output(text);
+}
@@ -0,0 +1,179 @@
+#ifndef LLM_PORT_H
+#define LLM_PORT_H
+
+/**
+ * Thin portability layer for the inference core (llm.c, tok_image.c).
+ *
+ * On the device everything maps onto FreeRTOS, esp-dsp and ESP-IDF services
+ * (llm_port.c). With LLM_HOST_BUILD defined the same core builds as a plain
+ * Linux library: pthreads stand in for pinned tasks and a scalar loop for the
+ * esp-dsp dot product (host/llm_port_host.c).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef LLM_HOST_BUILD
+
+#include <stdio.h>
+#include <time.h>
+
+typedef struct llm_sem *llm_sem_t;
+typedef struct llm_task *llm_task_t;
+typedef uint32_t llm_map_t;
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) do { } while (0)
+
+#ifndef MAX_LLM_OUTPUT
+#define MAX_LLM_OUTPUT 8192
+#endif
+#define MATRIX_ROWS 8
+#define MATRIX_COLS 8
+
+static inline void llm_dotprod_f32(const float *a, const float *b, float *out, int n)
+{
+    float acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += a[i] * b[i];
+    }
+    *out = acc;
+}
+
+// the host has no portable cycle counter; monotonic nanoseconds stand in for it
+static inline uint32_t llm_port_cycles(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+static inline uint32_t llm_port_cycles_per_us(void)
+{
+    return 1000;
+}
+
+#else
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_dsp.h"
+#include "esp_partition.h"
+#include "esp_cpu.h"
+#include "esp_private/esp_clk.h"
+#include "ws_matrix.h"
+#include "captive_portal.h"
+
+typedef SemaphoreHandle_t llm_sem_t;
+typedef TaskHandle_t llm_task_t;
+typedef esp_partition_mmap_handle_t llm_map_t;
+
+static inline void llm_dotprod_f32(const float *a, const float *b, float *out, int n)
+{
+    dsps_dotprod_f32_aes3(a, b, out, n);
+}
+
+static inline uint32_t llm_port_cycles(void)
+{
+    return esp_cpu_get_cycle_count();
+}
+
+static inline uint32_t llm_port_cycles_per_us(void)
+{
+    return esp_clk_cpu_freq() / 1000000;
+}
+
+#endif
+
+typedef void (*llm_task_fn)(void *arg);
+
+/**
+ * @brief Creates a binary semaphore, initially empty
+ */
+llm_sem_t llm_sem_create(void);
+void llm_sem_give(llm_sem_t sem);
+void llm_sem_take(llm_sem_t sem);
+/**
+ * @brief Frees a semaphore nobody waits on
+ */
+void llm_sem_delete(llm_sem_t sem);
+
+/**
+ * @brief Starts a worker task, pinned to a core where the platform supports it
+ * @return 0 on success
+ */
+int llm_task_create(llm_task_fn fn, const char *name, uint32_t stack_size, void *arg,
+                    int priority, int core, llm_task_t *out);
+/**
+ * @brief Ends the calling task: the last call of a task function that stops,
+ *        since a FreeRTOS task must not return
+ */
+void llm_task_exit(void);
+
+uint32_t llm_port_random(void);
+uint32_t llm_port_free_heap(void);
+
+/**
+ * @brief Allocates from fast internal RAM (falls back to malloc on the host)
+ */
+void *llm_port_malloc_internal(size_t size);
+
+/**
+ * @brief Allocates from PSRAM, or from any heap when there is none (malloc on the host)
+ */
+void *llm_port_malloc_external(size_t size);
+
+/**
+ * @brief Like llm_port_malloc_external(), with the start aligned to align bytes
+ *        (a power of two); release with free()
+ */
+void *llm_port_malloc_external_aligned(size_t size, size_t align);
+
+/**
+ * @brief Free bytes of internal RAM (SIZE_MAX on the host, which has a single tier)
+ */
+size_t llm_port_free_internal(void);
+
+/**
+ * @brief Non-zero if ptr is in PSRAM (always on the host, so its paths get exercised)
+ */
+int llm_port_is_external(const void *ptr);
+
+/**
+ * @brief Starts a copy in the background and gives done when it has finished:
+ *        async memcpy over GDMA on the S3, a copier thread on the host. One
+ *        copy at a time; wait for done before starting the next.
+ * @return 0 if the copy was started, -1 if the caller has to copy itself
+ *         (no DMA channel, or src/len not aligned for a PSRAM burst)
+ */
+int llm_port_memcpy_async(void *dst, const void *src, size_t len, llm_sem_t done);
+
+/**
+ * @brief Maps a raw data partition read-only
+ * @return 0 on success; always fails on the host, which has no partitions
+ */
+int llm_port_map_partition(const char *label, const void **ptr, size_t *size, llm_map_t *handle);
+void llm_port_unmap_partition(llm_map_t handle);
+
+/**
+ * @brief Erases a raw data partition and writes data at its start
+ * @return 0 on success
+ */
+int llm_port_write_partition(const char *label, const void *data, size_t len);
+
+/**
+ * @brief Lights up one LED of the matrix with the "new node" animation
+ * @return 0 if the animation was started
+ */
+int llm_port_activate_node(int x, int y);
+
+/**
+ * @brief Hands the text of a finished dream to the captive portal
+ */
+void llm_port_publish_output(const char *text);
+
+#endif // LLM_PORT_H
@@ -0,0 +1,108 @@
+#include "llm_prefetch.h"
+#include "llm_prof.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "LLM_PREFETCH";
+
+llm_prefetch_t *llm_prefetch_create(size_t buf_size)
+{
+    llm_prefetch_t *pf = calloc(1, sizeof(llm_prefetch_t));
+    if (!pf) {
+        return NULL;
+    }
+    pf->buf_size = buf_size;
+    pf->buf[0] = llm_port_malloc_internal(buf_size);
+    pf->buf[1] = llm_port_malloc_internal(buf_size);
+    pf->done = llm_sem_create();
+    if (!pf->buf[0] || !pf->buf[1] || !pf->done) {
+        if (pf->done) {
+            llm_sem_delete(pf->done);
+        }
+        free(pf->buf[0]);
+        free(pf->buf[1]);
+        free(pf);
+        return NULL;
+    }
+    pf->in_use = -1;
+    pf->enabled = 1;
+    return pf;
+}
+
+void llm_prefetch_issue(llm_prefetch_t *pf, const void *src, size_t size)
+{
+    if (!pf->enabled || pf->pending || size > pf->buf_size || !llm_port_is_external(src)) {
+        return;
+    }
+    pf->pending_buf = pf->in_use == 0 ? 1 : 0;
+    pf->pending = src;
+    pf->stats.bytes += size;
+    if (llm_port_memcpy_async(pf->buf[pf->pending_buf], src, size, pf->done) != 0) {
+        // still worth it: the copy streams PSRAM sequentially, the matmul would not
+        memcpy(pf->buf[pf->pending_buf], src, size);
+        pf->stats.sync++;
+        llm_sem_give(pf->done);
+    }
+}
+
+const void *llm_prefetch_take(llm_prefetch_t *pf, const void *src)
+{
+    if (!pf->pending) {
+        pf->in_use = -1;
+        pf->stats.bypassed++;
+        return src;
+    }
+    // a copy in flight has to land before its buffer or the DMA channel is reused
+    LLM_PROF_BEGIN(t0);
+    uint32_t start = llm_port_cycles();
+    llm_sem_take(pf->done);
+    pf->stats.wait_cycles += llm_port_cycles() - start;
+    LLM_PROF_END(LLM_PROF_PREFETCH_WAIT, t0);
+    int staged = pf->pending == src;
+    pf->pending = NULL;
+    if (!staged) {
+        pf->in_use = -1;
+        pf->stats.bypassed++;
+        return src;
+    }
+    pf->in_use = pf->pending_buf;
+    pf->stats.staged++;
+    return pf->buf[pf->in_use];
+}
+
+void llm_prefetch_enable(llm_prefetch_t *pf, int enabled)
+{
+    if (pf->pending) {
+        llm_sem_take(pf->done);
+        pf->pending = NULL;
+    }
+    pf->in_use = -1;
+    pf->enabled = enabled;
+}
+
+void llm_prefetch_reset_stats(llm_prefetch_t *pf)
+{
+    memset(&pf->stats, 0, sizeof(pf->stats));
+}
+
+void llm_prefetch_log(const llm_prefetch_t *pf)
+{
+    const llm_prefetch_stats_t *st = &pf->stats;
+    ESP_LOGI(TAG, "%u matmuls staged, %u in place, %u sync copies, %.1f MB copied, %.1f ms waiting",
+             (unsigned)st->staged, (unsigned)st->bypassed, (unsigned)st->sync,
+             st->bytes / (1024.0f * 1024.0f), st->wait_cycles / (1000.0f * llm_port_cycles_per_us()));
+}
+
+void llm_prefetch_free(llm_prefetch_t *pf)
+{
+    if (!pf) {
+        return;
+    }
+    if (pf->pending) {
+        llm_sem_take(pf->done);
+    }
+    llm_sem_delete(pf->done);
+    free(pf->buf[0]);
+    free(pf->buf[1]);
+    free(pf);
+}
@@ -0,0 +1,79 @@
+#ifndef LLM_PREFETCH_H
+#define LLM_PREFETCH_H
+
+/**
+ * Double-buffered staging of PSRAM weights in internal SRAM.
+ *
+ * Rows read straight from PSRAM go through the 32 KB cache and stall on
+ * every miss. forward() knows which matrix comes next, so while one matmul
+ * reads its weights from staging buffer A, the next matrix is copied into
+ * buffer B by async memcpy (GDMA), which does not occupy either core:
+ *
+ *   take(wq)  issue(wk)  matmul wq from A
+ *   take(wk)  issue(wv)  matmul wk from B
+ *   ...
+ *
+ * take() returns the SRAM copy when the matching issue() went through, and
+ * the original pointer otherwise: weights already in SRAM, matrices larger
+ * than a buffer, or a prefetcher that is switched off.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "llm_port.h"
+
+typedef struct {
+    uint32_t staged;      // matmuls that read their weights from a staging buffer
+    uint32_t bypassed;    // matmuls that read them in place
+    uint32_t sync;        // copies the DMA refused, done with memcpy
+    uint64_t bytes;       // bytes staged
+    uint64_t wait_cycles; // time take() spent waiting for a copy
+} llm_prefetch_stats_t;
+
+typedef struct {
+    float *buf[2];
+    size_t buf_size;
+    int in_use;           // buffer the current matmul reads, -1 if it reads in place
+    const void *pending;  // source of the copy in flight, NULL if none
+    int pending_buf;
+    int enabled;
+    llm_sem_t done;
+    llm_prefetch_stats_t stats;
+} llm_prefetch_t;
+
+/**
+ * @brief Allocates the two staging buffers in internal SRAM
+ * @return The prefetcher, NULL if there is not enough internal RAM
+ */
+llm_prefetch_t *llm_prefetch_create(size_t buf_size);
+
+/**
+ * @brief Starts copying src into the buffer the current matmul isn't using;
+ *        does nothing when src is in SRAM already, too large, or disabled
+ */
+void llm_prefetch_issue(llm_prefetch_t *pf, const void *src, size_t size);
+
+/**
+ * @brief Returns the staged copy of src, waiting for the copy if it is still
+ *        running, or src itself if it was not staged
+ */
+const void *llm_prefetch_take(llm_prefetch_t *pf, const void *src);
+
+/**
+ * @brief Switches staging on or off at run time, to compare per-matmul cycles
+ */
+void llm_prefetch_enable(llm_prefetch_t *pf, int enabled);
+
+void llm_prefetch_reset_stats(llm_prefetch_t *pf);
+
+/**
+ * @brief Logs staged/bypassed matmuls, bytes copied and time spent waiting
+ */
+void llm_prefetch_log(const llm_prefetch_t *pf);
+
+/**
+ * @brief Waits for a copy in flight and frees the buffers
+ */
+void llm_prefetch_free(llm_prefetch_t *pf);
+
+#endif // LLM_PREFETCH_H
@@ -0,0 +1,80 @@
+#include "llm_prof.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *stage_names[LLM_PROF_COUNT] = {
+    [LLM_PROF_EMBED] = "embedding+noise",
+    [LLM_PROF_RMSNORM] = "rmsnorm",
+    [LLM_PROF_MATMUL_Q] = "matmul wq",
+    [LLM_PROF_MATMUL_K] = "matmul wk",
+    [LLM_PROF_MATMUL_V] = "matmul wv",
+    [LLM_PROF_MATMUL_O] = "matmul wo",
+    [LLM_PROF_MATMUL_W13] = "matmul w1/w3+swiglu",
+    [LLM_PROF_MATMUL_W2] = "matmul w2",
+    [LLM_PROF_ROPE] = "rope",
+    [LLM_PROF_ATTN_CORE0] = "attention core0",
+    [LLM_PROF_ATTN_CORE1] = "attention core1",
+    [LLM_PROF_SYNC_WAIT] = "cross-core wait",
+    [LLM_PROF_PREFETCH_WAIT] = "prefetch wait",
+    [LLM_PROF_RESIDUAL_NORM] = "residual+rmsnorm",
+    [LLM_PROF_CLASSIFIER] = "classifier",
+    [LLM_PROF_SAMPLE] = "sample",
+    [LLM_PROF_DECODE] = "decode+output",
+    [LLM_PROF_LED] = "led",
+};
+
+#if CONFIG_LLM_PROFILE
+
+llm_prof_counter_t llm_prof_counters[LLM_PROF_COUNT];
+uint32_t llm_prof_tokens;
+
+void llm_prof_reset(void)
+{
+    memset(llm_prof_counters, 0, sizeof(llm_prof_counters));
+    llm_prof_tokens = 0;
+}
+
+size_t llm_prof_render(char *buf, size_t len)
+{
+    // core 1 runs concurrently and the waits are nested in other stages,
+    // so none of them counts towards the per-token total
+    uint64_t total = 0;
+    for (int i = 0; i < LLM_PROF_COUNT; i++) {
+        if (i != LLM_PROF_ATTN_CORE1 && i != LLM_PROF_SYNC_WAIT && i != LLM_PROF_PREFETCH_WAIT) {
+            total += llm_prof_counters[i].cycles;
+        }
+    }
+    uint32_t tokens = llm_prof_tokens ? llm_prof_tokens : 1;
+    uint32_t per_us = llm_port_cycles_per_us();
+
+    size_t n = snprintf(buf, len, "%-20s %12s %10s %10s %6s\n",
+                        "stage", "cycles/tok", "us/tok", "calls", "share");
+    for (int i = 0; i < LLM_PROF_COUNT && n < len; i++) {
+        uint64_t c = llm_prof_counters[i].cycles;
+        n += snprintf(buf + n, len - n, "%-20s %12llu %10.1f %10lu %5.1f%%\n",
+                      stage_names[i], (unsigned long long)(c / tokens),
+                      (double)c / tokens / per_us, (unsigned long)llm_prof_counters[i].calls,
+                      total ? 100.0 * c / total : 0.0);
+    }
+    if (n < len) {
+        n += snprintf(buf + n, len - n, "%-20s %12llu %10.1f   (%lu tokens)\n", "total",
+                      (unsigned long long)(total / tokens), (double)total / tokens / per_us,
+                      (unsigned long)llm_prof_tokens);
+    }
+    return n < len ? n : len - 1;
+}
+
+#else
+
+void llm_prof_reset(void)
+{
+}
+
+size_t llm_prof_render(char *buf, size_t len)
+{
+    (void)stage_names;
+    int n = snprintf(buf, len, "profiler disabled, enable CONFIG_LLM_PROFILE\n");
+    return (size_t)n < len ? (size_t)n : len - 1;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef LLM_PROF_H
+#define LLM_PROF_H
+
+/**
+ * Per-stage cycle profiler for the inference loop.
+ *
+ * Each stage accumulates CPU cycles (esp_cpu_get_cycle_count on the device,
+ * nanoseconds on the host) and a call count. The counters are plain globals
+ * with no locking: in the split forward core 1 only writes
+ * LLM_PROF_ATTN_CORE1 and core 0 every other stage. Two LLM_EXEC_LOCAL
+ * sessions stepped on different cores would both write every stage, so
+ * CONFIG_LLM_PER_CORE_DREAMS excludes the profiler, and llm_bench skips its
+ * concurrent run when profiling. With CONFIG_LLM_PROFILE unset the macros
+ * compile to nothing.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "llm_port.h"
+
+typedef enum {
+    LLM_PROF_EMBED,         // token embedding + noise
+    LLM_PROF_RMSNORM,
+    LLM_PROF_MATMUL_Q,
+    LLM_PROF_MATMUL_K,
+    LLM_PROF_MATMUL_V,
+    LLM_PROF_MATMUL_O,
+    LLM_PROF_MATMUL_W13,    // w1 and w3 fused with the SwiGLU
+    LLM_PROF_MATMUL_W2,
+    LLM_PROF_ROPE,
+    LLM_PROF_ATTN_CORE0,
+    LLM_PROF_ATTN_CORE1,
+    LLM_PROF_SYNC_WAIT,     // core 0 waiting on core 1, also counted inside matmul/attention
+    LLM_PROF_PREFETCH_WAIT, // waiting for a staged weight copy, also counted inside the matmul
+    LLM_PROF_RESIDUAL_NORM, // residual add fused with the following rmsnorm
+    LLM_PROF_CLASSIFIER,
+    LLM_PROF_SAMPLE,
+    LLM_PROF_DECODE,
+    LLM_PROF_LED,
+    LLM_PROF_COUNT
+} llm_prof_stage_t;
+
+typedef struct {
+    uint64_t cycles;
+    uint32_t calls;
+} llm_prof_counter_t;
+
+#if CONFIG_LLM_PROFILE
+
+extern llm_prof_counter_t llm_prof_counters[LLM_PROF_COUNT];
+extern uint32_t llm_prof_tokens;
+
+#define LLM_PROF_BEGIN(var) uint32_t var = llm_port_cycles()
+#define LLM_PROF_END(stage, var)                                        \
+    do {                                                                \
+        llm_prof_counters[stage].cycles += llm_port_cycles() - (var);   \
+        llm_prof_counters[stage].calls++;                               \
+    } while (0)
+#define LLM_PROF_TOKEN() (llm_prof_tokens++)
+
+#else
+
+#define LLM_PROF_BEGIN(var) do { } while (0)
+#define LLM_PROF_END(stage, var) do { } while (0)
+#define LLM_PROF_TOKEN() do { } while (0)
+
+#endif
+
+/**
+ * @brief Clears all counters, called at the start of every dream
+ */
+void llm_prof_reset(void);
+
+/**
+ * @brief Writes the per-stage table (cycles/token, us/token, share) as plain text
+ * @return Number of characters written, excluding the terminator
+ */
+size_t llm_prof_render(char *buf, size_t len);
+
+#endif // LLM_PROF_H
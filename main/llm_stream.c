@@ -0,0 +1,222 @@
+#include "llm_stream.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "LLM_STREAM";
+
+// matches CKPT_ALIGN, so a slot keeps the alignment the v2 container gives tensors
+#define SLOT_ALIGN 64
+
+static int read_layer(llm_stream_t *s, int slot, int layer)
+{
+    uint8_t *dst = (uint8_t *)s->slot[slot];
+    for (int i = 0; i < s->n_segments; i++) {
+        const llm_stream_segment_t *seg = &s->segments[i];
+        long offset = (long)seg->offset + (long)layer * seg->size;
+        if (fseek(s->file, offset, SEEK_SET) != 0 ||
+            fread(dst + s->segment_off[i], 1, seg->size, s->file) != seg->size) {
+            return -1;
+        }
+        s->stats.bytes += seg->size;
+    }
+    s->stats.loads++;
+    if (s->prepare) {
+        s->prepare(s->slot[slot], layer, s->prepare_arg);
+    }
+    return 0;
+}
+
+static void loader_task(void *arg)
+{
+    llm_stream_t *s = arg;
+    for (;;) {
+        llm_sem_take(s->request);
+        if (s->stop) {
+            break;
+        }
+        s->load_error = read_layer(s, s->load_slot, s->load_layer);
+        s->slot_layer[s->load_slot] = s->load_error ? -1 : s->load_layer;
+        s->load_ready = 1;
+        llm_sem_give(s->done);
+    }
+    // s is freed as soon as done is given
+    llm_sem_give(s->done);
+    llm_task_exit();
+}
+
+llm_stream_t *llm_stream_open(FILE *file, const llm_stream_segment_t *segments, int n_segments,
+                              int n_layers, llm_stream_prepare_fn prepare, void *arg)
+{
+    if (!file || n_segments <= 0 || n_segments > LLM_STREAM_MAX_SEGMENTS || n_layers <= 0) {
+        return NULL;
+    }
+    llm_stream_t *s = calloc(1, sizeof(llm_stream_t));
+    if (!s) {
+        return NULL;
+    }
+    s->file = file;
+    s->n_layers = n_layers;
+    s->n_segments = n_segments;
+    s->prepare = prepare;
+    s->prepare_arg = arg;
+    size_t off = 0;
+    for (int i = 0; i < n_segments; i++) {
+        s->segments[i] = segments[i];
+        s->segment_off[i] = off;
+        off = (off + segments[i].size + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+    }
+    s->slot_size = off;
+    for (int i = 0; i < LLM_STREAM_SLOTS; i++) {
+        s->slot_layer[i] = -1;
+    }
+    return s;
+}
+
+// hands one read to the loader task; the slot is unusable until it is done
+static void issue(llm_stream_t *s, int slot, int layer)
+{
+    s->slot_layer[slot] = -1;
+    s->load_slot = slot;
+    s->load_layer = layer;
+    s->load_ready = 0;
+    s->in_flight = 1;
+    llm_sem_give(s->request);
+}
+
+static int wait_done(llm_stream_t *s)
+{
+    llm_sem_take(s->done);
+    s->in_flight = 0;
+    return s->load_error;
+}
+
+// frees what llm_stream_start() allocated, once the loader task is gone
+static void release(llm_stream_t *s)
+{
+    for (int i = 0; i < LLM_STREAM_SLOTS; i++) {
+        free(s->slot[i]);
+        s->slot[i] = NULL;
+    }
+    if (s->request) {
+        llm_sem_delete(s->request);
+        s->request = NULL;
+    }
+    if (s->done) {
+        llm_sem_delete(s->done);
+        s->done = NULL;
+    }
+}
+
+int llm_stream_start(llm_stream_t *s)
+{
+    for (int i = 0; i < LLM_STREAM_SLOTS; i++) {
+        // PSRAM: a slot is rewritten every token, SRAM is better spent on the activations
+        s->slot[i] = llm_port_malloc_external_aligned(s->slot_size, SLOT_ALIGN);
+        if (!s->slot[i]) {
+            ESP_LOGE(TAG, "No memory for a %u-byte layer slot", (unsigned)s->slot_size);
+            release(s);
+            return -1;
+        }
+    }
+    s->request = llm_sem_create();
+    s->done = llm_sem_create();
+    // below the compute tasks (19): the loader mostly waits on flash reads
+    if (!s->request || !s->done ||
+        llm_task_create(loader_task, "LayerLoader", 4096, s, 10, -1, &s->task) != 0) {
+        ESP_LOGE(TAG, "Couldn't start the layer loader");
+        s->task = NULL;
+        release(s);
+        return -1;
+    }
+    ESP_LOGI(TAG, "Streaming %d layers through 2 slots of %u bytes", s->n_layers, (unsigned)s->slot_size);
+    issue(s, 0, 0);
+    return 0;
+}
+
+float *llm_stream_acquire(llm_stream_t *s, int layer)
+{
+    int slot = -1;
+    for (int i = 0; i < LLM_STREAM_SLOTS; i++) {
+        if (s->slot_layer[i] == layer) {
+            slot = i;
+        }
+    }
+
+    if (s->in_flight) {
+        // the loader reads one layer at a time, so it has to finish before
+        // anything else is issued, whichever layer it is reading
+        int wanted = s->load_layer == layer;
+        int ready = s->load_ready;
+        uint32_t t0 = llm_port_cycles();
+        if (wait_done(s) != 0) {
+            ESP_LOGE(TAG, "Reading layer %d failed", s->load_layer);
+            return NULL;
+        }
+        if (wanted) {
+            slot = s->load_slot;
+            if (ready) {
+                s->stats.hits++;
+            } else {
+                s->stats.misses++;
+                s->stats.stall_us += (llm_port_cycles() - t0) / llm_port_cycles_per_us();
+            }
+        }
+    } else if (slot >= 0) {
+        s->stats.hits++;
+    }
+
+    if (slot < 0) {
+        // not prefetched (first call after a reset, or an out of order layer):
+        // read it now into the slot the previous layer did not use
+        slot = s->slot_layer[0] == layer - 1 ? 1 : 0;
+        uint32_t t0 = llm_port_cycles();
+        issue(s, slot, layer);
+        if (wait_done(s) != 0) {
+            ESP_LOGE(TAG, "Reading layer %d failed", layer);
+            return NULL;
+        }
+        s->stats.misses++;
+        s->stats.stall_us += (llm_port_cycles() - t0) / llm_port_cycles_per_us();
+    }
+
+    // next layer, or layer 0 of the next token, into the other slot
+    int next = (layer + 1) % s->n_layers;
+    int other = 1 - slot;
+    if (s->slot_layer[slot] != next && s->slot_layer[other] != next) {
+        issue(s, other, next);
+    }
+    return s->slot[slot];
+}
+
+void llm_stream_reset_stats(llm_stream_t *s)
+{
+    memset(&s->stats, 0, sizeof(s->stats));
+}
+
+void llm_stream_log(const llm_stream_t *s)
+{
+    const llm_stream_stats_t *st = &s->stats;
+    uint32_t total = st->hits + st->misses;
+    ESP_LOGI(TAG, "prefetch: %u hits, %u misses (%.1f%% hit), %.1f ms waiting, %u layers / %.1f MB read",
+             (unsigned)st->hits, (unsigned)st->misses, total ? 100.0f * st->hits / total : 0.0f,
+             st->stall_us / 1000.0f, (unsigned)st->loads, st->bytes / (1024.0f * 1024.0f));
+}
+
+void llm_stream_close(llm_stream_t *s)
+{
+    if (!s) {
+        return;
+    }
+    if (s->task) {
+        if (s->in_flight) {
+            wait_done(s);
+        }
+        s->stop = 1;
+        llm_sem_give(s->request);
+        llm_sem_take(s->done);
+        s->task = NULL;
+    }
+    release(s);
+    fclose(s->file);
+    free(s);
+}
@@ -0,0 +1,112 @@
+#ifndef LLM_STREAM_H
+#define LLM_STREAM_H
+
+/**
+ * Layer-by-layer weight streaming for checkpoints larger than PSRAM.
+ *
+ * Only two layers of matrices are resident, in two slots. While forward()
+ * computes layer l from one slot, a background task reads layer l + 1 from
+ * the checkpoint file into the other; after the last layer it wraps around
+ * to layer 0 for the next token. With two slots and more than two layers the
+ * wrap-around evicts layer 0 before it is needed again, so every token reads
+ * every layer once (loads grows by n_layers per token). That costs a
+ * predictable share of throughput instead of a hard cap on model size.
+ *
+ * A layer is a list of segments, one per matrix: each segment is a tensor
+ * stacked over the layers in the file, so layer l of it starts at
+ * offset + l * size. In a slot the segments follow each other, each at a
+ * 64-byte aligned offset.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "llm_port.h"
+
+#define LLM_STREAM_MAX_SEGMENTS 8
+#define LLM_STREAM_SLOTS 2
+
+typedef struct {
+    uint32_t offset;    // file offset of the tensor, i.e. of its layer 0
+    uint32_t size;      // bytes per layer
+} llm_stream_segment_t;
+
+// runs on the loader task after a layer was read, e.g. to repack it
+typedef void (*llm_stream_prepare_fn)(float *slot, int layer, void *arg);
+
+typedef struct {
+    uint32_t hits;      // layer already loaded when forward() asked for it
+    uint32_t misses;    // forward() had to wait for the read
+    uint32_t loads;     // layers read from the file
+    uint64_t bytes;     // bytes read from the file
+    uint64_t stall_us;  // time forward() spent waiting on misses
+} llm_stream_stats_t;
+
+typedef struct {
+    FILE *file;
+    int n_layers;
+    int n_segments;
+    llm_stream_segment_t segments[LLM_STREAM_MAX_SEGMENTS];
+    size_t segment_off[LLM_STREAM_MAX_SEGMENTS]; // byte offset in a slot
+    size_t slot_size;
+    float *slot[LLM_STREAM_SLOTS];
+    volatile int slot_layer[LLM_STREAM_SLOTS];  // layer held by each slot, -1 if none
+    llm_stream_prepare_fn prepare;
+    void *prepare_arg;
+    // the one read in flight, handed to the loader task
+    int in_flight;
+    int load_slot;
+    int load_layer;
+    volatile int load_ready;
+    int load_error;
+    int stop;           // the next request ends the loader task
+    llm_sem_t request;
+    llm_sem_t done;
+    llm_task_t task;
+    llm_stream_stats_t stats;
+} llm_stream_t;
+
+/**
+ * @brief Creates a stream over an open checkpoint file and sizes its slots
+ * @param file Checkpoint, owned by the stream from here on
+ * @return The stream, NULL if a segment list is too long or out of memory
+ */
+llm_stream_t *llm_stream_open(FILE *file, const llm_stream_segment_t *segments, int n_segments,
+                              int n_layers, llm_stream_prepare_fn prepare, void *arg);
+
+/**
+ * @brief Allocates the slots, starts the loader task and prefetches layer 0
+ * @return 0 on success, -1 with the slots and semaphores freed again
+ */
+int llm_stream_start(llm_stream_t *s);
+
+/**
+ * @brief Returns the slot holding a layer, waiting for its read if needed, and
+ *        prefetches the next layer into the other slot. The slot returned by
+ *        the previous call must no longer be in use.
+ * @return The slot, NULL if the file could not be read
+ */
+float *llm_stream_acquire(llm_stream_t *s, int layer);
+
+/**
+ * @brief Byte offset of a segment inside a slot
+ */
+static inline size_t llm_stream_segment_offset(const llm_stream_t *s, int segment)
+{
+    return s->segment_off[segment];
+}
+
+void llm_stream_reset_stats(llm_stream_t *s);
+
+/**
+ * @brief Logs hits, misses, wait time and bytes read since the last reset
+ */
+void llm_stream_log(const llm_stream_t *s);
+
+/**
+ * @brief Waits for a read in flight, stops the loader task, frees the slots
+ *        and semaphores and closes the file
+ */
+void llm_stream_close(llm_stream_t *s);
+
+#endif // LLM_STREAM_H
@@ -7,8 +7,12 @@
 #include "esp_event.h"
 #include "esp_random.h"
 #include "esp_timer.h"
+#include "esp_sleep.h"
+#include "esp_wifi.h"
+#include "driver/uart.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/event_groups.h"
 
 #include "llm.h"
@@ -17,16 +21,57 @@
 #include "motion_sensor.h"
 #include "button_manager.h"
 #include "captive_portal.h"
+#include "dream_queue.h"
+#include "power_gov.h"
+#include "standby.h"
+#include "app_events.h"
 
 static const char *TAG = "MAIN";
+
+#define DREAM_PRODUCER_PRIORITY 2   // below the animations and the network stack
+#define DREAM_PRODUCER_CORE 0       // forward() runs here, its worker tasks on core 1
+#define ANIMATOR_CORE 1
+#define TRAIL_NODE_DELAY_MS 200     // about the pace generation lights them at
+#define BUTTON_WAKE_GRACE_MS 2000   // the press that ends a standby is not a click
+#define PORTAL_IDLE_TIMEOUT_MS 30000  // access point up with no station
+
+typedef enum {
+    APP_BOOTING,      // boot pattern on the matrix
+    APP_GENERATING,   // the ring is empty, waiting for the producer
+    APP_ANIMATING,    // the animator is showing a dream
+    APP_PORTAL,       // access point and captive portal up, LEDs paused
+    APP_STANDBY,      // light sleep until motion or the button
+} app_state_t;
+
+static const char *app_state_names[] = {"booting", "generating", "animating", "portal", "standby"};
+
+// owned by app_task: only it reads the event queue and changes these
+static app_state_t app_state = APP_BOOTING;
+static standby_t standby;
+static bool standby_due = false;      // the dream on the LEDs is the last before a standby
+static bool animator_busy = false;
+static int portal_clients = 0;
+static int64_t idle_armed_us = 0;     // when the portal idle timer last started
+static int64_t resumed_us = -BUTTON_WAKE_GRACE_MS * 1000LL;
+
+// the producer's batch, kept across runs when the portal preempts it
+static GenSession session;
+static bool session_open = false;       // producer task only
+static volatile bool yield_generation = false;  // set by app_task, read at token boundaries
+static volatile int64_t yield_requested_us = 0;
+static int64_t worst_yield_us = 0;
+static int64_t worst_portal_us = 0;
+
 static EventGroupHandle_t system_events;
-static bool wifi_requested = false;
+static QueueHandle_t animator_queue;  // dream_t *, one at a time
+static esp_timer_handle_t portal_idle_timer;
 
 // LLM parameters structure
 typedef struct {
     Transformer* transformer;
     Tokenizer* tokenizer;
-    Sampler* sampler;
+    Sampler* sampler;     // CONFIG_LLM_BATCH_SIZE samplers, one per dream of a batch
+    char* prompt;
     int steps;
     generated_complete_cb callback;
     bool dream_ready;
@@ -40,28 +85,84 @@ void generation_complete_callback(float tk_s) {
 
 
 static esp_err_t init_storage(void);
-static void wifi_start_callback(void);
-
-// Callback for motion detection and button press
-static void wifi_start_callback(void) {
-    if (!wifi_requested) {
-        ESP_LOGI(TAG, "Starting WiFi and captive portal");
-        pause_animations();  // Pause animations before starting WiFi
-        esp_err_t err = wifi_manager_start();
+
+// (Re)starts the portal timeout; it posts APP_EV_PORTAL_IDLE when it expires
+static void arm_portal_idle(void) {
+    esp_timer_stop(portal_idle_timer);
+    idle_armed_us = esp_timer_get_time();
+    esp_timer_start_once(portal_idle_timer, PORTAL_IDLE_TIMEOUT_MS * 1000ULL);
+}
+
+static void set_state(app_state_t state) {
+    if (state != app_state) {
+        ESP_LOGI("APP", "%s -> %s", app_state_names[app_state], app_state_names[state]);
+        app_state = state;
+    }
+}
+
+// Brings up the access point and the captive portal, pausing the LEDs
+static bool start_portal(void) {
+    ESP_LOGI(TAG, "Starting WiFi and captive portal");
+    pause_animations();  // Pause animations before starting WiFi
+    power_gov_begin(POWER_ACT_NETWORK);  // no light sleep while the AP is up
+    esp_err_t err = wifi_manager_start();
+    if (err == ESP_OK) {
+        err = captive_portal_init(wifi_manager_get_netif());
         if (err == ESP_OK) {
-            wifi_requested = true;
-            err = captive_portal_init(wifi_manager_get_netif());
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to init captive portal");
-                wifi_manager_stop();
-                wifi_requested = false;
-                resume_animations();  // Resume animations if failed
-            }
-        } else {
-            ESP_LOGE(TAG, "Failed to start WiFi");
-            resume_animations();  // Resume animations if failed
+            portal_clients = 0;
+            arm_portal_idle();
+            return true;
         }
+        ESP_LOGE(TAG, "Failed to init captive portal");
+        wifi_manager_stop();
+    } else {
+        ESP_LOGE(TAG, "Failed to start WiFi");
     }
+    power_gov_end(POWER_ACT_NETWORK);
+    resume_animations();  // Resume animations if failed
+    return false;
+}
+
+// Stops the access point and gives the LEDs back
+static void stop_portal(const char *why) {
+    ESP_LOGI(TAG, "Stopping WiFi: %s", why);
+    esp_timer_stop(portal_idle_timer);
+    wifi_manager_stop();
+    power_gov_end(POWER_ACT_NETWORK);
+    portal_clients = 0;
+    resume_animations();
+}
+
+// Event sources: each only posts, app_task does the work
+
+static void on_button(button_event_t event, void *arg) {
+    switch (event) {
+    case BUTTON_EVENT_CLICK:
+        app_events_post(APP_EV_BUTTON_CLICK);
+        break;
+    case BUTTON_EVENT_DOUBLE_CLICK:
+        app_events_post(APP_EV_BUTTON_DOUBLE);
+        break;
+    case BUTTON_EVENT_LONG_PRESS:
+        app_events_post(APP_EV_BUTTON_LONG);
+        break;
+    }
+}
+
+static void on_shake(void) {
+    app_events_post(APP_EV_SHAKE);
+}
+
+static void on_movement(void) {
+    app_events_post(APP_EV_MOTION);
+}
+
+static void on_portal_idle(void *arg) {
+    app_events_post(APP_EV_PORTAL_IDLE);
+}
+
+static void on_wifi_event(void *arg, esp_event_base_t base, int32_t id, void *data) {
+    app_events_post(id == WIFI_EVENT_AP_STACONNECTED ? APP_EV_CLIENT_JOINED : APP_EV_CLIENT_LEFT);
 }
 
 // Storage initialization
@@ -88,69 +189,314 @@ static esp_err_t init_storage(void) {
     return ret;
 }
 
-// LLM task
-static void llm_task(void *pvParameters) {
-    LLMParams* params = (LLMParams*)pvParameters;
-    bool initial_generation = true;
-    int disconnect_counter = 0;
-    
-    ESP_LOGI("LLM_TASK", "Starting LLM task");
-    
-    // Wait for matrix pattern to complete before starting
-    ESP_LOGI("LLM_TASK", "Waiting for matrix pattern to complete...");
-    while (!(xEventGroupGetBits(matrix_events) & MATRIX_PATTERN_COMPLETE_BIT)) {
-        vTaskDelay(pdMS_TO_TICKS(100));
+static void queue_dream(const char *text, const DreamTrail *trail, void *arg) {
+    if (dream_queue_push(text, trail)) {
+        app_events_post(APP_EV_DREAM_READY);
     }
-    ESP_LOGI("LLM_TASK", "Matrix pattern complete, proceeding with generation");
-    
-    while(1) {
-        if (initial_generation) {
-            // Generate first dream
-            generate(params->transformer, params->tokenizer, params->sampler,
-                    NULL, params->steps, params->callback);
-            
-            // Start first animation
-            animate_dream(llm_output_buffer);
-            initial_generation = false;
-            continue;
+}
+
+static bool generation_should_yield(void *arg) {
+    return yield_generation;
+}
+
+static void log_yield(int pos) {
+    int64_t waited = esp_timer_get_time() - yield_requested_us;
+    if (waited > worst_yield_us) {
+        worst_yield_us = waited;
+    }
+    ESP_LOGI(TAG, "Generation yielded at token %d, %lld us after the request (worst %lld us)",
+             pos, (long long)waited, (long long)worst_yield_us);
+}
+
+// Producer: one run of dreams into the ring, on the inference core. A run
+// the portal preempts pauses at the next token and resumes once it is gone
+static int produce_dreams(void *arg) {
+    LLMParams* params = (LLMParams*)arg;
+    if (yield_generation) {
+        // WiFi is up: no LEDs to feed, and the portal gets the CPU
+        return 0;
+    }
+    power_gov_begin(POWER_ACT_GENERATE);
+    if (!session_open) {
+        gen_session_begin(&session, params->transformer, params->tokenizer, params->sampler,
+                          CONFIG_LLM_BATCH_SIZE, params->prompt, params->steps, queue_dream, NULL);
+        session_open = true;
+    } else {
+        ESP_LOGI(TAG, "Resuming generation at token %d", session.pos);
+    }
+    bool done = gen_session_run(&session, generation_should_yield, NULL);
+    power_gov_end(POWER_ACT_GENERATE);
+    if (!done) {
+        log_yield(session.pos);
+        return 0;
+    }
+    gen_session_end(&session);
+    session_open = false;
+    params->callback(llm_last_stats(params->transformer)->tokens_ps);
+    return CONFIG_LLM_BATCH_SIZE;
+}
+
+#if CONFIG_LLM_PER_CORE_DREAMS
+// Throughput mode: a producer per core, each stepping its own session on
+// its own core with no handoff to the other
+typedef struct {
+    const LlmContext *ctx;
+    LLMParams *params;
+    Sampler sampler;
+    LlmSession *session;    // kept across runs when the portal preempts it
+    int core;
+} CoreProducer;
+
+static int produce_core_dream(void *arg) {
+    CoreProducer *cp = (CoreProducer*)arg;
+    if (yield_generation) {
+        return 0;
+    }
+    if (!cp->session) {
+        cp->session = llm_session_create(cp->ctx, &cp->sampler, cp->params->prompt, cp->params->steps,
+                                         LLM_EXEC_LOCAL);
+        if (!cp->session) {
+            ESP_LOGE(TAG, "No memory for a session on core %d", cp->core);
+            return 0;
+        }
+    } else {
+        ESP_LOGI(TAG, "Core %d resuming generation at token %d", cp->core, cp->session->pos);
+    }
+    power_gov_begin(POWER_ACT_GENERATE);
+    bool done = gen_session_run(cp->session, generation_should_yield, NULL);
+    power_gov_end(POWER_ACT_GENERATE);
+    if (!done) {
+        log_yield(cp->session->pos);
+        return 0;
+    }
+    const GenerateStats *st = &cp->session->stats;
+    ESP_LOGI(TAG, "Core %d: %d tokens in %ld ms, %.2f tok/s, checksum %08lx", cp->core, st->tokens,
+             st->elapsed_ms, st->tokens_ps, (unsigned long)st->checksum);
+    queue_dream(llm_session_text(cp->session), llm_session_trail(cp->session), NULL);
+    cp->params->callback(st->tokens_ps);
+    llm_session_destroy(cp->session);
+    cp->session = NULL;
+    return 1;
+}
+#endif
+
+// Lights the nodes of a dream in the order it lit them while it was generated
+static void replay_trail(const DreamTrail *trail) {
+    for (int i = 0; i < trail->n; i++) {
+        llm_port_activate_node(trail->x[i], trail->y[i]);
+        vTaskDelay(pdMS_TO_TICKS(TRAIL_NODE_DELAY_MS));
+    }
+    // let the last fade in finish before animate_dream() looks for lit nodes
+    vTaskDelay(pdMS_TO_TICKS(FADE_STEPS * FADE_DELAY_MS));
+}
+
+// Feeds the standby policy, logging what it saw in the CSV host/standby_sim reads back
+static standby_action_t standby_feed(standby_event_t ev) {
+    if (ev != STANDBY_EV_DREAM_SHOWN && standby.state == STANDBY_ACTIVE && standby.idle_dreams == 0) {
+        return STANDBY_NONE;  // nobody was missing, not worth a log line
+    }
+    int64_t now = esp_timer_get_time();
+    int64_t wake_us = standby.wake_us;
+    standby_action_t action = standby_event(&standby, ev, now);
+    ESP_LOGI("STANDBY", "standby,%lld,%s", (long long)(now / 1000), standby_event_name(ev));
+    if (action != STANDBY_NONE) {
+        ESP_LOGI("STANDBY", "standby,%lld,%s", (long long)(now / 1000), standby_action_name(action));
+    }
+    if (wake_us >= 0 && standby.wake_us < 0) {
+        float asleep = standby.time_us[STANDBY_ASLEEP] / 1e6f;
+        float total = asleep + standby.time_us[STANDBY_ACTIVE] / 1e6f;
+        float never = standby_nominal_ma(STANDBY_ACTIVE) * total;
+        ESP_LOGI("STANDBY", "Resumed in %.0f ms (max %.0f ms), %u standbys, asleep %.0f%% of the time, "
+                 "energy proxy %.0f mAs vs %.0f mAs without standby",
+                 (now - wake_us) / 1000.0f, standby.latency_max_us / 1000.0f, (unsigned)standby.entries,
+                 total > 0 ? 100.0f * asleep / total : 0.0f, standby_charge_mas(&standby), never);
+    }
+    return action;
+}
+
+// Light sleep until motion or the button. The model stays in PSRAM and the
+// ring keeps its dreams, so the next one is on the LEDs right after waking
+static void enter_standby(void) {
+    ESP_LOGI("STANDBY", "Nobody around for %d dreams, standing by", CONFIG_LLM_STANDBY_IDLE_DREAMS);
+    set_state(APP_STANDBY);
+    matrix_clear();
+    matrix_show();
+    esp_err_t wom = motion_sensor_wom_arm(CONFIG_LLM_STANDBY_WOM_MG);
+    if (wom != ESP_OK) {
+        ESP_LOGW("STANDBY", "No wake-on-motion (%s), only the button wakes up", esp_err_to_name(wom));
+    }
+    // the level the button manager also arms while the button is released
+    gpio_wakeup_enable(BOOT_BUTTON_PIN, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    uart_wait_tx_idle_polling(CONFIG_ESP_CONSOLE_UART_NUM);
+
+    // both sources are GPIO levels, so any other cause is not a reason to resume
+    esp_err_t slept;
+    while ((slept = esp_light_sleep_start()) == ESP_OK && esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_GPIO) {
+        ESP_LOGW("STANDBY", "Woken by cause %d, back to sleep", (int)esp_sleep_get_wakeup_cause());
+        uart_wait_tx_idle_polling(CONFIG_ESP_CONSOLE_UART_NUM);
+    }
+    if (slept != ESP_OK) {
+        // a source already fired while entering the sleep
+        ESP_LOGW("STANDBY", "Light sleep rejected (%s)", esp_err_to_name(slept));
+    }
+
+    // the GPIO cause does not say which pin: INT2 does, the button is the other one
+    standby_event_t source = motion_sensor_wom_fired() ? STANDBY_EV_MOTION : STANDBY_EV_BUTTON;
+    resumed_us = esp_timer_get_time();
+    motion_sensor_wom_disarm();
+    standby_feed(source);
+}
+
+// Hands the next ready dream to the animator, or waits for the producer
+static void show_next_dream(void) {
+    dream_t *dream = dream_queue_pop(0);
+    if (!dream) {
+        set_state(APP_GENERATING);
+        return;
+    }
+    standby_due = standby_feed(STANDBY_EV_DREAM_SHOWN) == STANDBY_ENTER;
+    dream_queue_stats_t stats;
+    dream_queue_get_stats(&stats);
+    ESP_LOGI("APP", "Next dream: %d/%d ready, producer busy %.0f%% of the time, %u waits for a dream",
+             stats.depth, stats.capacity, stats.duty_cycle * 100.0f, (unsigned)stats.starved);
+
+    captive_portal_set_llm_output(dream->text);
+    animator_busy = true;
+    xQueueSend(animator_queue, &dream, portMAX_DELAY);
+    set_state(APP_ANIMATING);
+}
+
+// Animator: plays the dreams app_task hands over, then reports back
+static void animator_task(void *pvParameters) {
+    dream_t *dream;
+    while (1) {
+        xQueueReceive(animator_queue, &dream, portMAX_DELAY);
+        power_gov_begin(POWER_ACT_ANIMATE);
+        replay_trail(&dream->trail);
+        dream_free(dream);
+        animate_dream(llm_output_buffer);
+        power_gov_end(POWER_ACT_ANIMATE);
+        power_gov_log();
+        app_events_post(APP_EV_ANIMATION_DONE);
+    }
+}
+
+// requested_us is when the click or shake was posted
+static void request_portal(int64_t requested_us) {
+    if (app_state == APP_PORTAL) {
+        return;
+    }
+    standby_feed(STANDBY_EV_NETWORK);
+    // the producer pauses at its next token instead of finishing the batch
+    yield_requested_us = esp_timer_get_time();
+    yield_generation = true;
+    if (start_portal()) {
+        int64_t latency = esp_timer_get_time() - requested_us;
+        if (latency > worst_portal_us) {
+            worst_portal_us = latency;
         }
-        
-        // Check if we need to generate new content
-        EventBits_t bits = xEventGroupGetBits(animation_events);
-        bool needs_generation = (bits & GENERATION_NEEDED_BIT) != 0;
-        bool animation_active = (bits & ANIMATION_IN_PROGRESS_BIT) != 0;
-        
-        if (needs_generation && !animation_active && is_animation_enabled()) {
-            ESP_LOGI("LLM_TASK", "Starting new generation");
-            
-            // Clear generation flag before starting
-            xEventGroupClearBits(animation_events, GENERATION_NEEDED_BIT);
-            
-            // Generate new content
-            generate(params->transformer, params->tokenizer, params->sampler,
-                    NULL, params->steps, params->callback);
-            
-            // Start animation if no animation is currently running
-            animate_dream(llm_output_buffer);
+        ESP_LOGI("APP", "AP up %lld ms after the request (worst %lld ms)",
+                 (long long)(latency / 1000), (long long)(worst_portal_us / 1000));
+        set_state(APP_PORTAL);
+    } else {
+        yield_generation = false;
+    }
+}
+
+static void leave_portal(const char *why) {
+    stop_portal(why);
+    yield_generation = false;
+    // the animation the portal interrupted may still be running
+    if (animator_busy) {
+        set_state(APP_ANIMATING);
+    } else {
+        show_next_dream();
+    }
+}
+
+static void handle_event(const app_event_t *ev) {
+    switch (ev->type) {
+    case APP_EV_DREAM_READY:
+        if (app_state == APP_GENERATING) {
+            show_next_dream();
+        }
+        break;
+    case APP_EV_ANIMATION_DONE:
+        animator_busy = false;
+        if (app_state != APP_ANIMATING) {
+            break;  // the portal came up meanwhile
+        }
+        if (standby_due) {
+            standby_due = false;
+            enter_standby();
+        }
+        show_next_dream();
+        break;
+    case APP_EV_BUTTON_CLICK:
+        standby_feed(STANDBY_EV_BUTTON);
+        if (ev->at_us - resumed_us >= BUTTON_WAKE_GRACE_MS * 1000LL) {
+            request_portal(ev->at_us);
+        }
+        break;
+    case APP_EV_SHAKE:
+        request_portal(ev->at_us);
+        break;
+    case APP_EV_BUTTON_LONG:
+        standby_feed(STANDBY_EV_BUTTON);
+        if (app_state == APP_PORTAL) {
+            leave_portal("long press");
+        }
+        break;
+    case APP_EV_BUTTON_DOUBLE: {
+        standby_feed(STANDBY_EV_BUTTON);
+        dream_queue_stats_t stats;
+        dream_queue_get_stats(&stats);
+        ESP_LOGI(TAG, "%s, %d/%d dreams ready, %u produced, %u shown, %u events dropped",
+                 app_state_names[app_state], stats.depth, stats.capacity, (unsigned)stats.produced,
+                 (unsigned)stats.consumed, (unsigned)app_events_dropped());
+        power_gov_log();
+        break;
+    }
+    case APP_EV_MOTION:
+        standby_feed(STANDBY_EV_MOTION);
+        break;
+    case APP_EV_CLIENT_JOINED:
+        if (app_state == APP_PORTAL && portal_clients++ == 0) {
+            esp_timer_stop(portal_idle_timer);
+        }
+        break;
+    case APP_EV_CLIENT_LEFT:
+        if (app_state == APP_PORTAL && portal_clients > 0 && --portal_clients == 0) {
+            arm_portal_idle();
         }
-        
-        // Handle WiFi state
-        wifi_state_t wifi_state = wifi_manager_get_state();
-        if (wifi_state == WIFI_STATE_CLIENT_CONNECTED) {
-            disconnect_counter = 0;
-        } else if (wifi_state == WIFI_STATE_ON) {
-            disconnect_counter++;
-            if (disconnect_counter >= 300) {
-                disconnect_counter = 0;
-                ESP_LOGI("LLM_TASK", "No clients connected for 30 seconds, stopping WiFi");
-                wifi_manager_stop();
-                wifi_requested = false;
-            }
-        } else {
-            disconnect_counter = 0;
+        break;
+    case APP_EV_PORTAL_IDLE:
+        // a station may have joined between the expiry and now, or the
+        // event may be from a timer stopped too late
+        if (app_state == APP_PORTAL && portal_clients == 0 &&
+            ev->at_us - idle_armed_us >= PORTAL_IDLE_TIMEOUT_MS * 1000LL) {
+            ESP_LOGI("APP", "No clients connected for %d seconds", PORTAL_IDLE_TIMEOUT_MS / 1000);
+            leave_portal("idle timeout");
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// App task: sleeps on the event queue and runs the state machine
+static void app_task(void *pvParameters) {
+    ESP_LOGI("APP", "Waiting for matrix pattern to complete...");
+    xEventGroupWaitBits(matrix_events, MATRIX_PATTERN_COMPLETE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    ESP_LOGI("APP", "Matrix pattern complete, proceeding with generation");
+    show_next_dream();
+
+    app_event_t ev;
+    while (1) {
+        if (app_events_wait(&ev, portMAX_DELAY)) {
+            handle_event(&ev);
         }
-        
-        vTaskDelay(pdMS_TO_TICKS(100));
     }
 }
 
@@ -166,6 +512,17 @@ void app_main(void) {
     }
     ESP_ERROR_CHECK(ret);
 
+    // DFS and light sleep, before anything reports an activity
+    ESP_ERROR_CHECK(power_gov_init());
+
+    // Everything below reports to app_task through this queue
+    ESP_ERROR_CHECK(app_events_init());
+    const esp_timer_create_args_t idle_timer_args = {
+        .callback = on_portal_idle,
+        .name = "portal_idle",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&idle_timer_args, &portal_idle_timer));
+
     // Initialize SPIFFS before loading matrix pattern
     ESP_ERROR_CHECK(init_storage());
 
@@ -178,10 +535,18 @@ void app_main(void) {
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     ESP_ERROR_CHECK(wifi_manager_init());
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED,
+                                                        on_wifi_event, NULL, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED,
+                                                        on_wifi_event, NULL, NULL));
 
     // Initialize input devices with callback
-    ESP_ERROR_CHECK(button_manager_init(wifi_start_callback));
-    //ESP_ERROR_CHECK(motion_sensor_init(wifi_start_callback));
+    ESP_ERROR_CHECK(button_manager_init(on_button, NULL));
+    // optional: without the sensor, only the button ends a standby
+    if (motion_sensor_init(on_shake, on_movement) != ESP_OK) {
+        ESP_LOGW(TAG, "No motion sensor, shake and wake-on-motion disabled");
+    }
+    standby_init(&standby, CONFIG_LLM_STANDBY_IDLE_DREAMS, esp_timer_get_time());
 
     // Create matrix pattern task separately
     xTaskCreate(matrix_pattern_task, "matrix_pattern", 4096, NULL, 5, NULL);
@@ -189,7 +554,7 @@ void app_main(void) {
     // Prepare LLM
     Transformer* transformer = malloc(sizeof(Transformer));
     Tokenizer* tokenizer = malloc(sizeof(Tokenizer));
-    Sampler* sampler = malloc(sizeof(Sampler));
+    Sampler* sampler = malloc(CONFIG_LLM_BATCH_SIZE * sizeof(Sampler));
     
     char *checkpoint_path = "/data/aidreams260K.bin";
     char *tokenizer_path = "/data/tok512.bin";
@@ -205,19 +570,68 @@ void app_main(void) {
     }
 
     build_tokenizer(tokenizer, tokenizer_path, transformer->config.vocab_size);
-    build_sampler(sampler, transformer->config.vocab_size, temperature, topp, esp_random());
+    for (int b = 0; b < CONFIG_LLM_BATCH_SIZE; b++) {
+        build_sampler(&sampler[b], transformer->config.vocab_size, temperature, topp, esp_random());
+#if CONFIG_LLM_DETERMINISTIC
+        // dream b of a batch reproduces a single dream with seed + b
+        sampler_set_deterministic(&sampler[b], CONFIG_LLM_BENCH_SEED + b);
+#endif
+    }
+#if CONFIG_LLM_DETERMINISTIC
+    ESP_LOGI(TAG, "Deterministic benchmark mode, seed %d", CONFIG_LLM_BENCH_SEED);
+#endif
+#if !CONFIG_LLM_PER_CORE_DREAMS
+    reserve_batch(transformer, CONFIG_LLM_BATCH_SIZE);
+#endif
 
     // Create LLM parameters with the new callback
     LLMParams* llm_params = malloc(sizeof(LLMParams));
     llm_params->transformer = transformer;
     llm_params->tokenizer = tokenizer;
     llm_params->sampler = sampler;
+#if CONFIG_LLM_DETERMINISTIC
+    llm_params->prompt = CONFIG_LLM_BENCH_PROMPT;
+#else
+    llm_params->prompt = NULL;
+#endif
     llm_params->steps = steps;
     llm_params->callback = generation_complete_callback;  // Use the new non-static callback
 
-    // Create LLM task
-    xTaskCreate(llm_task, "llm_task", 16384,
-                llm_params, 5, NULL);
+#if CONFIG_LLM_PER_CORE_DREAMS
+    // Ring of ready dreams, room for one from each core. The producers stay
+    // below the animator and the app task on core 1 and below Wi-Fi on
+    // core 0, so LED frames and the portal preempt them at once
+    static LlmContext llm_ctx;
+    static CoreProducer core_producers[2];
+    llm_context_init(&llm_ctx, transformer, tokenizer);
+    ESP_ERROR_CHECK(dream_queue_init(CONFIG_LLM_DREAM_QUEUE_DEPTH < 2 ? 2 : CONFIG_LLM_DREAM_QUEUE_DEPTH));
+    for (int c = 0; c < 2; c++) {
+        CoreProducer *cp = &core_producers[c];
+        cp->ctx = &llm_ctx;
+        cp->params = llm_params;
+        cp->core = c;
+        build_sampler(&cp->sampler, transformer->config.vocab_size, temperature, topp, esp_random());
+#if CONFIG_LLM_DETERMINISTIC
+        sampler_set_deterministic(&cp->sampler, CONFIG_LLM_BENCH_SEED + c);
+#endif
+        ESP_ERROR_CHECK(dream_queue_start_producer(produce_core_dream, cp, 1, DREAM_PRODUCER_PRIORITY, c));
+    }
+#else
+    // Ring of ready dreams, always room for a whole batch
+    int ring_size = CONFIG_LLM_DREAM_QUEUE_DEPTH < CONFIG_LLM_BATCH_SIZE ?
+                    CONFIG_LLM_BATCH_SIZE : CONFIG_LLM_DREAM_QUEUE_DEPTH;
+    ESP_ERROR_CHECK(dream_queue_init(ring_size));
+    ESP_ERROR_CHECK(dream_queue_start_producer(produce_dreams, llm_params, CONFIG_LLM_BATCH_SIZE,
+                                               DREAM_PRODUCER_PRIORITY, DREAM_PRODUCER_CORE));
+#endif
+
+    // The animator plays dreams, app_task decides which and when
+    animator_queue = xQueueCreate(1, sizeof(dream_t *));
+    ESP_ERROR_CHECK(animator_queue ? ESP_OK : ESP_ERR_NO_MEM);
+    xTaskCreatePinnedToCore(animator_task, "animator", 4096,
+                            NULL, 5, NULL, ANIMATOR_CORE);
+    xTaskCreatePinnedToCore(app_task, "app", 4096,
+                            NULL, 5, NULL, ANIMATOR_CORE);
 
-    ESP_LOGI(TAG, "Initialization complete - Press button or shake device to enable WiFi");
+    ESP_LOGI(TAG, "Initialization complete - Click the button or shake device to enable WiFi, long-press to stop it");
 }
\ No newline at end of file
@@ -1,44 +1,84 @@
 #include "motion_sensor.h"
+#include "gesture.h"
 #include "esp_log.h"
 #include "driver/i2c.h"
 #include "esp_timer.h"
+#include "esp_sleep.h"
+#include "freertos/semphr.h"
 #include <string.h>
-#include <math.h>
+#include <stdio.h>
 
 static const char *TAG = "MOTION_SENSOR";
 static TaskHandle_t monitor_task_handle = NULL;
 static motion_callback_t motion_cb = NULL;
+static motion_callback_t movement_cb = NULL;
 
-// Riduco le soglie per rendere più sensibile il rilevamento
-#define SHAKE_THRESHOLD           1.2f    // Ridotto da 2.0f
-#define MIN_SHAKE_THRESHOLD      0.8f    // Soglia minima per considerare un movimento
-#define SHAKE_COUNT              8       // Ridotto da 10
-#define SHAKE_WINDOW_MS          1500    // Aumentato da 1000
-#define DEBOUNCE_TIME_MS         100     // Tempo minimo tra due shake
-
-// Registri QMI8658
+// Registri QMI8658 (gli altri sono in motion_sensor.h)
 #define QMI8658_RESET_REG        0x60
-#define QMI8658_CTRL1_REG        0x02  // Output data rate
-#define QMI8658_CTRL2_REG        0x03  // Accelerometer config
-#define QMI8658_CTRL3_REG        0x04  // Gyroscope config
-#define QMI8658_CTRL7_REG        0x08  // Enable sensors
-#define QMI8658_ACCEL_X_L        0x35
-#define QMI8658_ACCEL_X_H        0x36
-#define QMI8658_ACCEL_Y_L        0x37
-#define QMI8658_ACCEL_Y_H        0x38
-#define QMI8658_ACCEL_Z_L        0x39
-#define QMI8658_ACCEL_Z_H        0x3A
+
+#define CTRL1_ADDR_AI            0x40  // auto-incremento dell'indirizzo nelle letture burst
+#define CTRL1_INT2_EN            0x10  // INT2 come uscita push-pull; il FIFO usa INT2
+#define CTRL2_ACC_8G_62HZ        0x27  // aFS = ±8g, aODR = 62.5 Hz
+#define CTRL2_ACC_8G_21HZ_LP     0x2D  // aFS = ±8g, aODR = 21 Hz low power, per il wake-on-motion
+#define CTRL7_ACC_EN             0x01
+#define QMI8658_CAL1_L_REG       0x0B  // soglia WoM in mg
+#define QMI8658_CAL1_H_REG       0x0C  // pin e livello iniziale WoM, campioni di blanking
+#define CAL1_H_WOM_INT2_LOW      0x80  // INT2, parte basso e cambia livello a ogni movimento
+#define WOM_BLANKING_SAMPLES     4     // ignora l'assestamento dopo il cambio di modo
+#define CTRL9_CMD_WRITE_WOM      0x08
+#define FIFO_CTRL_STREAM_32      0x06  // modo stream, 32 campioni
+#define CTRL9_CMD_ACK            0x00
+#define CTRL9_CMD_RST_FIFO       0x04
+#define CTRL9_CMD_REQ_FIFO       0x05
+#define STATUSINT_CMD_DONE       0x80
+#define CTRL9_POLLS              20    // ogni poll è una transazione, circa 50 us
+
+#define SAMPLE_BYTES             6     // solo accelerometro: X, Y, Z a 16 bit
+#define BATCH_PERIOD_MS          ((int)(MOTION_FIFO_BATCH * 1000 / MOTION_ODR_HZ))
+#define STATS_PERIOD_MS          10000
+
+#ifndef CONFIG_LLM_MOTION_INT_GPIO
+#define CONFIG_LLM_MOTION_INT_GPIO -1
+#endif
+
+static SemaphoreHandle_t sensor_lock = NULL;  // il task e il wake-on-motion si alternano sul sensore
+static volatile bool wom_armed = false;
+static volatile uint32_t movements = 0;
+
+static motion_sensor_stats_t stats;
+static int64_t stats_start_us = 0;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void account_i2c(int64_t start_us, size_t bytes) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&stats_lock);
+    stats.transactions++;
+    stats.bytes += bytes;
+    stats.bus_us += now - start_us;
+    portEXIT_CRITICAL(&stats_lock);
+}
 
 static esp_err_t i2c_write_reg(uint8_t reg, uint8_t data) {
     uint8_t write_buf[2] = {reg, data};
-    return i2c_master_write_to_device(I2C_MASTER_NUM, QMI8658_ADDR, write_buf, 
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t ret = i2c_master_write_to_device(I2C_MASTER_NUM, QMI8658_ADDR, write_buf,
                                     sizeof(write_buf), pdMS_TO_TICKS(I2C_MASTER_TIMEOUT_MS));
+    account_i2c(t0, sizeof(write_buf));
+    return ret;
 }
 
-static esp_err_t i2c_read_reg(uint8_t reg, uint8_t* data) {
-    return i2c_master_write_read_device(I2C_MASTER_NUM, QMI8658_ADDR, 
-                                      &reg, 1, data, 1, 
+// Con ADDR_AI attivo una sola transazione legge len registri consecutivi
+static esp_err_t i2c_read_regs(uint8_t reg, uint8_t *data, size_t len) {
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t ret = i2c_master_write_read_device(I2C_MASTER_NUM, QMI8658_ADDR,
+                                      &reg, 1, data, len,
                                       pdMS_TO_TICKS(I2C_MASTER_TIMEOUT_MS));
+    account_i2c(t0, 1 + len);
+    return ret;
+}
+
+static esp_err_t i2c_read_reg(uint8_t reg, uint8_t* data) {
+    return i2c_read_regs(reg, data, 1);
 }
 
 static esp_err_t init_i2c(void) {
@@ -73,6 +113,42 @@ static esp_err_t init_i2c(void) {
 }
 
 
+// Protocollo CTRL9: scrive il comando, attende CmdDone in STATUSINT e
+// conferma con ACK. Risponde in poche decine di microsecondi.
+static esp_err_t ctrl9_command(uint8_t cmd) {
+    esp_err_t ret = i2c_write_reg(QMI8658_CTRL9_REG, cmd);
+    if (ret != ESP_OK) return ret;
+    uint8_t status = 0;
+    for (int i = 0; i < CTRL9_POLLS && !(status & STATUSINT_CMD_DONE); i++) {
+        ret = i2c_read_reg(QMI8658_STATUSINT_REG, &status);
+        if (ret != ESP_OK) return ret;
+    }
+    if (!(status & STATUSINT_CMD_DONE)) {
+        ESP_LOGW(TAG, "CTRL9 command 0x%02x timed out", cmd);
+        return ESP_ERR_TIMEOUT;
+    }
+    return i2c_write_reg(QMI8658_CTRL9_REG, CTRL9_CMD_ACK);
+}
+
+// Accelerometro a 62.5 Hz con batch nel FIFO: il modo normale
+static esp_err_t configure_fifo(void) {
+    esp_err_t ret;
+    // CTRL2: ±8g, 62.5 Hz (vicino ai 50 Hz per cui sono tarate le soglie)
+    ret = i2c_write_reg(QMI8658_CTRL2_REG, CTRL2_ACC_8G_62HZ);
+    if (ret != ESP_OK) return ret;
+
+    // FIFO in modo stream, watermark a un batch
+    ret = i2c_write_reg(QMI8658_FIFO_WTM_TH_REG, MOTION_FIFO_BATCH);
+    if (ret != ESP_OK) return ret;
+    ret = i2c_write_reg(QMI8658_FIFO_CTRL_REG, FIFO_CTRL_STREAM_32);
+    if (ret != ESP_OK) return ret;
+    ret = ctrl9_command(CTRL9_CMD_RST_FIFO);
+    if (ret != ESP_OK) return ret;
+
+    // CTRL7: abilita l'accelerometro
+    return i2c_write_reg(QMI8658_CTRL7_REG, CTRL7_ACC_EN);
+}
+
 static esp_err_t init_qmi8658(void) {
     esp_err_t ret;
     uint8_t data;
@@ -94,22 +170,20 @@ static esp_err_t init_qmi8658(void) {
     if (ret != ESP_OK) return ret;
     vTaskDelay(pdMS_TO_TICKS(50));  // Attesa dopo il reset
 
-    // Configurazione accelerometro:
-    // CTRL1: Output data rate 100Hz (0x06)
-    ret = i2c_write_reg(QMI8658_CTRL1_REG, 0x06);
-    if (ret != ESP_OK) return ret;
-
-    // CTRL2: ±8g range (0x02)
-    ret = i2c_write_reg(QMI8658_CTRL2_REG, 0x02);
+    // CTRL1: letture burst, e INT2 per il watermark del FIFO
+    uint8_t ctrl1 = CTRL1_ADDR_AI;
+    if (CONFIG_LLM_MOTION_INT_GPIO >= 0) {
+        ctrl1 |= CTRL1_INT2_EN;
+    }
+    ret = i2c_write_reg(QMI8658_CTRL1_REG, ctrl1);
     if (ret != ESP_OK) return ret;
 
-    // CTRL7: Enable accelerometer (0x40)
-    ret = i2c_write_reg(QMI8658_CTRL7_REG, 0x40);
+    ret = configure_fifo();
     if (ret != ESP_OK) return ret;
 
     // Verifica che la configurazione sia stata applicata
     ret = i2c_read_reg(QMI8658_CTRL7_REG, &data);
-    if (ret != ESP_OK || !(data & 0x40)) {
+    if (ret != ESP_OK || !(data & CTRL7_ACC_EN)) {
         ESP_LOGE(TAG, "Failed to enable accelerometer");
         return ESP_FAIL;
     }
@@ -118,127 +192,183 @@ static esp_err_t init_qmi8658(void) {
     return ESP_OK;
 }
 
+static void convert(const uint8_t *raw, motion_sensor_data_t *data) {
+    // Converti i dati raw (±8g range)
+    int16_t x = (raw[1] << 8) | raw[0];
+    int16_t y = (raw[3] << 8) | raw[2];
+    int16_t z = (raw[5] << 8) | raw[4];
+
+    data->x = x * 8.0f / 32768.0f;  // Converti a g
+    data->y = y * 8.0f / 32768.0f;
+    data->z = z * 8.0f / 32768.0f;
+}
+
 esp_err_t motion_sensor_read(motion_sensor_data_t *data) {
     if (!data) return ESP_ERR_INVALID_ARG;
 
-    uint8_t raw_data[6];
-    esp_err_t ret;
-    
-    // Leggi i dati asse per asse
-    ret = i2c_read_reg(QMI8658_ACCEL_X_L, &raw_data[0]);
-    if (ret != ESP_OK) return ret;
-    ret = i2c_read_reg(QMI8658_ACCEL_X_H, &raw_data[1]);
-    if (ret != ESP_OK) return ret;
-    
-    ret = i2c_read_reg(QMI8658_ACCEL_Y_L, &raw_data[2]);
-    if (ret != ESP_OK) return ret;
-    ret = i2c_read_reg(QMI8658_ACCEL_Y_H, &raw_data[3]);
-    if (ret != ESP_OK) return ret;
-    
-    ret = i2c_read_reg(QMI8658_ACCEL_Z_L, &raw_data[4]);
-    if (ret != ESP_OK) return ret;
-    ret = i2c_read_reg(QMI8658_ACCEL_Z_H, &raw_data[5]);
+    // Tutti gli assi in una transazione, grazie all'auto-incremento
+    uint8_t raw_data[SAMPLE_BYTES];
+    esp_err_t ret = i2c_read_regs(QMI8658_ACCEL_DATA_REG, raw_data, sizeof(raw_data));
     if (ret != ESP_OK) return ret;
 
-    // Converti i dati raw (±8g range)
-    int16_t x = (raw_data[1] << 8) | raw_data[0];
-    int16_t y = (raw_data[3] << 8) | raw_data[2];
-    int16_t z = (raw_data[5] << 8) | raw_data[4];
+    convert(raw_data, data);
+    return ESP_OK;
+}
 
-    data->x = x * 8.0f / 32768.0f;  // Converti a g
-    data->y = y * 8.0f / 32768.0f;
-    data->z = z * 8.0f / 32768.0f;
+// Legge i campioni accumulati nel FIFO, al massimo max
+static int read_fifo(motion_sensor_data_t *samples, int max) {
+    static uint8_t raw[32 * SAMPLE_BYTES];
+    uint8_t count[2];
+    if (i2c_read_regs(QMI8658_FIFO_SMPL_CNT_REG, count, sizeof(count)) != ESP_OK) {
+        return -1;
+    }
+    // il contatore è in parole da 16 bit
+    int bytes = 2 * (((count[1] & 0x03) << 8) | count[0]);
+    int n = bytes / SAMPLE_BYTES;
+    if (n > max) {
+        n = max;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    if (ctrl9_command(CTRL9_CMD_REQ_FIFO) != ESP_OK ||
+        i2c_read_regs(QMI8658_FIFO_DATA_REG, raw, n * SAMPLE_BYTES) != ESP_OK) {
+        return -1;
+    }
+    // riscrive FIFO_CTRL senza FIFO_RD_MODE per uscire dal modo lettura;
+    // i campioni non letti restano per il prossimo batch
+    if (i2c_write_reg(QMI8658_FIFO_CTRL_REG, FIFO_CTRL_STREAM_32) != ESP_OK) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        convert(&raw[i * SAMPLE_BYTES], &samples[i]);
+    }
+    return n;
+}
 
-    // Debug log dei valori raw
-    static int count = 0;
-    if (++count % 50 == 0) {  // Log ogni 50 letture
-        ESP_LOGI(TAG, "Raw values - X: %d, Y: %d, Z: %d", x, y, z);
+static void process_sample(gesture_t *g, const motion_sensor_data_t *sample, int64_t t_ms) {
+#if CONFIG_LLM_MOTION_LOG_SAMPLES
+    // una riga per campione, da ritagliare in una traccia per host/gesture_bench
+    printf("acc,%lld,%.3f,%.3f,%.3f\n", (long long)t_ms, sample->x, sample->y, sample->z);
+#endif
+    gesture_event_t ev = gesture_update(g, sample->x, sample->y, sample->z);
+    if (ev == GESTURE_NONE) {
+        return;
+    }
+    movements++;
+    if (movement_cb) {
+        movement_cb();
+    }
+    if (ev == GESTURE_SHAKE) {
+        ESP_LOGI(TAG, "*** SHAKE DETECTED at %lld ms ***", (long long)t_ms);
+        if (motion_cb) {
+            motion_cb();
+        }
     }
+}
 
-    return ESP_OK;
+static void IRAM_ATTR fifo_isr(void *arg) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(monitor_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+void motion_sensor_get_stats(motion_sensor_stats_t *out) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    out->elapsed_us = now - stats_start_us;
+    memset(&stats, 0, sizeof(stats));
+    stats_start_us = now;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static void log_stats(void) {
+    motion_sensor_stats_t st;
+    motion_sensor_get_stats(&st);
+    float secs = st.elapsed_us / 1e6f;
+    if (secs <= 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "%.1f wakeups/s, %.1f samples/s, %.1f I2C transactions/s, bus busy %.2f ms/s (%.1f bytes/s)",
+             st.wakeups / secs, st.samples / secs, st.transactions / secs,
+             st.bus_us / 1000.0f / secs, st.bytes / secs);
 }
 
 static void motion_monitor_task(void *pvParameters) {
-    int shake_count = 0;
-    int64_t shake_start_time = 0;
-    int64_t last_shake_time = 0;
-    motion_sensor_data_t last_data = {0};
-    bool first_reading = true;
+    gesture_config_t config;
+    gesture_t shake;
+    gesture_default_config(&config, MOTION_ODR_HZ);
+    gesture_init(&shake, &config);
+    motion_sensor_data_t batch[32];
     int64_t last_print_time = 0;
-    
+    int64_t last_stats_time = 0;
+    // senza pin di interrupt il task si sveglia comunque una volta per batch;
+    // con il pin il timeout copre solo un fronte perso
+    TickType_t wait = pdMS_TO_TICKS(CONFIG_LLM_MOTION_INT_GPIO >= 0 ? 2 * BATCH_PERIOD_MS : BATCH_PERIOD_MS);
+
     // Attendiamo che il sensore si stabilizzi
     vTaskDelay(pdMS_TO_TICKS(500));  // Aumentato a 500ms
-    
-    ESP_LOGI(TAG, "Motion monitoring started");
-    
+    motion_sensor_stats_t discard;
+    motion_sensor_get_stats(&discard);  // misura dalla prima lettura
+
+    ESP_LOGI(TAG, "Motion monitoring started, %d samples per wakeup", MOTION_FIFO_BATCH);
+
     while(1) {
-        motion_sensor_data_t current_data;
-        if (motion_sensor_read(&current_data) == ESP_OK) {
-            // Stampa i valori ogni secondo
-            int64_t current_time = esp_timer_get_time() / 1000;
-            if (current_time - last_print_time > 1000) {
-                ESP_LOGI(TAG, "ACC: X=%.2f Y=%.2f Z=%.2f", 
-                        current_data.x, current_data.y, current_data.z);
-                last_print_time = current_time;
-            }
-
-            if (first_reading) {
-                first_reading = false;
-                memcpy(&last_data, &current_data, sizeof(motion_sensor_data_t));
-                continue;
-            }
-
-            float delta_x = fabsf(current_data.x - last_data.x);
-            float delta_y = fabsf(current_data.y - last_data.y);
-            float delta_z = fabsf(current_data.z - last_data.z);
-            
-            float total_delta = sqrtf(delta_x * delta_x + delta_y * delta_y + delta_z * delta_z);
-
-            // Se c'è un movimento significativo, logghiamo sempre
-            if (total_delta > MIN_SHAKE_THRESHOLD) {
-                ESP_LOGI(TAG, "Movement detected! Delta=%.2f (x:%.2f y:%.2f z:%.2f)", 
-                        total_delta, delta_x, delta_y, delta_z);
-            }
-
-            if (total_delta > SHAKE_THRESHOLD) {
-                if (current_time - last_shake_time > DEBOUNCE_TIME_MS) {
-                    if (shake_count == 0) {
-                        shake_start_time = current_time;
-                        ESP_LOGI(TAG, "Starting shake detection, delta=%.2f", total_delta);
-                    }
-                    shake_count++;
-                    last_shake_time = current_time;
-                    
-                    ESP_LOGI(TAG, "Shake detected! Count: %d, Delta: %.2f", shake_count, total_delta);
-                }
-            }
-            
-            // Verifica se abbiamo raggiunto il numero necessario di shake
-            if (shake_count >= SHAKE_COUNT && 
-                (current_time - shake_start_time) <= SHAKE_WINDOW_MS) {
-                ESP_LOGI(TAG, "*** SHAKE SEQUENCE COMPLETED! Count: %d, Time: %lld ms ***", 
-                         shake_count, (current_time - shake_start_time));
-                if (motion_cb) {
-                    motion_cb();
-                }
-                shake_count = 0;
-                shake_start_time = 0;
-                vTaskDelay(pdMS_TO_TICKS(500));
-            } else if ((current_time - shake_start_time) > SHAKE_WINDOW_MS && shake_count > 0) {
-                ESP_LOGW(TAG, "Shake sequence timeout. Count: %d, Time: %lld ms", 
-                         shake_count, (current_time - shake_start_time));
-                shake_count = 0;
-                shake_start_time = 0;
-            }
-            
-            memcpy(&last_data, &current_data, sizeof(motion_sensor_data_t));
+        // col wake-on-motion armato il FIFO è spento: si attende il disarm
+        ulTaskNotifyTake(pdTRUE, wom_armed ? portMAX_DELAY : wait);
+        if (wom_armed) {
+            continue;
+        }
+        xSemaphoreTake(sensor_lock, portMAX_DELAY);
+        int n = wom_armed ? 0 : read_fifo(batch, sizeof(batch) / sizeof(batch[0]));
+        xSemaphoreGive(sensor_lock);
+        int64_t now_ms = esp_timer_get_time() / 1000;
+        portENTER_CRITICAL(&stats_lock);
+        stats.wakeups++;
+        stats.samples += n > 0 ? n : 0;
+        portEXIT_CRITICAL(&stats_lock);
+        if (n < 0) {
+            ESP_LOGW(TAG, "FIFO read failed");
+            continue;
+        }
+
+        // l'ultimo campione è il più recente, gli altri sono distanziati di un periodo ODR
+        for (int i = 0; i < n; i++) {
+            int64_t t = now_ms - (int64_t)((n - 1 - i) * 1000 / MOTION_ODR_HZ);
+            process_sample(&shake, &batch[i], t);
+        }
+
+        // Stampa i valori ogni secondo
+        if (n > 0 && now_ms - last_print_time > 1000) {
+            ESP_LOGI(TAG, "ACC: X=%.2f Y=%.2f Z=%.2f",
+                    batch[n - 1].x, batch[n - 1].y, batch[n - 1].z);
+            last_print_time = now_ms;
+        }
+        if (now_ms - last_stats_time > STATS_PERIOD_MS) {
+            log_stats();
+            last_stats_time = now_ms;
         }
-        
-        vTaskDelay(pdMS_TO_TICKS(20));  // Ridotto il polling a 50Hz
     }
 }
 
-esp_err_t motion_sensor_init(motion_callback_t motion_detected_cb) {
+static esp_err_t init_int_pin(void) {
+    gpio_config_t io_conf = {
+        .pin_bit_mask = (1ULL << CONFIG_LLM_MOTION_INT_GPIO),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_ENABLE,
+        .intr_type = GPIO_INTR_POSEDGE
+    };
+    esp_err_t err = gpio_config(&io_conf);
+    if (err != ESP_OK) return err;
+    // il servizio può essere già installato dal button manager
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return err;
+    return gpio_isr_handler_add(CONFIG_LLM_MOTION_INT_GPIO, fifo_isr, NULL);
+}
+
+esp_err_t motion_sensor_init(motion_callback_t motion_detected_cb, motion_callback_t on_movement) {
     if (monitor_task_handle != NULL) {
         return ESP_ERR_INVALID_STATE;
     }
@@ -258,6 +388,9 @@ esp_err_t motion_sensor_init(motion_callback_t motion_detected_cb) {
     }
 
     motion_cb = motion_detected_cb;
+    movement_cb = on_movement;
+    sensor_lock = xSemaphoreCreateMutex();
+    if (!sensor_lock) return ESP_ERR_NO_MEM;
     
     BaseType_t ret = xTaskCreate(motion_monitor_task, "motion_monitor", 4096,
                                 NULL, tskIDLE_PRIORITY + 3, &monitor_task_handle);
@@ -266,6 +399,14 @@ esp_err_t motion_sensor_init(motion_callback_t motion_detected_cb) {
         ESP_LOGE(TAG, "Failed to create motion monitor task");
         return ESP_FAIL;
     }
+
+    if (CONFIG_LLM_MOTION_INT_GPIO >= 0) {
+        err = init_int_pin();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to set up the FIFO interrupt on GPIO %d", CONFIG_LLM_MOTION_INT_GPIO);
+            return err;
+        }
+    }
     
     ESP_LOGI(TAG, "Motion sensor initialized successfully");
     return ESP_OK;
@@ -277,7 +418,77 @@ esp_err_t motion_sensor_stop(void) {
         return ESP_ERR_INVALID_STATE;
     }
 
+    if (CONFIG_LLM_MOTION_INT_GPIO >= 0) {
+        gpio_isr_handler_remove(CONFIG_LLM_MOTION_INT_GPIO);
+    }
     vTaskDelete(monitor_task_handle);
     monitor_task_handle = NULL;
     return i2c_driver_delete(I2C_MASTER_NUM);
-}
\ No newline at end of file
+}
+
+uint32_t motion_sensor_movements(void) {
+    return movements;
+}
+
+esp_err_t motion_sensor_wom_arm(uint8_t threshold_mg) {
+    if (monitor_task_handle == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (CONFIG_LLM_MOTION_INT_GPIO < 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    xSemaphoreTake(sensor_lock, portMAX_DELAY);
+    wom_armed = true;
+    // sequenza del datasheet: sensori spenti, ODR a basso consumo, soglia,
+    // comando WoM, accelerometro di nuovo acceso
+    esp_err_t ret = i2c_write_reg(QMI8658_CTRL7_REG, 0);
+    if (ret == ESP_OK) ret = i2c_write_reg(QMI8658_CTRL2_REG, CTRL2_ACC_8G_21HZ_LP);
+    if (ret == ESP_OK) ret = i2c_write_reg(QMI8658_CAL1_L_REG, threshold_mg);
+    if (ret == ESP_OK) ret = i2c_write_reg(QMI8658_CAL1_H_REG, CAL1_H_WOM_INT2_LOW | WOM_BLANKING_SAMPLES);
+    if (ret == ESP_OK) ret = ctrl9_command(CTRL9_CMD_WRITE_WOM);
+    if (ret == ESP_OK) ret = i2c_write_reg(QMI8658_CTRL7_REG, CTRL7_ACC_EN);
+    if (ret == ESP_OK) {
+        // INT2 parte basso: il primo movimento lo alza e sveglia il chip.
+        // L'interrupt resta mascherato, un livello lo farebbe scattare di continuo
+        gpio_intr_disable(CONFIG_LLM_MOTION_INT_GPIO);
+        gpio_wakeup_enable(CONFIG_LLM_MOTION_INT_GPIO, GPIO_INTR_HIGH_LEVEL);
+        ret = esp_sleep_enable_gpio_wakeup();
+    }
+    xSemaphoreGive(sensor_lock);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to arm wake-on-motion (%s)", esp_err_to_name(ret));
+        motion_sensor_wom_disarm();
+        return ret;
+    }
+    ESP_LOGI(TAG, "Wake-on-motion armed at %d mg", threshold_mg);
+    return ESP_OK;
+}
+
+bool motion_sensor_wom_fired(void) {
+    // INT2 cambia livello a ogni movimento: letto subito dopo il risveglio è
+    // ancora alto per quello che l'ha causato
+    return wom_armed && gpio_get_level(CONFIG_LLM_MOTION_INT_GPIO) == 1;
+}
+
+esp_err_t motion_sensor_wom_disarm(void) {
+    if (!wom_armed) {
+        return ESP_OK;
+    }
+    xSemaphoreTake(sensor_lock, portMAX_DELAY);
+    gpio_wakeup_disable(CONFIG_LLM_MOTION_INT_GPIO);
+    gpio_set_intr_type(CONFIG_LLM_MOTION_INT_GPIO, GPIO_INTR_POSEDGE);
+    // soglia 0 spegne il WoM, poi di nuovo il FIFO
+    esp_err_t ret = i2c_write_reg(QMI8658_CTRL7_REG, 0);
+    if (ret == ESP_OK) ret = i2c_write_reg(QMI8658_CAL1_L_REG, 0);
+    if (ret == ESP_OK) ret = i2c_write_reg(QMI8658_CAL1_H_REG, 0);
+    if (ret == ESP_OK) ret = ctrl9_command(CTRL9_CMD_WRITE_WOM);
+    if (ret == ESP_OK) ret = configure_fifo();
+    gpio_intr_enable(CONFIG_LLM_MOTION_INT_GPIO);
+    wom_armed = false;
+    xSemaphoreGive(sensor_lock);
+    xTaskNotifyGive(monitor_task_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to restore FIFO acquisition (%s)", esp_err_to_name(ret));
+    }
+    return ret;
+}
@@ -10,10 +10,16 @@
 // QMI8658 specifiche
 #define QMI8658_ADDR               0x6B
 #define QMI8658_WHO_AM_I_REG      0x00
-#define QMI8658_CTRL7_REG         0x15
-#define QMI8658_CTRL8_REG         0x16
-#define QMI8658_CTRL9_REG         0x17
-#define QMI8658_ACCEL_DATA_REG    0x35
+#define QMI8658_CTRL1_REG         0x02  // interfaccia e interrupt
+#define QMI8658_CTRL2_REG         0x03  // fondo scala e ODR accelerometro
+#define QMI8658_CTRL7_REG         0x08  // abilitazione sensori
+#define QMI8658_CTRL9_REG         0x0A  // comandi al sensore
+#define QMI8658_FIFO_WTM_TH_REG   0x13
+#define QMI8658_FIFO_CTRL_REG     0x14
+#define QMI8658_FIFO_SMPL_CNT_REG 0x15  // seguito da FIFO_STATUS (0x16)
+#define QMI8658_FIFO_DATA_REG     0x17
+#define QMI8658_STATUSINT_REG     0x2D
+#define QMI8658_ACCEL_DATA_REG    0x35  // AX_L..AZ_H, letti in un'unica transazione
 
 // Configurazione I2C
 #define I2C_MASTER_SCL_IO         12
@@ -22,12 +28,12 @@
 #define I2C_MASTER_FREQ_HZ        400000
 #define I2C_MASTER_TIMEOUT_MS     100
 
-// Nel motion_sensor.h
-#define SHAKE_THRESHOLD           0.8f    // Ridotto ulteriormente
-#define MIN_SHAKE_THRESHOLD      0.4f    // Ridotto ulteriormente
-#define SHAKE_COUNT              6       // Ridotto il numero di shake necessari
-#define SHAKE_WINDOW_MS          2000    // Aumentato la finestra temporale
-#define DEBOUNCE_TIME_MS         100     // Mantenuto il debounce
+// le soglie dello shake sono in gesture.c (gesture_default_config)
+
+// Campioni per risveglio: il FIFO li accumula a MOTION_ODR_HZ e il task
+// li legge tutti insieme quando scatta il watermark
+#define MOTION_ODR_HZ             62.5f
+#define MOTION_FIFO_BATCH         16
 
 typedef void (*motion_callback_t)(void);
 
@@ -39,10 +45,11 @@ typedef struct {
 
 /**
  * @brief Inizializza il sensore di movimento
- * @param motion_detected_cb Callback da chiamare quando viene rilevato movimento
+ * @param motion_detected_cb Callback da chiamare quando viene riconosciuto uno shake
+ * @param movement_cb Callback da chiamare a ogni movimento, anche NULL
  * @return ESP_OK in caso di successo
  */
-esp_err_t motion_sensor_init(motion_callback_t motion_detected_cb);
+esp_err_t motion_sensor_init(motion_callback_t motion_detected_cb, motion_callback_t movement_cb);
 
 /**
  * @brief Ferma il monitoraggio del movimento
@@ -57,4 +64,43 @@ esp_err_t motion_sensor_stop(void);
  */
 esp_err_t motion_sensor_read(motion_sensor_data_t *data);
 
+typedef struct {
+    uint32_t wakeups;       // volte che il task di monitoraggio si è svegliato
+    uint32_t samples;       // campioni letti dal FIFO
+    uint32_t transactions;  // transazioni I2C
+    uint32_t bytes;         // byte letti e scritti sul bus
+    int64_t bus_us;         // tempo passato dentro le transazioni I2C
+    int64_t elapsed_us;     // durata della finestra di misura
+} motion_sensor_stats_t;
+
+/**
+ * @brief Statistiche di acquisizione dall'ultima chiamata, che le azzera
+ */
+void motion_sensor_get_stats(motion_sensor_stats_t *stats);
+
+/**
+ * @brief Movimenti rilevati dall'avvio, per capire se c'è qualcuno intorno
+ */
+uint32_t motion_sensor_movements(void);
+
+/**
+ * @brief Passa il sensore in wake-on-motion a basso consumo: il FIFO si ferma
+ *        e il primo movimento oltre la soglia alza INT2, che sveglia il chip
+ *        dal light sleep
+ * @return ESP_OK in caso di successo, ESP_ERR_NOT_SUPPORTED senza pin INT2
+ */
+esp_err_t motion_sensor_wom_arm(uint8_t threshold_mg);
+
+/**
+ * @brief Spegne il wake-on-motion e riprende l'acquisizione dal FIFO
+ * @return ESP_OK in caso di successo
+ */
+esp_err_t motion_sensor_wom_disarm(void);
+
+/**
+ * @brief Dice se il wake-on-motion armato ha visto un movimento, cioè se
+ *        INT2 è alto. Va chiamata dopo il risveglio e prima del disarm
+ */
+bool motion_sensor_wom_fired(void);
+
 #endif // MOTION_SENSOR_H
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "power_gov.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_pm.h"
+
+static const char *TAG = "POWER";
+
+#ifndef CONFIG_LLM_POWER_LIGHT_SLEEP
+#define CONFIG_LLM_POWER_LIGHT_SLEEP 0
+#endif
+
+#define MIN_FREQ_MHZ 80   // APB stays at 80 MHz from here up, so RMT and Wi-Fi timing hold
+
+static power_policy_t policy;
+static SemaphoreHandle_t policy_mutex = NULL;  // the producer and the animator report from both cores
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t cpu_max_lock = NULL;
+static esp_pm_lock_handle_t no_sleep_lock = NULL;
+#endif
+static power_level_t applied = POWER_LEVEL_SLEEP;
+
+esp_err_t power_gov_init(void) {
+    policy_mutex = xSemaphoreCreateMutex();
+    if (!policy_mutex) {
+        return ESP_ERR_NO_MEM;
+    }
+    power_policy_init(&policy, esp_timer_get_time());
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = MIN_FREQ_MHZ,
+        .light_sleep_enable = CONFIG_LLM_POWER_LIGHT_SLEEP,
+    };
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure DFS (%s)", esp_err_to_name(err));
+        return err;
+    }
+    if ((err = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "generate", &cpu_max_lock)) != ESP_OK ||
+        (err = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "network", &no_sleep_lock)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the PM locks (%s)", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "DFS %d-%d MHz, light sleep %s", MIN_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+             CONFIG_LLM_POWER_LIGHT_SLEEP ? "on" : "off");
+#else
+    ESP_LOGW(TAG, "CONFIG_PM_ENABLE is off, the CPU stays at %d MHz", CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+#endif
+    return ESP_OK;
+}
+
+// MAX holds both locks, AWAKE only the sleep one; acquire before release so
+// the level never dips below the lower of the two on the way
+static void apply(power_level_t level) {
+#if CONFIG_PM_ENABLE
+    bool had_cpu = applied == POWER_LEVEL_MAX, want_cpu = level == POWER_LEVEL_MAX;
+    bool had_awake = applied >= POWER_LEVEL_AWAKE, want_awake = level >= POWER_LEVEL_AWAKE;
+    if (want_cpu && !had_cpu) {
+        esp_pm_lock_acquire(cpu_max_lock);
+    }
+    if (want_awake && !had_awake) {
+        esp_pm_lock_acquire(no_sleep_lock);
+    }
+    if (had_cpu && !want_cpu) {
+        esp_pm_lock_release(cpu_max_lock);
+    }
+    if (had_awake && !want_awake) {
+        esp_pm_lock_release(no_sleep_lock);
+    }
+#endif
+    applied = level;
+}
+
+static void report(power_activity_t act, bool begin) {
+    xSemaphoreTake(policy_mutex, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    power_level_t level = begin ? power_policy_begin(&policy, act, now)
+                                : power_policy_end(&policy, act, now);
+    if (level != applied) {
+        apply(level);
+    }
+    xSemaphoreGive(policy_mutex);
+    // one line per event, in the CSV host/power_replay reads back
+    ESP_LOGI(TAG, "phase,%lld,%s,%s", (long long)(now / 1000), power_activity_name(act),
+             begin ? "begin" : "end");
+}
+
+void power_gov_begin(power_activity_t act) {
+    report(act, true);
+}
+
+void power_gov_end(power_activity_t act) {
+    report(act, false);
+}
+
+void power_gov_log(void) {
+    power_policy_t snapshot;
+    xSemaphoreTake(policy_mutex, portMAX_DELAY);
+    power_policy_account(&policy, esp_timer_get_time());
+    snapshot = policy;
+    xSemaphoreGive(policy_mutex);
+
+    int64_t total = 0;
+    for (int i = 0; i < POWER_LEVEL_COUNT; i++) {
+        total += snapshot.time_us[i];
+    }
+    for (int i = 0; i < POWER_LEVEL_COUNT; i++) {
+        ESP_LOGI(TAG, "%-5s (>= %3d MHz) %8.1f s  %5.1f%%", power_level_name(i), power_level_min_mhz(i),
+                 snapshot.time_us[i] / 1e6, total ? 100.0 * snapshot.time_us[i] / total : 0.0);
+    }
+    float always_max = power_level_nominal_ma(POWER_LEVEL_MAX) * (total / 1e6f);
+    float charge = power_policy_charge_mas(&snapshot);
+    ESP_LOGI(TAG, "%u level changes, energy proxy %.0f mAs vs %.0f mAs at a fixed %d MHz (%.0f%% saved)",
+             (unsigned)snapshot.transitions, charge, always_max, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+             always_max > 0 ? 100.0f * (1.0f - charge / always_max) : 0.0f);
+#if CONFIG_PM_PROFILING
+    // the time esp_pm itself spent in each mode, to check the proxy against
+    esp_pm_dump_locks(stdout);
+#endif
+}
@@ -0,0 +1,39 @@
+#ifndef POWER_GOV_H
+#define POWER_GOV_H
+
+/**
+ * Power governor: applies power_policy.h to the chip through esp_pm.
+ *
+ * Dynamic frequency scaling runs between 80 and 240 MHz with automatic
+ * light sleep. A CPU_FREQ_MAX lock is held while any dream is generated and
+ * a NO_LIGHT_SLEEP lock while Wi-Fi is up; with neither, the chip drops to
+ * 80 MHz and sleeps whenever every task is blocked, e.g. between the frames
+ * of the pulse animation. Without CONFIG_PM_ENABLE the locks are no-ops and
+ * only the accounting runs.
+ */
+
+#include "esp_err.h"
+#include "power_policy.h"
+
+/**
+ * @brief Configures DFS and light sleep and creates the locks
+ * @return ESP_OK in caso di successo
+ */
+esp_err_t power_gov_init(void);
+
+/**
+ * @brief Reports that an activity started, raising the level if it needs more
+ */
+void power_gov_begin(power_activity_t act);
+
+/**
+ * @brief Reports that an activity finished, lowering the level if nothing else needs it
+ */
+void power_gov_end(power_activity_t act);
+
+/**
+ * @brief Logs the time spent at each level since boot and the energy proxy
+ */
+void power_gov_log(void);
+
+#endif // POWER_GOV_H
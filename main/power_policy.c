@@ -0,0 +1,99 @@
+#include "power_policy.h"
+#include <string.h>
+
+static const char *activity_names[POWER_ACT_COUNT] = {"generate", "animate", "network"};
+
+static const struct {
+    const char *name;
+    int min_mhz;
+    // ballpark ESP32-S3 supply current at the level, radio off: both cores
+    // busy at 240 MHz, mostly-idle cores at 80 MHz, and the duty-cycled mix of
+    // 80 MHz LED frames and light sleep in between. Only the ratios matter.
+    float nominal_ma;
+} levels[POWER_LEVEL_COUNT] = {
+    [POWER_LEVEL_SLEEP] = {"sleep", 80, 8.0f},
+    [POWER_LEVEL_AWAKE] = {"awake", 80, 25.0f},
+    [POWER_LEVEL_MAX] = {"max", 240, 65.0f},
+};
+
+static power_level_t required_level(const power_policy_t *p)
+{
+    if (p->active[POWER_ACT_GENERATE] > 0) {
+        return POWER_LEVEL_MAX;
+    }
+    if (p->active[POWER_ACT_NETWORK] > 0) {
+        return POWER_LEVEL_AWAKE;
+    }
+    // animation frames are short RMT bursts 12-25 ms apart: the CPU can
+    // run at the minimum and sleep between them
+    return POWER_LEVEL_SLEEP;
+}
+
+void power_policy_init(power_policy_t *p, int64_t now_us)
+{
+    memset(p, 0, sizeof(*p));
+    p->level = POWER_LEVEL_SLEEP;
+    p->since_us = now_us;
+}
+
+void power_policy_account(power_policy_t *p, int64_t now_us)
+{
+    if (now_us > p->since_us) {
+        p->time_us[p->level] += now_us - p->since_us;
+        p->since_us = now_us;
+    }
+}
+
+static power_level_t update(power_policy_t *p, int64_t now_us)
+{
+    power_policy_account(p, now_us);
+    power_level_t level = required_level(p);
+    if (level != p->level) {
+        p->level = level;
+        p->transitions++;
+    }
+    return level;
+}
+
+power_level_t power_policy_begin(power_policy_t *p, power_activity_t act, int64_t now_us)
+{
+    p->active[act]++;
+    return update(p, now_us);
+}
+
+power_level_t power_policy_end(power_policy_t *p, power_activity_t act, int64_t now_us)
+{
+    if (p->active[act] > 0) {
+        p->active[act]--;
+    }
+    return update(p, now_us);
+}
+
+const char *power_activity_name(power_activity_t act)
+{
+    return act < POWER_ACT_COUNT ? activity_names[act] : "?";
+}
+
+const char *power_level_name(power_level_t level)
+{
+    return level < POWER_LEVEL_COUNT ? levels[level].name : "?";
+}
+
+int power_level_min_mhz(power_level_t level)
+{
+    return levels[level].min_mhz;
+}
+
+float power_level_nominal_ma(power_level_t level)
+{
+    return levels[level].nominal_ma;
+}
+
+float power_policy_charge_mas(const power_policy_t *p)
+{
+    float mas = 0.0f;
+    for (int i = 0; i < POWER_LEVEL_COUNT; i++) {
+        mas += levels[i].nominal_ma * (p->time_us[i] / 1e6f);
+    }
+    return mas;
+}
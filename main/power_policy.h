@@ -0,0 +1,83 @@
+#ifndef POWER_POLICY_H
+#define POWER_POLICY_H
+
+/**
+ * Power/performance policy, kept apart from esp_pm so the host can replay
+ * recorded phase traces through it (host/power_replay.c).
+ *
+ * The firmware reports what it is doing as nested begin/end pairs of
+ * activities; several can overlap, e.g. the dream producer generating on
+ * core 0 while core 1 animates. The policy turns the set of active
+ * activities into a level, and accounts the time spent at each:
+ *
+ *   MAX     CPU locked at the maximum frequency   any generation running
+ *   AWAKE   DFS down to the minimum, no sleep     Wi-Fi up (the AP must answer)
+ *   SLEEP   DFS plus automatic light sleep        animation only, or idle
+ *
+ * The LED driver keeps its own APB lock while a frame goes out, so RMT
+ * timing holds at every level.
+ */
+
+#include <stdint.h>
+
+typedef enum {
+    POWER_ACT_GENERATE,
+    POWER_ACT_ANIMATE,
+    POWER_ACT_NETWORK,
+    POWER_ACT_COUNT,
+} power_activity_t;
+
+typedef enum {
+    POWER_LEVEL_SLEEP,
+    POWER_LEVEL_AWAKE,
+    POWER_LEVEL_MAX,
+    POWER_LEVEL_COUNT,
+} power_level_t;
+
+typedef struct {
+    int active[POWER_ACT_COUNT];        // begin() minus end() calls per activity
+    power_level_t level;
+    int64_t since_us;                   // time accounted up to here
+    int64_t time_us[POWER_LEVEL_COUNT]; // time spent at each level
+    uint32_t transitions;
+} power_policy_t;
+
+void power_policy_init(power_policy_t *p, int64_t now_us);
+
+/**
+ * @brief Marks an activity as started
+ * @return The level the system has to be at from now on
+ */
+power_level_t power_policy_begin(power_policy_t *p, power_activity_t act, int64_t now_us);
+
+/**
+ * @brief Marks an activity as finished; an end without a begin is ignored
+ * @return The level the system has to be at from now on
+ */
+power_level_t power_policy_end(power_policy_t *p, power_activity_t act, int64_t now_us);
+
+/**
+ * @brief Adds the time since the last event to the current level
+ */
+void power_policy_account(power_policy_t *p, int64_t now_us);
+
+const char *power_activity_name(power_activity_t act);
+const char *power_level_name(power_level_t level);
+
+/**
+ * @brief Lowest CPU frequency a level allows, in MHz
+ */
+int power_level_min_mhz(power_level_t level);
+
+/**
+ * @brief Nominal supply current at a level, the weight of the energy proxy
+ */
+float power_level_nominal_ma(power_level_t level);
+
+/**
+ * @brief Energy proxy: accounted time weighted by a nominal current per level
+ * @return Charge in mA·s
+ */
+float power_policy_charge_mas(const power_policy_t *p);
+
+#endif // POWER_POLICY_H
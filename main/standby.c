@@ -0,0 +1,99 @@
+#include "standby.h"
+#include <string.h>
+
+static const char *event_names[STANDBY_EV_COUNT] = {"shown", "motion", "button", "network"};
+static const char *action_names[] = {"none", "enter", "resume"};
+
+// ballpark supply current, LEDs excluded. Active is the average of a dream
+// cycle under the power governor (host/traces/dream_cycle.csv through
+// power_replay); asleep is light sleep with PSRAM retained plus the
+// accelerometer in low-power wake-on-motion. Only the ratio matters.
+static const float nominal_ma[STANDBY_STATE_COUNT] = {
+    [STANDBY_ACTIVE] = 14.0f,
+    [STANDBY_ASLEEP] = 1.2f,
+};
+
+void standby_init(standby_t *s, int idle_limit, int64_t now_us)
+{
+    memset(s, 0, sizeof(*s));
+    s->idle_limit = idle_limit;
+    s->state = STANDBY_ACTIVE;
+    s->since_us = now_us;
+    s->wake_us = -1;
+}
+
+void standby_account(standby_t *s, int64_t now_us)
+{
+    if (now_us > s->since_us) {
+        s->time_us[s->state] += now_us - s->since_us;
+        s->since_us = now_us;
+    }
+}
+
+static standby_action_t on_active(standby_t *s, standby_event_t ev, int64_t now_us)
+{
+    if (ev != STANDBY_EV_DREAM_SHOWN) {
+        // somebody is around
+        s->idle_dreams = 0;
+        return STANDBY_NONE;
+    }
+    if (s->wake_us >= 0) {
+        // the first dream after a resume closes the latency, and counts as seen
+        int64_t latency = now_us - s->wake_us;
+        s->latency_sum_us += latency;
+        if (latency > s->latency_max_us) {
+            s->latency_max_us = latency;
+        }
+        s->wake_us = -1;
+        return STANDBY_NONE;
+    }
+    if (s->idle_limit > 0 && ++s->idle_dreams >= s->idle_limit) {
+        s->state = STANDBY_ASLEEP;
+        s->idle_dreams = 0;
+        s->entries++;
+        return STANDBY_ENTER;
+    }
+    return STANDBY_NONE;
+}
+
+static standby_action_t on_asleep(standby_t *s, standby_event_t ev, int64_t now_us)
+{
+    if (ev == STANDBY_EV_DREAM_SHOWN) {
+        // nothing is shown while asleep
+        return STANDBY_NONE;
+    }
+    s->state = STANDBY_ACTIVE;
+    s->wake_us = now_us;
+    s->resumes++;
+    return STANDBY_RESUME;
+}
+
+standby_action_t standby_event(standby_t *s, standby_event_t ev, int64_t now_us)
+{
+    standby_account(s, now_us);
+    return s->state == STANDBY_ASLEEP ? on_asleep(s, ev, now_us) : on_active(s, ev, now_us);
+}
+
+const char *standby_event_name(standby_event_t ev)
+{
+    return ev < STANDBY_EV_COUNT ? event_names[ev] : "?";
+}
+
+const char *standby_action_name(standby_action_t action)
+{
+    return action <= STANDBY_RESUME ? action_names[action] : "?";
+}
+
+float standby_nominal_ma(standby_state_t state)
+{
+    return nominal_ma[state];
+}
+
+float standby_charge_mas(const standby_t *s)
+{
+    float mas = 0.0f;
+    for (int i = 0; i < STANDBY_STATE_COUNT; i++) {
+        mas += nominal_ma[i] * (s->time_us[i] / 1e6f);
+    }
+    return mas;
+}
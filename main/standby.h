@@ -0,0 +1,80 @@
+#ifndef STANDBY_H
+#define STANDBY_H
+
+/**
+ * Standby policy: puts the dreamer to sleep when nobody is around, kept
+ * apart from the sleep calls so the host can replay recorded or simulated
+ * event traces through it (host/standby_sim.c).
+ *
+ *   ACTIVE   dreams are generated and animated; every dream shown with no
+ *            motion, button or Wi-Fi since the previous one is an idle
+ *            dream, and the limit-th in a row enters standby
+ *   ASLEEP   LEDs off, chip in light sleep, accelerometer in wake-on-motion;
+ *            motion or the button resumes, with a dream already in the ring
+ *
+ * Resume latency runs from the wake event to the first dream shown after it.
+ */
+
+#include <stdint.h>
+
+typedef enum {
+    STANDBY_ACTIVE,
+    STANDBY_ASLEEP,
+    STANDBY_STATE_COUNT,
+} standby_state_t;
+
+typedef enum {
+    STANDBY_EV_DREAM_SHOWN,
+    STANDBY_EV_MOTION,
+    STANDBY_EV_BUTTON,
+    STANDBY_EV_NETWORK,
+    STANDBY_EV_COUNT,
+} standby_event_t;
+
+typedef enum {
+    STANDBY_NONE,
+    STANDBY_ENTER,   // go to sleep now
+    STANDBY_RESUME,  // woken up: show the next dream
+} standby_action_t;
+
+typedef struct {
+    int idle_limit;                         // idle dreams before standby, 0 never
+    standby_state_t state;
+    int idle_dreams;
+    int64_t since_us;                       // time accounted up to here
+    int64_t time_us[STANDBY_STATE_COUNT];
+    int64_t wake_us;                        // wake event of a resume still waiting for its dream, or -1
+    uint32_t entries;
+    uint32_t resumes;
+    int64_t latency_sum_us;
+    int64_t latency_max_us;
+} standby_t;
+
+void standby_init(standby_t *s, int idle_limit, int64_t now_us);
+
+/**
+ * @brief Feeds an event
+ * @return What the caller has to do about it
+ */
+standby_action_t standby_event(standby_t *s, standby_event_t ev, int64_t now_us);
+
+/**
+ * @brief Adds the time since the last event to the current state
+ */
+void standby_account(standby_t *s, int64_t now_us);
+
+const char *standby_event_name(standby_event_t ev);
+const char *standby_action_name(standby_action_t action);
+
+/**
+ * @brief Energy proxy: accounted time weighted by a nominal current per state
+ * @return Charge in mA·s
+ */
+float standby_charge_mas(const standby_t *s);
+
+/**
+ * @brief The nominal current of a state, in mA
+ */
+float standby_nominal_ma(standby_state_t state);
+
+#endif // STANDBY_H
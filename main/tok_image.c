@@ -0,0 +1,189 @@
+#include "tok_image.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define ALIGN4(x) (((x) + 3u) & ~3u)
+
+static uint32_t fnv1a(const uint8_t *data, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Turns a raw vocab piece into the bytes that are shown to the user:
+// raw byte tokens like '<0x0A>' become the byte itself and any <s> / </s>
+// markers are removed. Returns the text length and sets *flags.
+static size_t decode_piece(const char *piece, size_t len, char *text, uint8_t *flags)
+{
+    *flags = 0;
+    size_t n = 0;
+    if (len == 6 && piece[0] == '<' && piece[1] == '0' && piece[2] == 'x' && piece[5] == '>' &&
+        hex_nibble(piece[3]) >= 0 && hex_nibble(piece[4]) >= 0) {
+        *flags |= TOK_FLAG_BYTE;
+        text[n++] = (char)((hex_nibble(piece[3]) << 4) | hex_nibble(piece[4]));
+    } else {
+        for (size_t i = 0; i < len;) {
+            if (strncmp(piece + i, "<s>", 3) == 0) {
+                *flags |= TOK_FLAG_SPECIAL;
+                i += 3;
+            } else if (strncmp(piece + i, "</s>", 4) == 0) {
+                *flags |= TOK_FLAG_SPECIAL;
+                i += 4;
+            } else {
+                text[n++] = piece[i++];
+            }
+        }
+    }
+    text[n] = '\0';
+
+    if (n > 0 && text[0] == ' ' && piece[0] == ' ') {
+        *flags |= TOK_FLAG_LEADING_SPACE;
+    }
+    // single bytes are only shown when printable, like the old safe_printf() did
+    if (n > 1 || (n == 1 && (isprint((unsigned char)text[0]) || isspace((unsigned char)text[0])))) {
+        *flags |= TOK_FLAG_PRINTABLE;
+    }
+    return n;
+}
+
+// qsort() has no user pointer; the builder runs once at boot so a file-scope
+// reference to the image being sorted is good enough
+static const tok_image_header_t *sort_image = NULL;
+
+static int compare_ids(const void *a, const void *b)
+{
+    return strcmp(tok_image_piece(sort_image, *(const uint16_t *)a),
+                  tok_image_piece(sort_image, *(const uint16_t *)b));
+}
+
+tok_image_header_t *tok_image_build(const uint8_t *legacy, size_t legacy_len, int vocab_size)
+{
+    if (!legacy || vocab_size <= 0 || vocab_size > UINT16_MAX || legacy_len < sizeof(int32_t)) {
+        return NULL;
+    }
+
+    // first pass: validate the legacy stream and size the string blob
+    int32_t max_token_length;
+    memcpy(&max_token_length, legacy, sizeof(int32_t));
+    size_t pos = sizeof(int32_t);
+    size_t blob_size = 0;
+    for (int i = 0; i < vocab_size; i++) {
+        int32_t len;
+        if (pos + sizeof(float) + sizeof(int32_t) > legacy_len) return NULL;
+        memcpy(&len, legacy + pos + sizeof(float), sizeof(int32_t));
+        pos += sizeof(float) + sizeof(int32_t);
+        if (len < 0 || pos + (size_t)len > legacy_len) return NULL;
+        pos += len;
+        blob_size += 2 * ((size_t)len + 1); // raw piece + decoded text, both NUL-terminated
+    }
+
+    tok_image_header_t hdr = {
+        .magic = TOK_IMAGE_MAGIC,
+        .version = TOK_IMAGE_VERSION,
+        .vocab_size = vocab_size,
+        .max_token_length = max_token_length,
+        .source_size = (uint32_t)legacy_len,
+        .source_hash = fnv1a(legacy, legacy_len),
+    };
+    uint32_t off = ALIGN4(sizeof(tok_image_header_t));
+    hdr.scores_off = off;
+    off += vocab_size * sizeof(float);
+    hdr.piece_off = off;
+    off += vocab_size * sizeof(uint32_t);
+    hdr.text_off = off;
+    off += vocab_size * sizeof(uint32_t);
+    hdr.sorted_off = off;
+    off = ALIGN4(off + vocab_size * sizeof(uint16_t));
+    hdr.flags_off = off;
+    off = ALIGN4(off + vocab_size);
+    hdr.blob_off = off;
+
+    uint8_t *image = calloc(1, ALIGN4(off + blob_size)); // covers image_size when no piece shrinks
+    if (!image) {
+        return NULL;
+    }
+    float *scores = (float *)(image + hdr.scores_off);
+    uint32_t *piece_off = (uint32_t *)(image + hdr.piece_off);
+    uint32_t *text_off = (uint32_t *)(image + hdr.text_off);
+    uint16_t *sorted_ids = (uint16_t *)(image + hdr.sorted_off);
+    uint8_t *flags = image + hdr.flags_off;
+    char *blob = (char *)image + hdr.blob_off;
+
+    // second pass: copy pieces and precompute their decoded form
+    pos = sizeof(int32_t);
+    uint32_t blob_pos = 0;
+    for (int i = 0; i < vocab_size; i++) {
+        int32_t len;
+        memcpy(&scores[i], legacy + pos, sizeof(float));
+        memcpy(&len, legacy + pos + sizeof(float), sizeof(int32_t));
+        pos += sizeof(float) + sizeof(int32_t);
+
+        piece_off[i] = blob_pos;
+        memcpy(blob + blob_pos, legacy + pos, len);
+        blob[blob_pos + len] = '\0';
+        blob_pos += len + 1;
+        pos += len;
+
+        text_off[i] = blob_pos;
+        blob_pos += decode_piece(blob + piece_off[i], len, blob + blob_pos, &flags[i]) + 1;
+        sorted_ids[i] = (uint16_t)i;
+    }
+
+    hdr.blob_size = blob_pos;
+    hdr.image_size = ALIGN4(hdr.blob_off + blob_pos);
+    memcpy(image, &hdr, sizeof(hdr));
+
+    sort_image = (const tok_image_header_t *)image;
+    qsort(sorted_ids, vocab_size, sizeof(uint16_t), compare_ids);
+    sort_image = NULL;
+
+    ((tok_image_header_t *)image)->checksum =
+        fnv1a(image + sizeof(tok_image_header_t), hdr.image_size - sizeof(tok_image_header_t));
+    return (tok_image_header_t *)image;
+}
+
+int tok_image_validate(const void *data, size_t len, int vocab_size, const uint8_t *source, size_t source_len)
+{
+    const tok_image_header_t *img = data;
+    if (!img || len < sizeof(tok_image_header_t)) return 0;
+    if (img->magic != TOK_IMAGE_MAGIC || img->version != TOK_IMAGE_VERSION) return 0;
+    if (img->vocab_size != (uint32_t)vocab_size) return 0;
+    if (img->image_size > len || img->image_size < sizeof(tok_image_header_t)) return 0;
+    if ((size_t)img->blob_off + img->blob_size > img->image_size) return 0;
+    if (source && (img->source_size != source_len || img->source_hash != fnv1a(source, source_len))) return 0;
+    return fnv1a((const uint8_t *)data + sizeof(tok_image_header_t),
+                 img->image_size - sizeof(tok_image_header_t)) == img->checksum;
+}
+
+int tok_image_lookup(const tok_image_header_t *img, const char *str)
+{
+    const uint16_t *sorted_ids = (const uint16_t *)((const uint8_t *)img + img->sorted_off);
+    int lo = 0;
+    int hi = (int)img->vocab_size - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(str, tok_image_piece(img, sorted_ids[mid]));
+        if (cmp == 0) {
+            return sorted_ids[mid];
+        }
+        if (cmp < 0) {
+            hi = mid - 1;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,96 @@
+#ifndef TOK_IMAGE_H
+#define TOK_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Precomputed tokenizer image.
+ *
+ * A single contiguous block holding everything the tokenizer needs at runtime.
+ * All references are offsets from the start of the image, so it can be used
+ * in place from a memory-mapped flash partition. Layout (4-byte aligned):
+ *
+ *   tok_image_header_t
+ *   float    scores[vocab_size]         merge scores
+ *   uint32_t piece_off[vocab_size]      raw vocab piece, offset into blob
+ *   uint32_t text_off[vocab_size]       decoded display bytes, offset into blob
+ *   uint16_t sorted_ids[vocab_size]     ids ordered by strcmp() of their piece
+ *   uint8_t  flags[vocab_size]          TOK_FLAG_*
+ *   char     blob[blob_size]            NUL-terminated strings
+ */
+
+#define TOK_IMAGE_MAGIC   0x474D4954  // "TIMG"
+#define TOK_IMAGE_VERSION 2
+
+#define TOK_FLAG_SPECIAL       (1 << 0)  // piece carries a <s> or </s> marker
+#define TOK_FLAG_LEADING_SPACE (1 << 1)  // text starts with a space, dropped after BOS
+#define TOK_FLAG_PRINTABLE     (1 << 2)  // text goes to the output buffer
+#define TOK_FLAG_BYTE          (1 << 3)  // raw byte token, e.g. <0x0A>
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t image_size;        // total size in bytes, header included
+    uint32_t checksum;          // FNV-1a of everything after the header
+    uint32_t source_size;       // size of the legacy file the image was built from
+    uint32_t source_hash;       // FNV-1a of that file, so a new tok512.bin rebuilds it
+    uint32_t vocab_size;
+    uint32_t max_token_length;
+    uint32_t scores_off;
+    uint32_t piece_off;
+    uint32_t text_off;
+    uint32_t sorted_off;
+    uint32_t flags_off;
+    uint32_t blob_off;
+    uint32_t blob_size;
+} tok_image_header_t;
+
+/**
+ * @brief Builds an image from a legacy llama2.c tokenizer file held in memory
+ * @param legacy Contents of the legacy tokenizer file
+ * @param legacy_len Size of the legacy file in bytes
+ * @param vocab_size Number of tokens to read
+ * @return Heap-allocated image (release with free()), NULL on malformed input
+ */
+tok_image_header_t *tok_image_build(const uint8_t *legacy, size_t legacy_len, int vocab_size);
+
+/**
+ * @brief Checks magic, version, bounds and checksum of an image, and that it
+ *        was built from the given legacy file
+ * @param source Contents of the legacy tokenizer file, or NULL when it is not
+ *               available and any source is accepted
+ * @param source_len Size of the legacy file in bytes
+ * @return 1 if the image is usable for the given vocabulary size, 0 otherwise
+ */
+int tok_image_validate(const void *data, size_t len, int vocab_size, const uint8_t *source, size_t source_len);
+
+/**
+ * @brief Finds the id of an exact vocab piece with a binary search over sorted_ids
+ * @return The token id, or -1 if not found
+ */
+int tok_image_lookup(const tok_image_header_t *img, const char *str);
+
+static inline const float *tok_image_scores(const tok_image_header_t *img)
+{
+    return (const float *)((const uint8_t *)img + img->scores_off);
+}
+
+static inline const char *tok_image_piece(const tok_image_header_t *img, int id)
+{
+    const uint32_t *off = (const uint32_t *)((const uint8_t *)img + img->piece_off);
+    return (const char *)img + img->blob_off + off[id];
+}
+
+static inline const char *tok_image_text(const tok_image_header_t *img, int id)
+{
+    const uint32_t *off = (const uint32_t *)((const uint8_t *)img + img->text_off);
+    return (const char *)img + img->blob_off + off[id];
+}
+
+static inline uint8_t tok_image_flags(const tok_image_header_t *img, int id)
+{
+    return ((const uint8_t *)img + img->flags_off)[id];
+}
+
+#endif // TOK_IMAGE_H
@@ -7,6 +7,9 @@
 #include "esp_random.h"
 #include <math.h>
 #include "esp_timer.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
 
 // WS2812B timing (in RMT ticks, 1 tick = 25ns with clock divider of 2)
 #define RMT_CLK_DIV 2
@@ -234,6 +237,12 @@ static rgb_color_t framebuffer[MATRIX_ROWS][MATRIX_COLS] = {0};
 static uint8_t brightness = DEFAULT_BRIGHTNESS;
 static bool node_active[MATRIX_ROWS][MATRIX_COLS] = {0};
 static int total_active_nodes = 0;
+#if CONFIG_PM_ENABLE
+// A frame is 64 separate RMT writes, timed off the 80 MHz APB clock. Light
+// sleep (or APB dropping to XTAL) between them would stretch the gaps past
+// the WS2812 reset time and latch half a frame, so a frame holds APB at max.
+static esp_pm_lock_handle_t frame_lock = NULL;
+#endif
 
 esp_err_t matrix_init(void) {
     ESP_LOGI(TAG, "Initializing LED matrix...");
@@ -271,6 +280,9 @@ esp_err_t matrix_init(void) {
     
     ESP_ERROR_CHECK(rmt_config(&config));
     ESP_ERROR_CHECK(rmt_driver_install(config.channel, 0, 0));
+#if CONFIG_PM_ENABLE
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "led_frame", &frame_lock));
+#endif
     
     // Clear the matrix and set initial state
     matrix_clear();
@@ -328,11 +340,17 @@ void matrix_set_pixel(uint8_t x, uint8_t y, rgb_color_t color) {
 }
 
 void matrix_show(void) {
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(frame_lock);
+#endif
     for (int y = 0; y < MATRIX_ROWS; y++) {
         for (int x = 0; x < MATRIX_COLS; x++) {
             ws2812_send_pixel(framebuffer[y][x]);
         }
     }
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(frame_lock);
+#endif
     vTaskDelay(pdMS_TO_TICKS(1));
 }
 